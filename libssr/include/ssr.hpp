@@ -11,6 +11,8 @@
 
 #include <string>
 #include <list>
+#include <deque>
+#include <vector>
 #include <map>
 #include <functional>
 
@@ -1,22 +1,52 @@
 #ifndef __EVENTLOOP_HPP__
 #define __EVENTLOOP_HPP__
 
+class TimerWheel;
+
 typedef std::function<void(int fd, int evt)> EventLoopCb;
 
+/**
+ * epoll based event loop.
+ *
+ * Registered fds are kept in a slab whose entries never move : epoll events
+ * point directly to them. An entry removed while events are dispatched is
+ * only recycled once the whole batch has been processed.
+ *
+ * Timers don't use their own fd, they share the loop timer wheel. Only
+ * aligned timers, which expire on exact wall clock deadlines, have one.
+ */
 class EventLoop {
+	friend class Timer;
+
 private:
 	struct InternalFd {
-		int mFd;
+		int mFd; // -1 once removed
 		EventLoopCb mCb;
 	};
 
 private:
 	int mEpollFd;
 	int mStopFd;
-	std::list<InternalFd> mFdList;
+
+	// Slab of entries, only grown at the back so entries are stable
+	std::deque<InternalFd> mSlab;
+	std::vector<InternalFd *> mFreeList;
+	std::vector<InternalFd *> mPendingFree;
+	bool mDispatching;
+
+	// Entry of each registered fd, indexed by fd
+	std::vector<InternalFd *> mFdIndex;
+	size_t mFdCount;
+
+	std::vector<struct epoll_event> mEvents;
+
+	// Runs every Timer of the loop
+	TimerWheel *mTimerWheel;
 
 private:
-	int findInternalFd(int fd, std::list<InternalFd>::iterator *internalFd);
+	InternalFd *findInternalFd(int fd) const;
+	InternalFd *allocInternalFd();
+	void releaseInternalFd(InternalFd *internalFd);
 	void readStopFd();
 
 public:
@@ -5,6 +5,27 @@ class EventLoop;
 
 class SystemMonitor {
 public:
+	enum class ReadBackend : uint8_t {
+		pread = 0,
+		uring,
+	};
+
+	enum class StatsBackend : uint8_t {
+		procfs = 0,
+		taskstats,
+	};
+
+	// Timestamps of the procfs reads, always in CLOCK_MONOTONIC time
+	enum class ClockSource : uint8_t {
+		monotonic = 0, // clock_gettime()
+		tsc,           // scaled invariant TSC, x86_64 only
+	};
+
+	enum class TimestampGranularity : uint8_t {
+		read = 0, // around each file read
+		process,  // around the reads of a process and its threads
+	};
+
 	struct SystemConfig {
 		int32_t mClkTck;
 		int32_t mPagesize ;
@@ -34,6 +55,23 @@ public:
 		uint64_t    mRamFree;
 	};
 
+	// One per /proc/stat cpuN line
+	struct CpuStats {
+		uint64_t    mTs;
+		uint64_t    mAcqEnd;
+
+		uint16_t    mCpu;
+
+		// Durations
+		uint64_t    mUtime;
+		uint64_t    mNice;
+		uint64_t    mStime;
+		uint64_t    mIdle;
+		uint64_t    mIoWait;
+		uint64_t    mIrq;
+		uint64_t    mSoftIrq;
+	};
+
 	struct ProcessStats {
 		uint64_t    mTs;
 		uint64_t    mAcqEnd;
@@ -58,17 +96,93 @@ public:
 
 		uint64_t    mUtime;
 		uint64_t    mStime;
+
+		// Same CPU times in nanoseconds. With StatsBackend::taskstats,
+		// they are precise to the microsecond instead of the tick.
+		uint64_t    mUtimeNs;
+		uint64_t    mStimeNs;
+	};
+
+	// Notified as soon as a monitored process exits, after its last
+	// ProcessStats
+	struct ProcessExit {
+		uint64_t    mTs;
+
+		uint32_t    mPid;
+		char        mName[64];
+	};
+
+	// Load shedding level, notified at each change. Readings are
+	// degraded step by step while acquisitions overrun
+	// Config::mAcqBudgetMs : threads are dropped, then processes of the
+	// lowest priorities, then the period is lengthened.
+	struct SheddingStep {
+		uint64_t    mTs;
+
+		// Duration of the acquisition that has triggered the step
+		uint64_t    mDuration;
+
+		uint8_t     mThreadsShed;
+		int32_t     mShedPriority; // processes up to this priority are not read
+		uint32_t    mPeriodFactor;
+	};
+
+	// Why the adaptive cadence has changed the acquisition period
+	enum class CadenceReason : uint8_t {
+		idle = 0, // cpu load under Config::mIdleLoad
+		load,     // cpu load back over Config::mIdleLoad
+		pressure, // PSI trigger on cpu, io or memory
+	};
+
+	// Default acquisition period set by the adaptive cadence, see
+	// Config::mAdaptiveMaxPeriodMs
+	struct CadenceChange {
+		uint64_t    mTs;
+
+		uint32_t    mPeriodMs;
+		int32_t     mLoad; // cpu busy per mille, -1 : unknown
+		uint8_t     mReason; // see CadenceReason
 	};
 
 	struct AcquisitionDuration {
 		uint64_t    mStart;
 		uint64_t    mEnd;
+
+		// Read path used between mStart and mEnd (see ReadBackend)
+		uint8_t     mReadBackend;
+		uint32_t    mReadCount;
+
+		// io_uring only : time spent in io_uring_enter(), submitting
+		// and waiting, and handling the completions. Summed over the
+		// worker jobs.
+		uint64_t    mSubmitTime;
+		uint64_t    mReapTime;
+
+		// Periods skipped since the previous acquisition
+		uint32_t    mMissedTicks;
+
+		// Thread stat fds kept open, and the ones opened only for this
+		// acquisition (see Config::mThreadFdBudget)
+		uint32_t    mThreadFdCount;
+		uint32_t    mReopenCount;
+
+		// Delay between the wall clock deadline of the tick and the
+		// start of its handling
+		uint64_t    mTickLateness;
+
+		// Thread reads skipped because their process was idle (see
+		// Config::mIdleThreadsRefreshMs)
+		uint32_t    mSkippedReads;
 	};
 
 	struct Callbacks {
 		void (*mSystemStats) (const SystemStats &stats, void *userdata);
+		void (*mCpuStats) (const CpuStats &stats, void *userdata);
 		void (*mProcessStats) (const ProcessStats &stats, void *userdata);
 		void (*mThreadStats) (const ThreadStats &stats, void *userdata);
+		void (*mProcessExit) (const ProcessExit &stats, void *userdata);
+		void (*mShedding) (const SheddingStep &step, void *userdata);
+		void (*mCadence) (const CadenceChange &change, void *userdata);
 
 		void (*mResultsBegin) (const AcquisitionDuration &stats, void *userdata);
 		void (*mResultsEnd) (void *userdata);
@@ -78,8 +192,12 @@ public:
 		Callbacks()
 		{
 			mSystemStats = nullptr;
+			mCpuStats = nullptr;
 			mProcessStats = nullptr;
 			mThreadStats = nullptr;
+			mProcessExit = nullptr;
+			mShedding = nullptr;
+			mCadence = nullptr;
 			mResultsBegin = nullptr;
 			mResultsEnd = nullptr;
 			mUserdata = nullptr;
@@ -88,12 +206,80 @@ public:
 
 	struct Config {
 		bool mRecordThreads;
-		int mAcqPeriod; // seconds
+		int mAcqPeriodMs;
+		int mSysStatsPeriodMs; // 0 : mAcqPeriodMs
+		ReadBackend mReadBackend;
+		StatsBackend mStatsBackend;
+		int mJobs; // acquisition threads
+		bool mProcEvents; // process discovery by proc connector
+		int mThreadFdBudget; // thread stat fds kept open, 0 : unlimited
+
+		// Reads are made by dedicated SCHED_FIFO threads with this
+		// priority, and the memory is locked. 0 : disabled
+		int mRtPriority;
+		int mRtCpu; // cpu of the real-time threads, -1 : any
+		ClockSource mClockSource;
+		TimestampGranularity mTsGranularity;
+
+		// Threads of a process without CPU time since they were last
+		// read are only read at this period. 0 : always read
+		int mIdleThreadsRefreshMs;
+
+		// Acquisitions longer than this degrade the next ones, see
+		// SheddingStep. 0 : disabled
+		int mAcqBudgetMs;
+
+		// While the system is idle, the default acquisition period is
+		// doubled up to this one. mAcqPeriodMs is restored as soon as
+		// the cpu load or the PSI rises. 0 : disabled
+		int mAdaptiveMaxPeriodMs;
+		int mIdleLoad; // cpu busy percent under which the system is idle
 
 		Config()
 		{
 			mRecordThreads = true;
-			mAcqPeriod = 1;
+			mAcqPeriodMs = 1000;
+			mSysStatsPeriodMs = 0;
+			mReadBackend = ReadBackend::pread;
+			mStatsBackend = StatsBackend::procfs;
+			mJobs = 1;
+			mProcEvents = false;
+			mThreadFdBudget = 0;
+			mRtPriority = 0;
+			mRtCpu = -1;
+			mClockSource = ClockSource::monotonic;
+			mTsGranularity = TimestampGranularity::read;
+			mIdleThreadsRefreshMs = 0;
+			mAcqBudgetMs = 0;
+			mAdaptiveMaxPeriodMs = 0;
+			mIdleLoad = 10;
+		}
+	};
+
+	// How the addProcess() name selects processes
+	enum class MatchType : uint8_t {
+		name = 0, // task name, truncated to 15 chars by the kernel
+		glob,     // shell pattern on the task name
+		regex,    // POSIX extended regex on the task name
+		cmdline,  // substring of the command line
+		all,      // every process, the name is ignored
+	};
+
+	// Settings of a monitored process, see addProcess()
+	struct ProcessConfig {
+		int mAcqPeriodMs; // 0 : Config::mAcqPeriodMs
+		bool mRecordThreads;
+		MatchType mMatch;
+		bool mAllInstances; // monitor every match, not only the first one
+		int mPriority; // the lowest priorities are shed first
+
+		ProcessConfig()
+		{
+			mAcqPeriodMs = 0;
+			mRecordThreads = true;
+			mMatch = MatchType::name;
+			mAllInstances = false;
+			mPriority = 0;
 		}
 	};
 
@@ -102,13 +288,16 @@ public:
 
 	virtual int readSystemConfig(SystemConfig *config) = 0;
 
+	// Use Config settings
 	virtual int addProcess(const char *name) = 0;
 
+	virtual int addProcess(const char *name, const ProcessConfig &config) = 0;
+
 	virtual int loadProcesses() = 0;
 
 	virtual int clearProcesses() = 0;
 
-	virtual int setAcqPeriod(int acqPeriod) = 0;
+	virtual int setAcqPeriod(int acqPeriodMs) = 0;
 
 	virtual int start() = 0;
 
@@ -2,16 +2,52 @@
 #define __TIMER_HPP__
 
 class EventLoop;
+class TimerWheel;
 
 typedef std::function<void()> TimerCb;
 
+/**
+ * Timer run by an EventLoop. Every timer of a loop shares the loop timer
+ * wheel, and a single timerfd. Aligned timers have their own timerfd
+ * instead, so that they expire on their exact deadlines.
+ */
 class Timer {
+	friend class TimerWheel;
+
+public:
+	// Link in a TimerWheel slot list
+	struct Link {
+		Link *mPrev;
+		Link *mNext;
+		Timer *mTimer;
+	};
+
 private:
 	EventLoop *mLoop;
+	TimerCb mCb;
+
+	// CLOCK_MONOTONIC, in nanoseconds, or CLOCK_REALTIME for an aligned
+	// timer. mPeriod is 0 for a one-shot timer
+	uint64_t mExpiry;
+	uint64_t mPeriod;
+
+	// Periods skipped before the current expiry
+	uint64_t mMissed;
+
+	// Deadline of the current expiry, the last skipped one if any, and
+	// delay between it and the expiry
+	uint64_t mDeadline;
+	uint64_t mLateness;
+
+	// timerfd of an aligned timer, -1 in the wheel
 	int mFd;
 
+	Link mLink;
+	int mSlot;
+
 private:
-	int setInternal(EventLoop *loop, const struct itimerspec &ts, TimerCb cb);
+	int setInternal(EventLoop *loop, uint64_t delay, uint64_t period, TimerCb cb);
+	void onFdEvent();
 
 public:
 	Timer();
@@ -19,7 +55,22 @@ public:
 
 	int set(EventLoop *loop, const struct timespec &ts, TimerCb cb);
 	int setPeriodic(EventLoop *loop, const struct timespec &ts, TimerCb cb);
+
+	// Expire on CLOCK_REALTIME multiples of the period, so that timers
+	// of different hosts tick together. The timerfd is armed with
+	// absolute deadlines, which follow the wall clock adjustments.
+	int setPeriodicAligned(EventLoop *loop, const struct timespec &ts, TimerCb cb);
+
 	int clear();
+
+	// Periods that have been skipped because the loop was late. Only
+	// valid in the timer callback
+	uint64_t getMissed() const { return mMissed; }
+
+	// Delay between the deadline of the current expiry and the time the
+	// timer has been found expired, in nanoseconds. Only valid in the
+	// timer callback
+	uint64_t getLateness() const { return mLateness; }
 };
 
 #endif // !__TIMER_HPP__
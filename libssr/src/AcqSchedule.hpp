@@ -0,0 +1,65 @@
+#ifndef __ACQ_SCHEDULE_HPP__
+#define __ACQ_SCHEDULE_HPP__
+
+/**
+ * Sampling state of a collector.
+ *
+ * Acquisitions are made on a base tick, which divides the period of every
+ * collector. Ticks are numbered from the CLOCK_REALTIME epoch, so a collector
+ * is read on the ticks which are multiples of its period.
+ */
+struct AcqSchedule {
+	int mPeriodMs; // 0 : default acquisition period
+	uint64_t mNextTick;
+	bool mDue;
+
+	AcqSchedule()
+	{
+		mPeriodMs = 0;
+		mNextTick = 0;
+		mDue = true;
+	}
+
+	int getPeriodMs(int defaultPeriodMs) const
+	{
+		return mPeriodMs > 0 ? mPeriodMs : defaultPeriodMs;
+	}
+
+	// Read on the next tick, whatever its index
+	void reset()
+	{
+		mNextTick = 0;
+	}
+
+	// Same next read in the unit of a new tick, so that the phase is kept
+	// across period changes. It is moved earlier only if the period is
+	// now shorter, to the next multiple of the new period.
+	void rescale(uint64_t nowMs, int oldTickMs, int tickMs,
+		     int defaultPeriodMs)
+	{
+		uint64_t periodMs = getPeriodMs(defaultPeriodMs);
+		uint64_t nextMs = mNextTick * oldTickMs;
+		uint64_t maxMs = (nowMs / periodMs + 1) * periodMs;
+
+		if (mNextTick == 0)
+			return;
+
+		if (nextMs > maxMs)
+			nextMs = maxMs;
+
+		mNextTick = (nextMs + tickMs - 1) / tickMs;
+	}
+
+	bool update(uint64_t tick, int tickMs, int defaultPeriodMs)
+	{
+		uint64_t ratio = getPeriodMs(defaultPeriodMs) / tickMs;
+
+		mDue = tick >= mNextTick;
+		if (mDue)
+			mNextTick = (tick / ratio + 1) * ratio;
+
+		return mDue;
+	}
+};
+
+#endif // !__ACQ_SCHEDULE_HPP__
@@ -0,0 +1,70 @@
+#ifndef __ADAPTIVE_CADENCE_HPP__
+#define __ADAPTIVE_CADENCE_HPP__
+
+// Idle system stats before the adaptive cadence doubles the period
+#define CADENCE_IDLE_COUNT 3
+
+/**
+ * Default acquisition period chosen by the adaptive cadence, see
+ * SystemMonitor::CadenceChange.
+ *
+ * After CADENCE_IDLE_COUNT system stats in a row under the idle load, the
+ * period is doubled, up to the max period. It goes back to the base period
+ * at once when the load rises over the idle load, or on a PSI trigger.
+ */
+class AdaptiveCadence {
+private:
+	int mBasePeriodMs; // period requested
+	int mIdleCount;
+
+public:
+	AdaptiveCadence()
+	{
+		mBasePeriodMs = 0;
+		mIdleCount = 0;
+	}
+
+	int getBasePeriodMs() const { return mBasePeriodMs; }
+
+	// Start again from this period
+	void reset(int basePeriodMs)
+	{
+		mBasePeriodMs = basePeriodMs;
+		mIdleCount = 0;
+	}
+
+	// Period to use after system stats with this cpu load (per mille),
+	// 0 if unchanged
+	int update(int periodMs, int load, int idleLoad, int maxPeriodMs,
+		   SystemMonitor::CadenceReason *reason)
+	{
+		// Back to full rate at once, slow down gradually
+		if (load >= idleLoad * 10) {
+			mIdleCount = 0;
+			if (periodMs <= mBasePeriodMs)
+				return 0;
+
+			*reason = SystemMonitor::CadenceReason::load;
+			return mBasePeriodMs;
+		}
+
+		mIdleCount++;
+		if (mIdleCount < CADENCE_IDLE_COUNT || periodMs >= maxPeriodMs)
+			return 0;
+
+		mIdleCount = 0;
+		*reason = SystemMonitor::CadenceReason::idle;
+
+		return std::min(periodMs * 2, maxPeriodMs);
+	}
+
+	// Period to use after a PSI trigger, 0 if unchanged
+	int onPressure(int periodMs)
+	{
+		mIdleCount = 0;
+
+		return periodMs > mBasePeriodMs ? mBasePeriodMs : 0;
+	}
+};
+
+#endif // !__ADAPTIVE_CADENCE_HPP__
@@ -1,14 +1,23 @@
 #include <unistd.h>
 #include "ssr_priv.hpp"
 
+// Events fetched by epoll_wait(), follows the registered fd count
+#define EVENTLOOP_MIN_EVENTS 8
+#define EVENTLOOP_MAX_EVENTS 1024
+
 EventLoop::EventLoop()
 {
 	mEpollFd = -1;
 	mStopFd = -1;
+	mDispatching = false;
+	mFdCount = 0;
+	mTimerWheel = nullptr;
 }
 
 EventLoop::~EventLoop()
 {
+	delete mTimerWheel;
+
 	if (mEpollFd != -1)
 		close(mEpollFd);
 
@@ -37,9 +46,10 @@ int EventLoop::init()
 		goto clear_epollfd;
 	}
 
+	// The stop fd is the only one without an entry
 	memset(&evt, 0, sizeof(evt));
 	evt.events = EPOLLIN;
-	evt.data.fd = mStopFd;
+	evt.data.ptr = nullptr;
 
 	ret = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &evt);
 	if (ret < 0) {
@@ -48,8 +58,21 @@ int EventLoop::init()
 		goto clear_stopfd;
 	}
 
+	// Init timers
+	mTimerWheel = new TimerWheel();
+
+	ret = mTimerWheel->init(this);
+	if (ret < 0) {
+		LOGE("TimerWheel::init() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		goto clear_timerwheel;
+	}
+
 	return 0;
 
+clear_timerwheel:
+	delete mTimerWheel;
+	mTimerWheel = nullptr;
 clear_stopfd:
 	close(mStopFd);
 	mStopFd = -1;
@@ -62,14 +85,23 @@ clear_epollfd:
 
 int EventLoop::wait(int timeout)
 {
-	std::list<InternalFd>::iterator internalFd;
-	struct epoll_event events[8];
+	InternalFd *internalFd;
+	size_t eventsSize;
 	int events_count;
 	int ret;
 
+	eventsSize = mFdCount + 1;
+	if (eventsSize < EVENTLOOP_MIN_EVENTS)
+		eventsSize = EVENTLOOP_MIN_EVENTS;
+	else if (eventsSize > EVENTLOOP_MAX_EVENTS)
+		eventsSize = EVENTLOOP_MAX_EVENTS;
+
+	if (mEvents.size() != eventsSize)
+		mEvents.resize(eventsSize);
+
 	do {
 		ret = epoll_wait(mEpollFd,
-				 events, SIZEOF_ARRAY(events),
+				 mEvents.data(), mEvents.size(),
 				 timeout);
 	} while (ret == -1 && errno == EINTR);
 
@@ -80,20 +112,26 @@ int EventLoop::wait(int timeout)
 	}
 
 	events_count = ret;
+	mDispatching = true;
 	for (int i = 0; i < events_count; i++) {
-		if (events[i].data.fd == mStopFd) {
+		internalFd = (InternalFd *) mEvents[i].data.ptr;
+		if (!internalFd) {
 			readStopFd();
 			continue;
 		}
 
-		ret = findInternalFd(events[i].data.fd, &internalFd);
-		if (ret < 0) {
-			LOGE("fd %d doesn't exist", events[i].data.fd);
+		// Removed by a previous callback of this batch
+		if (internalFd->mFd == -1)
 			continue;
-		}
 
-		internalFd->mCb(events[i].data.fd, events[i].events);
+		internalFd->mCb(internalFd->mFd, mEvents[i].events);
 	}
+	mDispatching = false;
+
+	for (auto &p : mPendingFree)
+		releaseInternalFd(p);
+
+	mPendingFree.clear();
 
 	return 0;
 }
@@ -123,66 +161,91 @@ void EventLoop::readStopFd()
 		LOG_ERRNO("read");
 }
 
-int EventLoop::findInternalFd(int fd,
-		std::list<InternalFd>::iterator *internalFd)
+EventLoop::InternalFd *EventLoop::findInternalFd(int fd) const
 {
-	for (auto i = mFdList.begin(); i != mFdList.end(); i++) {
-		if (i->mFd == fd) {
-			*internalFd = i;
+	if (fd < 0 || (size_t) fd >= mFdIndex.size())
+		return nullptr;
 
-			return 0;
-		}
+	return mFdIndex[fd];
+}
+
+EventLoop::InternalFd *EventLoop::allocInternalFd()
+{
+	InternalFd *internalFd;
+
+	if (!mFreeList.empty()) {
+		internalFd = mFreeList.back();
+		mFreeList.pop_back();
+		return internalFd;
 	}
 
-	return -ENOENT;
+	mSlab.emplace_back();
+
+	return &mSlab.back();
+}
+
+void EventLoop::releaseInternalFd(InternalFd *internalFd)
+{
+	internalFd->mFd = -1;
+	internalFd->mCb = nullptr;
+	mFreeList.push_back(internalFd);
 }
 
 int EventLoop::addFd(int op, int fd, EventLoopCb cb)
 {
-	std::list<InternalFd>::iterator internalFd;
+	InternalFd *internalFd;
 	struct epoll_event evt;
 	int ret;
 
-	if (!cb)
+	if (!cb || fd < 0)
 		return -EINVAL;
 
 	// Check fd isn't already registered
-	ret = findInternalFd(fd, &internalFd);
-	if (ret == 0) {
+	if (findInternalFd(fd)) {
 		LOGE("fd %d already exists", fd);
 		return -EPERM;
 	}
 
+	internalFd = allocInternalFd();
+
 	// Register in epoll fd
 	memset(&evt, 0, sizeof(evt));
 	evt.events = op;
-	evt.data.fd = fd;
+	evt.data.ptr = internalFd;
 
 	ret = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &evt);
 	if (ret == -1) {
 		ret = -errno;
 		LOG_ERRNO("epoll_ctl");
+		mFreeList.push_back(internalFd);
 		return ret;
 	}
 
 	// Register fd
-	mFdList.push_back( { fd, cb } );
+	internalFd->mFd = fd;
+	internalFd->mCb = cb;
+
+	if ((size_t) fd >= mFdIndex.size())
+		mFdIndex.resize(fd + 1, nullptr);
+
+	mFdIndex[fd] = internalFd;
+	mFdCount++;
 
 	return 0;
 }
 
 int EventLoop::modFd(int op, int fd, EventLoopCb cb)
 {
-	std::list<InternalFd>::iterator internalFd;
+	InternalFd *internalFd;
 	struct epoll_event evt;
 	int ret;
 
 	if (!cb)
 		return -EINVAL;
 
-	// Check fd isn't already registered
-	ret = findInternalFd(fd, &internalFd);
-	if (ret < 0) {
+	// Check fd is registered
+	internalFd = findInternalFd(fd);
+	if (!internalFd) {
 		LOGE("fd %d doesn't exists", fd);
 		return -EPERM;
 	}
@@ -190,7 +253,7 @@ int EventLoop::modFd(int op, int fd, EventLoopCb cb)
 	// Update in epoll fd
 	memset(&evt, 0, sizeof(evt));
 	evt.events = op;
-	evt.data.fd = fd;
+	evt.data.ptr = internalFd;
 
 	ret = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &evt);
 	if (ret == -1) {
@@ -199,17 +262,19 @@ int EventLoop::modFd(int op, int fd, EventLoopCb cb)
 		return ret;
 	}
 
+	internalFd->mCb = cb;
+
 	return 0;
 }
 
 int EventLoop::delFd(int fd)
 {
-	std::list<InternalFd>::iterator internalFd;
+	InternalFd *internalFd;
 	int ret;
 
-	// Check fd isn't already registered
-	ret = findInternalFd(fd, &internalFd);
-	if (ret < 0) {
+	// Check fd is registered
+	internalFd = findInternalFd(fd);
+	if (!internalFd) {
 		LOGE("fd %d doesn't exists", fd);
 		return -EPERM;
 	}
@@ -222,8 +287,17 @@ int EventLoop::delFd(int fd)
 		return ret;
 	}
 
-	// Register fd
-	mFdList.erase(internalFd);
+	mFdIndex[fd] = nullptr;
+	mFdCount--;
+
+	// Pending events of the current batch may still point to the entry,
+	// and its callback may be the one running
+	if (mDispatching) {
+		internalFd->mFd = -1;
+		mPendingFree.push_back(internalFd);
+	} else {
+		releaseInternalFd(internalFd);
+	}
 
 	return 0;
 }
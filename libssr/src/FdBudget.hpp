@@ -0,0 +1,46 @@
+#ifndef __FD_BUDGET_HPP__
+#define __FD_BUDGET_HPP__
+
+/**
+ * Count of thread stat fds kept open, shared by every process monitor.
+ *
+ * A thread that doesn't get an fd from the budget is reopened at each of its
+ * acquisitions. Reopened threads take the slots freed by exited ones.
+ */
+class FdBudget {
+private:
+	std::atomic<int> mUsed;
+	int mMax; // 0 : unlimited
+
+public:
+	FdBudget()
+	{
+		mUsed = 0;
+		mMax = 0;
+	}
+
+	void setMax(int max) { mMax = max; }
+	bool isLimited() const { return mMax > 0; }
+	int getUsed() const { return mUsed; }
+
+	// Return true if the caller may keep an fd open
+	bool acquire()
+	{
+		int used = mUsed.load(std::memory_order_relaxed);
+
+		do {
+			if (mMax > 0 && used >= mMax)
+				return false;
+		} while (!mUsed.compare_exchange_weak(used, used + 1,
+						      std::memory_order_relaxed));
+
+		return true;
+	}
+
+	void release()
+	{
+		mUsed.fetch_sub(1, std::memory_order_relaxed);
+	}
+};
+
+#endif // !__FD_BUDGET_HPP__
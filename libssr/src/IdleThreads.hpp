@@ -0,0 +1,38 @@
+#ifndef __IDLE_THREADS_HPP__
+#define __IDLE_THREADS_HPP__
+
+/**
+ * Idle threads skipping state of a process.
+ *
+ * Threads can't have run if the process CPU time is unchanged, their stats
+ * are the same. They are still read by periodic refreshes, which also find
+ * the threads created meanwhile. A thread running less than a clock tick may
+ * only be read later, its times are cumulative anyway.
+ */
+struct IdleThreads {
+	// Process CPU time when threads were last read, at mTs. 0 : never read
+	uint64_t mCpuTime;
+	uint64_t mTs;
+
+	IdleThreads()
+	{
+		mCpuTime = 0;
+		mTs = 0;
+	}
+
+	// Return true if the threads must be read along with a process stats
+	// read at ts, and remember this read
+	bool update(uint64_t cpuTime, uint64_t ts, int refreshMs)
+	{
+		if (mTs != 0 && cpuTime == mCpuTime &&
+		    ts - mTs < refreshMs * 1000000ULL)
+			return false;
+
+		mCpuTime = cpuTime;
+		mTs = ts;
+
+		return true;
+	}
+};
+
+#endif // !__IDLE_THREADS_HPP__
@@ -0,0 +1,129 @@
+#ifndef __LOAD_SHEDDING_HPP__
+#define __LOAD_SHEDDING_HPP__
+
+// Acquisitions under half the budget before a load shedding step is undone
+#define SHED_RECOVERY_COUNT 5
+
+// Longest period lengthening by load shedding
+#define SHED_MAX_PERIOD_FACTOR 8
+
+/**
+ * Load shedding level, see SystemMonitor::SheddingStep.
+ *
+ * Each acquisition over the budget goes one step down the ladder : threads
+ * are no longer read, then the processes of the lowest priority still read
+ * (the highest priority is always read), then the period is doubled up to
+ * SHED_MAX_PERIOD_FACTOR. Each step is undone, in reverse order, after
+ * SHED_RECOVERY_COUNT acquisitions in a row under half the budget.
+ *
+ * Monitors are any container of pointers to objects with getPriority().
+ */
+class LoadShedding {
+private:
+	bool mThreadsShed;
+	int mShedPriority; // processes up to this priority are not read
+	int mPeriodFactor;
+	int mUnderBudgetCount;
+
+private:
+	template <typename Monitors>
+	bool shedMore(const Monitors &monitors)
+	{
+		int maxPriority = INT32_MIN;
+		int next = INT32_MAX;
+
+		if (!mThreadsShed) {
+			mThreadsShed = true;
+			return true;
+		}
+
+		// Lowest priority still read
+		for (auto m :monitors) {
+			maxPriority = std::max(maxPriority, m->getPriority());
+			if (m->getPriority() > mShedPriority)
+				next = std::min(next, m->getPriority());
+		}
+
+		if (next < maxPriority) {
+			mShedPriority = next;
+			return true;
+		}
+
+		if (mPeriodFactor < SHED_MAX_PERIOD_FACTOR) {
+			mPeriodFactor *= 2;
+			return true;
+		}
+
+		return false;
+	}
+
+	template <typename Monitors>
+	bool shedLess(const Monitors &monitors)
+	{
+		int prev = INT32_MIN;
+
+		if (mPeriodFactor > 1) {
+			mPeriodFactor /= 2;
+			return true;
+		}
+
+		if (mShedPriority != INT32_MIN) {
+			for (auto m :monitors) {
+				if (m->getPriority() < mShedPriority)
+					prev = std::max(prev, m->getPriority());
+			}
+
+			mShedPriority = prev;
+			return true;
+		}
+
+		if (mThreadsShed) {
+			mThreadsShed = false;
+			return true;
+		}
+
+		return false;
+	}
+
+public:
+	LoadShedding()
+	{
+		mThreadsShed = false;
+		mShedPriority = INT32_MIN;
+		mPeriodFactor = 1;
+		mUnderBudgetCount = 0;
+	}
+
+	bool getThreadsShed() const { return mThreadsShed; }
+	int getShedPriority() const { return mShedPriority; }
+	int getPeriodFactor() const { return mPeriodFactor; }
+
+	bool isShedding() const
+	{
+		return mThreadsShed || mShedPriority != INT32_MIN ||
+		       mPeriodFactor > 1;
+	}
+
+	// Return true if the level has changed
+	template <typename Monitors>
+	bool update(uint64_t duration, uint64_t budget, const Monitors &monitors)
+	{
+		// Degrade at each overrun, recover slowly
+		if (duration > budget) {
+			mUnderBudgetCount = 0;
+			return shedMore(monitors);
+		} else if (duration < budget / 2 && isShedding()) {
+			mUnderBudgetCount++;
+			if (mUnderBudgetCount >= SHED_RECOVERY_COUNT) {
+				mUnderBudgetCount = 0;
+				return shedLess(monitors);
+			}
+		} else {
+			mUnderBudgetCount = 0;
+		}
+
+		return false;
+	}
+};
+
+#endif // !__LOAD_SHEDDING_HPP__
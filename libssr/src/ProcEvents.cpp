@@ -0,0 +1,224 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include "ssr_priv.hpp"
+
+#define PROCEVENTS_BUFFER_SIZE 4096
+
+ProcEvents::ProcEvents()
+{
+	mLoop = nullptr;
+	mFd = -1;
+}
+
+ProcEvents::~ProcEvents()
+{
+	clear();
+}
+
+int ProcEvents::sendListenMsg(bool listen)
+{
+	uint8_t buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(uint32_t))]
+		__attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	struct cn_msg *cnMsg;
+	uint32_t op;
+	ssize_t len;
+	int ret;
+
+	memset(buffer, 0, sizeof(buffer));
+
+	nlh = (struct nlmsghdr *) buffer;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*cnMsg) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_pid = getpid();
+
+	cnMsg = (struct cn_msg *) NLMSG_DATA(nlh);
+	cnMsg->id.idx = CN_IDX_PROC;
+	cnMsg->id.val = CN_VAL_PROC;
+	cnMsg->len = sizeof(op);
+
+	op = listen ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+	memcpy(cnMsg->data, &op, sizeof(op));
+
+	len = send(mFd, nlh, nlh->nlmsg_len, 0);
+	if (len == -1) {
+		ret = -errno;
+		LOG_ERRNO("send");
+		return ret;
+	}
+
+	return 0;
+}
+
+int ProcEvents::init(EventLoop *loop, const Callbacks &cb)
+{
+	struct sockaddr_nl addr;
+	int ret;
+
+	if (!loop)
+		return -EINVAL;
+	else if (mFd != -1)
+		return -EPERM;
+
+	mFd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		     NETLINK_CONNECTOR);
+	if (mFd == -1) {
+		ret = -errno;
+		LOG_ERRNO("socket");
+		return ret;
+	}
+
+	// Joining the CN_IDX_PROC group requires CAP_NET_ADMIN
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
+
+	ret = bind(mFd, (struct sockaddr *) &addr, sizeof(addr));
+	if (ret == -1) {
+		ret = -errno;
+		LOG_ERRNO("bind");
+		goto error;
+	}
+
+	ret = sendListenMsg(true);
+	if (ret < 0)
+		goto error;
+
+	mCb = cb;
+
+	ret = loop->addFd(EPOLLIN, mFd,
+		[this] (int fd, int evt) {
+			readEvents();
+		});
+	if (ret < 0) {
+		LOGE("EventLoop::addFd() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		goto error;
+	}
+
+	mLoop = loop;
+
+	return 0;
+
+error:
+	close(mFd);
+	mFd = -1;
+
+	return ret;
+}
+
+int ProcEvents::clear()
+{
+	if (mFd == -1)
+		return -EPERM;
+
+	sendListenMsg(false);
+
+	mLoop->delFd(mFd);
+	close(mFd);
+	mFd = -1;
+
+	mLoop = nullptr;
+
+	return 0;
+}
+
+void ProcEvents::readEvents()
+{
+	uint8_t buffer[PROCEVENTS_BUFFER_SIZE]
+		__attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	struct cn_msg *cnMsg;
+	ssize_t len;
+
+	while (true) {
+		len = recv(mFd, buffer, sizeof(buffer), 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN)
+				break;
+
+			// The socket buffer has overflowed, events are lost
+			if (errno == ENOBUFS) {
+				LOGW("Proc events lost");
+				if (mCb.mOverrun)
+					mCb.mOverrun(mCb.mUserdata);
+				continue;
+			}
+
+			LOG_ERRNO("recv");
+			break;
+		}
+
+		for (nlh = (struct nlmsghdr *) buffer;
+		     NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_NOOP ||
+			    nlh->nlmsg_type == NLMSG_ERROR)
+				continue;
+
+			cnMsg = (struct cn_msg *) NLMSG_DATA(nlh);
+			if (cnMsg->id.idx != CN_IDX_PROC ||
+			    cnMsg->id.val != CN_VAL_PROC)
+				continue;
+
+			processEvent(cnMsg->data, cnMsg->len);
+		}
+	}
+}
+
+void ProcEvents::processEvent(const void *data, size_t len)
+{
+	const struct proc_event *evt = (const struct proc_event *) data;
+	char comm[sizeof(evt->event_data.comm.comm) + 1];
+
+	if (len < offsetof(struct proc_event, event_data))
+		return;
+
+	switch (evt->what) {
+	case proc_event::PROC_EVENT_FORK:
+		if (mCb.mFork) {
+			mCb.mFork(evt->event_data.fork.child_pid,
+				  evt->event_data.fork.child_tgid,
+				  mCb.mUserdata);
+		}
+		break;
+
+	case proc_event::PROC_EVENT_EXEC:
+		if (mCb.mExec) {
+			mCb.mExec(evt->event_data.exec.process_pid,
+				  evt->event_data.exec.process_tgid,
+				  mCb.mUserdata);
+		}
+		break;
+
+	case proc_event::PROC_EVENT_COMM:
+		if (mCb.mComm) {
+			memcpy(comm, evt->event_data.comm.comm,
+			       sizeof(evt->event_data.comm.comm));
+			comm[sizeof(comm) - 1] = '\0';
+
+			mCb.mComm(evt->event_data.comm.process_pid,
+				  evt->event_data.comm.process_tgid,
+				  comm,
+				  mCb.mUserdata);
+		}
+		break;
+
+	case proc_event::PROC_EVENT_EXIT:
+		if (mCb.mExit) {
+			mCb.mExit(evt->event_data.exit.process_pid,
+				  evt->event_data.exit.process_tgid,
+				  mCb.mUserdata);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef __PROC_EVENTS_HPP__
+#define __PROC_EVENTS_HPP__
+
+/**
+ * Listener of the kernel proc connector (NETLINK_CONNECTOR, CN_IDX_PROC).
+ *
+ * Process and thread creation, exec, rename and exit are notified from the
+ * EventLoop. Subscribing requires CAP_NET_ADMIN: init() fails if it is
+ * missing and callers are expected to keep scanning /proc instead.
+ */
+class ProcEvents {
+public:
+	struct Callbacks {
+		// New task. pid == tgid for a process, a thread otherwise
+		void (*mFork) (int pid, int tgid, void *userdata);
+		void (*mExec) (int pid, int tgid, void *userdata);
+		void (*mComm) (int pid, int tgid, const char *comm, void *userdata);
+		void (*mExit) (int pid, int tgid, void *userdata);
+
+		// Some events have been lost, a full rescan is required
+		void (*mOverrun) (void *userdata);
+
+		void *mUserdata;
+
+		Callbacks()
+		{
+			mFork = nullptr;
+			mExec = nullptr;
+			mComm = nullptr;
+			mExit = nullptr;
+			mOverrun = nullptr;
+			mUserdata = nullptr;
+		}
+	};
+
+private:
+	EventLoop *mLoop;
+	int mFd;
+	Callbacks mCb;
+
+private:
+	int sendListenMsg(bool listen);
+	void readEvents();
+	void processEvent(const void *data, size_t len);
+
+public:
+	ProcEvents();
+	~ProcEvents();
+
+	int init(EventLoop *loop, const Callbacks &cb);
+	int clear();
+
+	bool isStarted() const { return mFd != -1; }
+};
+
+#endif // !__PROC_EVENTS_HPP__
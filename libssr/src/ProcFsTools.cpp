@@ -2,27 +2,47 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/syscall.h>
+#include <type_traits>
 #include "ssr_priv.hpp"
 
-namespace {
+#if defined(__SSE2__)
+#define TOKENIZER_SSE2
+#endif
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define TOKENIZER_AVX2
+#endif
 
-typedef bool (*TokenizerCb) (
-		int idx,
-		const char *start,
-		const char *end,
-		void *userdata);
+// getdents64 buffer of pfstools::iteratePidDir()
+#define PID_DIR_BUF_SIZE (32 * 1024)
 
-typedef bool (*PidFoundCb) (int pid, void *userdata);
+#if defined(TOKENIZER_SSE2) || defined(TOKENIZER_AVX2)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Kernel struct linux_dirent64, not exported by every libc
+struct PidDirent {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
 
 enum SysStatLine {
 	SYSSTAT_UNKNOWN,
 	SYSSTAT_LINE_CPU,
+	SYSSTAT_LINE_PERCPU,
 	SYSSTAT_IRQ,
 	SYSSTAT_SOFT_IRQ,
 	SYSSTAT_CTX_SWITCH,
 };
 
 enum SysStatCpuIdx {
+	SYSSTAT_CPU_IDX_NAME = 0,
 	SYSSTAT_CPU_IDX_USER = 1,
 	SYSSTAT_CPU_IDX_NICE = 2,
 	SYSSTAT_CPU_IDX_SYSTEM = 3,
@@ -54,412 +74,375 @@ enum ProcStatIdx {
 	PROCSTAT_IDX_RSS = 23
 };
 
-enum ParserState {
-	PARSER_STATE_IDLE = 0,
-	PARSER_STATE_INT,
-	PARSER_STATE_STR
-};
+/**
+ * Delimiter search. Return a pointer on the first occurrence of delim or on
+ * the terminating '\0'.
+ *
+ * Vectorized versions only do aligned loads, that never cross a page
+ * boundary, so reading beyond the end of the string is safe.
+ */
+typedef const char *(*FindDelimFunc) (const char *s, char delim);
 
-struct PidTestCtx {
-	const char *mName;
-	bool mMatch;
-};
+#ifndef TOKENIZER_SSE2
 
-int tokenizeStats(const char *s, TokenizerCb cb, void *userdata)
+const char *findDelimScalar(const char *s, char delim)
 {
-	bool doParse;
-	const char *start = NULL;
-	ParserState state;
-	int idx = 0;
-
-	if (!s|| !cb)
-		return -EINVAL;
-
-	state = PARSER_STATE_IDLE;
-	while (*s != '\0') {
-		switch (state) {
-		case PARSER_STATE_IDLE:
-			if (*s == '(') {
-				state = PARSER_STATE_STR;
-				start = s;
-			} else if (*s != ' ') {
-				state = PARSER_STATE_INT;
-				start = s;
-			}
-			break;
-
-		case PARSER_STATE_INT:
-			if (*s == ' ') {
-				doParse = cb(idx, start, s - 1, userdata);
-				if (!doParse)
-					return 0;
-
-				state = PARSER_STATE_IDLE;
-				idx++;
-			}
-			break;
-
-		case PARSER_STATE_STR:
-			if (*s == ')') {
-				doParse = cb(idx, start, s, userdata);
-				if (!doParse)
-					return 0;
-
-				state = PARSER_STATE_IDLE;
-				idx++;
-			}
-			break;
-
-		default:
-			break;
-		}
-
+	while (*s != delim && *s != '\0')
 		s++;
-	}
 
-	switch (state) {
-	case PARSER_STATE_INT:
-		cb(idx, start, s - 1, userdata);
-		break;
-
-	case PARSER_STATE_STR:
-		cb(idx, start, s - 1, userdata);
-		break;
-
-	default:
-		break;
-	}
-
-	return 0;
+	return s;
 }
 
-bool processStatsCb(int idx,
-		     const char *start,
-		     const char *end,
-		     void *userdata)
-{
-	SystemMonitor::ProcessStats *stats = (SystemMonitor::ProcessStats *) userdata;
-	char buf[64];
-	bool ret = true;
-
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
-
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
-
-	switch (idx) {
-	case PROCSTAT_IDX_PID:
-		stats->mPid = atoi(buf);
-		break;
+#endif // !TOKENIZER_SSE2
 
-	case PROCSTAT_IDX_NAME:
-		strncpy(stats->mName, buf, sizeof(stats->mName));
-		break;
+#ifdef TOKENIZER_SSE2
 
-	case PROCSTAT_IDX_UTIME:
-		stats->mUtime = atoll(buf);
-		break;
+const char *findDelimSse2(const char *s, char delim)
+{
+	const __m128i vDelim = _mm_set1_epi8(delim);
+	const __m128i vZero = _mm_setzero_si128();
+	uintptr_t offset = (uintptr_t) s & 15;
+	const __m128i *p = (const __m128i *) (s - offset);
+	__m128i chunk;
+	uint32_t mask;
+
+	// First chunk : ignore bytes before the start of the string
+	chunk = _mm_load_si128(p);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, vDelim),
+					      _mm_cmpeq_epi8(chunk, vZero)));
+	mask >>= offset;
+	if (mask)
+		return s + __builtin_ctz(mask);
 
-	case PROCSTAT_IDX_STIME:
-		stats->mStime = atoll(buf);
-		break;
+	while (true) {
+		p++;
+		chunk = _mm_load_si128(p);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(chunk, vDelim),
+				_mm_cmpeq_epi8(chunk, vZero)));
+		if (mask)
+			return (const char *) p + __builtin_ctz(mask);
+	}
+}
 
-	case PROCSTAT_IDX_THREADCOUNT:
-		stats->mThreadCount = atoi(buf);
-		break;
+#endif // TOKENIZER_SSE2
 
-	case PROCSTAT_IDX_VSIZE:
-		stats->mVsize = atoi(buf);
-		break;
+#ifdef TOKENIZER_AVX2
 
-	case PROCSTAT_IDX_RSS:
-		stats->mRss = atoi(buf);
-		ret = false;
-		break;
+__attribute__((target("avx2")))
+const char *findDelimAvx2(const char *s, char delim)
+{
+	const __m256i vDelim = _mm256_set1_epi8(delim);
+	const __m256i vZero = _mm256_setzero_si256();
+	uintptr_t offset = (uintptr_t) s & 31;
+	const __m256i *p = (const __m256i *) (s - offset);
+	__m256i chunk;
+	uint32_t mask;
+
+	// First chunk : ignore bytes before the start of the string
+	chunk = _mm256_load_si256(p);
+	mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(chunk, vDelim),
+			_mm256_cmpeq_epi8(chunk, vZero)));
+	mask >>= offset;
+	if (mask)
+		return s + __builtin_ctz(mask);
 
-	default:
-		break;
+	while (true) {
+		p++;
+		chunk = _mm256_load_si256(p);
+		mask = _mm256_movemask_epi8(_mm256_or_si256(
+				_mm256_cmpeq_epi8(chunk, vDelim),
+				_mm256_cmpeq_epi8(chunk, vZero)));
+		if (mask)
+			return (const char *) p + __builtin_ctz(mask);
 	}
-
-	return ret;
 }
 
-bool threadStatsCb(int idx,
-		   const char *start,
-		   const char *end,
-		   void *userdata)
-{
-	SystemMonitor::ThreadStats *stats = (SystemMonitor::ThreadStats *) userdata;
-	char buf[64];
-	bool ret = true;
-
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
-
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
+#endif // TOKENIZER_AVX2
 
-	switch (idx) {
-	case PROCSTAT_IDX_PID:
-		stats->mTid = atoi(buf);
-		break;
+FindDelimFunc getFindDelimFunc()
+{
+#ifdef TOKENIZER_AVX2
+	// May run before libgcc constructors
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return findDelimAvx2;
+#endif
+
+#ifdef TOKENIZER_SSE2
+	return findDelimSse2;
+#else
+	return findDelimScalar;
+#endif
+}
 
-	case PROCSTAT_IDX_NAME:
-		strncpy(stats->mName, buf, sizeof(stats->mName));
-		break;
+const FindDelimFunc findDelim = getFindDelimFunc();
 
-	case PROCSTAT_IDX_UTIME:
-		stats->mUtime = atoll(buf);
-		break;
+// Parse a decimal value in place, stopping at the first non-digit char
+uint64_t parseUint(const char *start, const char *end)
+{
+	uint64_t v = 0;
 
-	case PROCSTAT_IDX_STIME:
-		stats->mStime = atoll(buf);
-		ret = false;
-		break;
+	for (; start <= end; start++) {
+		unsigned digit = (unsigned) (*start - '0');
+		if (digit > 9)
+			break;
 
-	default:
-		break;
+		v = v * 10 + digit;
 	}
 
-	return ret;
+	return v;
 }
 
-bool pidTestCb(int idx,
-		      const char *start,
-		      const char *end,
-		      void *userdata)
+void copyToken(char *dst, size_t size, const char *start, const char *end)
 {
-	PidTestCtx *ctx = (PidTestCtx *) userdata;
-	char buf[64];
-
-	if (idx != PROCSTAT_IDX_NAME)
-		return true;
-
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
+	size_t len = end - start + 1;
 
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
+	if (len > size - 1)
+		len = size - 1;
 
-	ctx->mMatch = (strncmp(buf + 1, ctx->mName, strlen(buf) - 2) == 0);
-
-	return false;
+	memcpy(dst, start, len);
+	dst[len] = '\0';
 }
 
-bool testPidName(int pid, const char *name)
+/**
+ * Field-selective stat line parser.
+ *
+ * A layout gives the destination type of a stat line and one StatField
+ * specialization per field that can be extracted from it. The parser is
+ * unrolled at compile time over the field indexes, up to the last one set in
+ * the field mask : unselected fields are skipped without being converted.
+ */
+constexpr uint64_t statFieldBit(int idx)
 {
-	PidTestCtx testCtx;
-	char path[128];
-	pfstools::RawStats rawStats;
-	int fd;
-	int ret;
-
-	// Open procfs
-	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-
-	fd = open(path, O_RDONLY|O_CLOEXEC);
-	if (fd == -1) {
-		ret = -errno;
-		LOGE("Fail to open %s : %d(%m)", path, errno);
-		return ret;
-	}
-
-	// Read content
-	ret = pfstools::readRawStats(fd, &rawStats);
-	if (ret < 0) {
-		close(fd);
-		return false;
-	}
-
-	testCtx.mName = name;
-	testCtx.mMatch = false;
-
-	ret = tokenizeStats(rawStats.mContent, pidTestCb, &testCtx);
-	close(fd);
-	if (ret < 0) {
-		return false;
-	}
-
-	return testCtx.mMatch;
+	return 1ULL << idx;
 }
 
-bool processCpuCb(int idx,
-		  const char *start,
-		  const char *end,
-		  void *userdata)
+constexpr int statLastField(uint64_t mask, int idx = 63)
 {
-	auto stats = (SystemMonitor::SystemStats *) userdata;
-	char buf[64];
-	bool ret = true;
-
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
-
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
+	return idx < 0 ? -1 :
+	       (mask & statFieldBit(idx)) ? idx :
+	       statLastField(mask, idx - 1);
+}
 
-	switch (idx) {
-	case SYSSTAT_CPU_IDX_USER:
-		stats->mUtime = atoi(buf);
-		break;
+template <typename Layout, int Idx>
+struct StatField;
 
-	case SYSSTAT_CPU_IDX_NICE:
-		stats->mNice = atoi(buf);
-		break;
+template <typename T>
+inline void storeStatField(T *field, const char *start, const char *end)
+{
+	*field = (T) parseUint(start, end);
+}
 
-	case SYSSTAT_CPU_IDX_SYSTEM:
-		stats->mStime = atoi(buf);
-		break;
+template <size_t N>
+inline void storeStatField(char (*field)[N], const char *start, const char *end)
+{
+	copyToken(*field, N, start, end);
+}
 
-	case SYSSTAT_CPU_IDX_IDLE:
-		stats->mIdle = atoi(buf);
-		break;
+#define STAT_FIELD(_layout, _idx, _member) \
+	template <> \
+	struct StatField<_layout, _idx> { \
+		static void store(_layout::Dest *dst, \
+				  const char *start, \
+				  const char *end) \
+		{ \
+			storeStatField(&dst->_member, start, end); \
+		} \
+	}
 
-	case SYSSTAT_CPU_IDX_IOWAIT:
-		stats->mIoWait = atoi(buf);
-		break;
+/**
+ * Find the next field of a stat line. A field is either a word delimited by
+ * spaces or a string between parenthesis (the task name, which may contain
+ * spaces). Return nullptr at end of line.
+ */
+inline const char *nextStatField(const char *s,
+				 const char **start,
+				 const char **end)
+{
+	while (*s == ' ')
+		s++;
 
-	case SYSSTAT_CPU_IDX_IRQ:
-		stats->mIrq = atoi(buf);
-		break;
+	if (*s == '\0')
+		return nullptr;
 
-	case SYSSTAT_CPU_IDX_SOFTIRQ:
-		stats->mSoftIrq = atoi(buf);
-		ret = false;
-		break;
+	*start = s;
+	if (*s == '(') {
+		s = findDelim(s + 1, ')');
+		if (*s == '\0') {
+			*end = s - 1;
+			return s;
+		}
 
-	default:
-		break;
+		*end = s;
+		return s + 1;
 	}
 
-	return ret;
+	s = findDelim(s + 1, ' ');
+	*end = s - 1;
+
+	return s;
 }
 
-bool processIrqCountCb(int idx,
-		       const char *start,
-		       const char *end,
-		       void *userdata)
+template <typename Layout, int Idx>
+inline void storeStatFieldIf(typename Layout::Dest *dst,
+			     const char *start,
+			     const char *end,
+			     std::true_type)
 {
-	auto stats = (SystemMonitor::SystemStats *) userdata;
-	char buf[64];
-	bool ret = true;
-
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
-
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
-
-	switch (idx) {
-	case SYSSTAT_IRQ_IDX_COUNT:
-		stats->mIrqCount = atoi(buf);
-		ret = false;
-		break;
-
-	default:
-		break;
-	}
-
-	return ret;
+	StatField<Layout, Idx>::store(dst, start, end);
 }
 
-bool processSoftIrqCountCb(int idx,
-			   const char *start,
-			   const char *end,
-			   void *userdata)
+template <typename Layout, int Idx>
+inline void storeStatFieldIf(typename Layout::Dest *dst,
+			     const char *start,
+			     const char *end,
+			     std::false_type)
 {
-	auto stats = (SystemMonitor::SystemStats *) userdata;
-	char buf[64];
-	bool ret = true;
+}
 
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
+template <typename Layout,
+	  uint64_t Mask,
+	  int Idx = 0,
+	  bool Done = (Idx > statLastField(Mask))>
+struct StatParser {
+	static int parse(const char *s, typename Layout::Dest *dst)
+	{
+		typedef std::integral_constant<bool,
+				(Mask & statFieldBit(Idx)) != 0> Wanted;
+		const char *start;
+		const char *end;
+
+		s = nextStatField(s, &start, &end);
+		if (!s)
+			return -EPROTO;
+
+		storeStatFieldIf<Layout, Idx>(dst, start, end, Wanted());
+
+		return StatParser<Layout, Mask, Idx + 1>::parse(s, dst);
+	}
+};
 
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
+template <typename Layout, uint64_t Mask, int Idx>
+struct StatParser<Layout, Mask, Idx, true> {
+	static int parse(const char *s, typename Layout::Dest *dst)
+	{
+		return 0;
+	}
+};
 
-	switch (idx) {
-	case SYSSTAT_SOFTIRQ_IDX_COUNT:
-		stats->mSoftIrqCount = atoi(buf);
-		ret = false;
-		break;
+template <typename Layout, uint64_t Mask>
+inline int parseStatFields(const char *s, typename Layout::Dest *dst)
+{
+	static_assert(Mask != 0, "No stat field selected");
 
-	default:
-		break;
-	}
+	if (!s || !dst)
+		return -EINVAL;
 
-	return ret;
+	return StatParser<Layout, Mask>::parse(s, dst);
 }
 
-bool processCtxSwitchCountCb(int idx,
-			     const char *start,
-			     const char *end,
-			     void *userdata)
-{
-	auto stats = (SystemMonitor::SystemStats *) userdata;
-	char buf[64];
-	bool ret = true;
+// /proc/<pid>/stat
+struct ProcessStatLayout {
+	typedef SystemMonitor::ProcessStats Dest;
+};
 
-	if ((size_t) (end - start + 1) > sizeof(buf))
-		return false;
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_PID, mPid);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_NAME, mName);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_UTIME, mUtime);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_STIME, mStime);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_THREADCOUNT, mThreadCount);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_VSIZE, mVsize);
+STAT_FIELD(ProcessStatLayout, PROCSTAT_IDX_RSS, mRss);
+
+constexpr uint64_t PROCESS_STAT_FIELDS =
+		statFieldBit(PROCSTAT_IDX_PID) |
+		statFieldBit(PROCSTAT_IDX_NAME) |
+		statFieldBit(PROCSTAT_IDX_UTIME) |
+		statFieldBit(PROCSTAT_IDX_STIME) |
+		statFieldBit(PROCSTAT_IDX_THREADCOUNT) |
+		statFieldBit(PROCSTAT_IDX_VSIZE) |
+		statFieldBit(PROCSTAT_IDX_RSS);
+
+// /proc/<pid>/task/<tid>/stat
+struct ThreadStatLayout {
+	typedef SystemMonitor::ThreadStats Dest;
+};
 
-	memcpy(buf, start, end - start + 1);
-	buf[end - start + 1] = '\0';
+STAT_FIELD(ThreadStatLayout, PROCSTAT_IDX_PID, mTid);
+STAT_FIELD(ThreadStatLayout, PROCSTAT_IDX_NAME, mName);
+STAT_FIELD(ThreadStatLayout, PROCSTAT_IDX_UTIME, mUtime);
+STAT_FIELD(ThreadStatLayout, PROCSTAT_IDX_STIME, mStime);
 
-	switch (idx) {
-	case SYSSTAT_CTXSWITCH_COUNT:
-		stats->mCtxSwitchCount = atoi(buf);
-		ret = false;
-		break;
+constexpr uint64_t THREAD_STAT_FIELDS =
+		statFieldBit(PROCSTAT_IDX_PID) |
+		statFieldBit(PROCSTAT_IDX_NAME) |
+		statFieldBit(PROCSTAT_IDX_UTIME) |
+		statFieldBit(PROCSTAT_IDX_STIME);
 
-	default:
-		break;
-	}
+// /proc/stat lines
+struct SysStatCpuLayout {
+	typedef SystemMonitor::SystemStats Dest;
+};
 
-	return ret;
-}
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_USER, mUtime);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_NICE, mNice);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_SYSTEM, mStime);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_IDLE, mIdle);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_IOWAIT, mIoWait);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_IRQ, mIrq);
+STAT_FIELD(SysStatCpuLayout, SYSSTAT_CPU_IDX_SOFTIRQ, mSoftIrq);
+
+constexpr uint64_t SYSSTAT_CPU_FIELDS =
+		statFieldBit(SYSSTAT_CPU_IDX_USER) |
+		statFieldBit(SYSSTAT_CPU_IDX_NICE) |
+		statFieldBit(SYSSTAT_CPU_IDX_SYSTEM) |
+		statFieldBit(SYSSTAT_CPU_IDX_IDLE) |
+		statFieldBit(SYSSTAT_CPU_IDX_IOWAIT) |
+		statFieldBit(SYSSTAT_CPU_IDX_IRQ) |
+		statFieldBit(SYSSTAT_CPU_IDX_SOFTIRQ);
+
+struct SysStatPerCpuLayout {
+	typedef SystemMonitor::CpuStats Dest;
+};
 
-int iterateAllPid(PidFoundCb cb, void *userdata)
-{
-	DIR *d;
-	struct dirent entry;
-	struct dirent *result = nullptr;
-	int pid;
-	char *endptr;
-	int ret;
-	bool process = true;
+// "cpuN" : only keep the cpu index
+template <>
+struct StatField<SysStatPerCpuLayout, SYSSTAT_CPU_IDX_NAME> {
+	static void store(SystemMonitor::CpuStats *dst,
+			  const char *start,
+			  const char *end)
+	{
+		dst->mCpu = parseUint(start + 3, end);
+	}
+};
 
-	if (!cb)
-		return -EINVAL;
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_USER, mUtime);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_NICE, mNice);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_SYSTEM, mStime);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_IDLE, mIdle);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_IOWAIT, mIoWait);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_IRQ, mIrq);
+STAT_FIELD(SysStatPerCpuLayout, SYSSTAT_CPU_IDX_SOFTIRQ, mSoftIrq);
 
-	d = opendir("/proc");
-	if (!d) {
-		ret = -errno;
-		LOGE("Fail to open /proc : %d(%m)", errno);
-		return ret;
-	}
+struct SysStatIrqLayout {
+	typedef SystemMonitor::SystemStats Dest;
+};
 
-	while (process) {
-		ret = readdir_r(d, &entry, &result);
-		if (ret == 0 && !result)
-			break;
+STAT_FIELD(SysStatIrqLayout, SYSSTAT_IRQ_IDX_COUNT, mIrqCount);
 
-		pid = strtol(entry.d_name, &endptr, 10);
-		if (pid == LONG_MIN || pid == LONG_MAX || errno == EINVAL) {
-			LOGW("Ignore %s", entry.d_name);
-			continue;
-		} else if (*endptr != '\0') {
-			continue;
-		}
+struct SysStatSoftIrqLayout {
+	typedef SystemMonitor::SystemStats Dest;
+};
 
-		process = cb(pid, userdata);
-	}
+STAT_FIELD(SysStatSoftIrqLayout, SYSSTAT_SOFTIRQ_IDX_COUNT, mSoftIrqCount);
 
-	closedir(d);
+struct SysStatCtxSwitchLayout {
+	typedef SystemMonitor::SystemStats Dest;
+};
 
-	return 0;
-}
+STAT_FIELD(SysStatCtxSwitchLayout, SYSSTAT_CTXSWITCH_COUNT, mCtxSwitchCount);
 
 enum MeminfoFields {
 	MEMINFO_FIELDS_TOTAL     = (1 << 0),
@@ -474,6 +457,37 @@ struct MeminfoParam {
 	uint64_t value;
 };
 
+/**
+ * Parse a directory name made of digits only, as pid and tid directories.
+ * Return -1 for any other name.
+ */
+inline int parsePidName(const char *s)
+{
+	unsigned int digit;
+	uint64_t v;
+	int i;
+
+	// No leading zero, and pid_t fits in 10 digits
+	digit = (unsigned char) s[0] - '1';
+	if (digit > 8)
+		return -1;
+
+	v = digit + 1;
+
+	for (i = 1; i < 10; i++) {
+		digit = (unsigned char) s[i] - '0';
+		if (digit > 9)
+			break;
+
+		v = v * 10 + digit;
+	}
+
+	if (s[i] != '\0' || v > INT_MAX)
+		return -1;
+
+	return v;
+}
+
 int meminfoGetParameterName(char *s, char **end)
 {
 	char *p;
@@ -571,68 +585,152 @@ int meminfoParseLine(char *s, MeminfoParam *result)
 
 namespace pfstools {
 
-struct FindProcessCtx {
-	const char *mName;
-	int mPid;
-};
-
-static bool findProcessCb(int pid, void *userdata)
+int iteratePidDir(const char *path, PidFoundCb cb, void *userdata)
 {
-	auto ctx = (FindProcessCtx *) userdata;
-	bool match;
+	const PidDirent *entry;
+	char *buf;
+	long size;
+	long off;
+	int pid;
+	int fd;
+	int ret;
+
+	if (!path || !cb)
+		return -EINVAL;
 
-	match = testPidName(pid, ctx->mName);
-	if (match) {
-		ctx->mPid = pid;
-		return false;
+	fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd == -1) {
+		ret = -errno;
+		LOGE("Fail to open %s : %d(%m)", path, errno);
+		return ret;
 	}
 
-	return true;
-}
+	// One buffer per call : callbacks may scan another directory, as
+	// the /proc walk attaching a process scans its task directory. Big
+	// enough for /proc in a few calls.
+	buf = (char *) malloc(PID_DIR_BUF_SIZE);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
-int findProcess(const char *name, int *outPid)
-{
-	FindProcessCtx ctx;
-	int ret;
+	while (true) {
+		size = syscall(SYS_getdents64, fd, buf, PID_DIR_BUF_SIZE);
+		if (size < 0) {
+			ret = -errno;
+			LOG_ERRNO("getdents64");
+			goto out;
+		} else if (size == 0) {
+			break;
+		}
 
-	ctx.mName = name;
-	ctx.mPid = -1;
+		for (off = 0; off < size; off += entry->d_reclen) {
+			entry = (const PidDirent *) (buf + off);
 
-	ret = iterateAllPid(findProcessCb, &ctx);
-	if (ret < 0)
-		return ret;
+			// Entries of /proc and task directories are
+			// directories, the other ones are skipped unparsed
+			if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+				continue;
+
+			pid = parsePidName(entry->d_name);
+			if (pid < 0)
+				continue;
 
-	if (ctx.mPid != -1) {
-		ret = 0;
-		*outPid = ctx.mPid;
-	} else {
-		ret = -ENOENT;
+			if (!cb(pid, userdata)) {
+				ret = 0;
+				goto out;
+			}
+		}
 	}
 
+	ret = 0;
+
+out:
+	free(buf);
+	close(fd);
+
 	return ret;
 }
 
-static bool findAllProcessesCb(int pid, void *userdata)
+int iterateAllPid(PidFoundCb cb, void *userdata)
+{
+	return iteratePidDir("/proc", cb, userdata);
+}
+
+bool matchProcessName(const char *comm, const char *name)
+{
+	// comm is truncated by the kernel
+	return strncmp(comm, name, PROC_COMM_MAX_LEN) == 0;
+}
+
+int readProcessName(int pid, char *name, size_t size)
 {
-	auto pidList = (std::list<int> *) userdata;
+	char path[64];
+	ssize_t readRet;
+	int fd;
+	int ret;
+
+	if (!name || size == 0)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	readRet = read(fd, name, size - 1);
+	ret = -errno;
+	close(fd);
+	if (readRet <= 0)
+		return readRet == 0 ? -ENODATA : ret;
+
+	// Remove trailing '\n'
+	if (name[readRet - 1] == '\n')
+		readRet--;
 
-	pidList->push_back(pid);
+	name[readRet] = '\0';
 
-	return true;
+	return 0;
 }
 
-int findAllProcesses(std::list<int> *outPid)
+int readProcessCmdline(int pid, char *cmdline, size_t size)
 {
+	char path[64];
+	ssize_t readRet;
+	int fd;
 	int ret;
 
-	ret = iterateAllPid(findAllProcessesCb, outPid);
-	if (ret < 0)
+	if (!cmdline || size == 0)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	readRet = read(fd, cmdline, size - 1);
+	ret = -errno;
+	close(fd);
+	if (readRet < 0)
 		return ret;
 
+	// Arguments are separated by '\0', kernel threads have none
+	for (ssize_t i = 0; i < readRet; i++) {
+		if (cmdline[i] == '\0')
+			cmdline[i] = ' ';
+	}
+
+	while (readRet > 0 && cmdline[readRet - 1] == ' ')
+		readRet--;
+
+	cmdline[readRet] = '\0';
+
 	return 0;
 }
 
-static int getTimeNs(uint64_t *ns)
+int getTimeNs(uint64_t *ns)
 {
 	struct timespec ts;
 	int ret;
@@ -649,7 +747,104 @@ static int getTimeNs(uint64_t *ns)
 	return 0;
 }
 
+int setRawStatsContent(RawStats *stats, ssize_t size)
+{
+	if (size <= 0) {
+		stats->mPending = false;
+		return size < 0 ? (int) size : -ENODATA;
+	}
+
+	// Remove trailing '\n'
+	stats->mContent[size - 1] = '\0';
+	stats->mPending = true;
+
+	return 0;
+}
+
+RawStats::RawStats()
+{
+	mPending = false;
+	mTs = 0;
+	mAcqEnd = 0;
+	mContent = mInline;
+	mCapacity = sizeof(mInline);
+	mInline[0] = '\0';
+}
+
+RawStats::RawStats(const RawStats &other) : RawStats()
+{
+	*this = other;
+}
+
+RawStats::~RawStats()
+{
+	if (mContent != mInline)
+		free(mContent);
+}
+
+RawStats &RawStats::operator=(const RawStats &other)
+{
+	char *content;
+
+	if (this == &other)
+		return *this;
+
+	if (other.mCapacity > mCapacity) {
+		content = (char *) malloc(other.mCapacity);
+		if (content) {
+			if (mContent != mInline)
+				free(mContent);
+
+			mContent = content;
+			mCapacity = other.mCapacity;
+		}
+	}
+
+	mPending = other.mPending;
+	mTs = other.mTs;
+	mAcqEnd = other.mAcqEnd;
+	snprintf(mContent, mCapacity, "%s", other.mContent);
+
+	return *this;
+}
+
+int RawStats::grow()
+{
+	size_t capacity = mCapacity * 2;
+	char *content;
+
+	if (capacity > RAW_STATS_MAX_SIZE)
+		return -EFBIG;
+
+	// Content is always read again after a resize
+	content = (char *) malloc(capacity);
+	if (!content)
+		return -ENOMEM;
+
+	if (mContent != mInline)
+		free(mContent);
+
+	mContent = content;
+	mCapacity = capacity;
+
+	return 0;
+}
+
 int readRawStats(int fd, RawStats *stats)
+{
+	int ret;
+
+	if (fd == -1 || !stats)
+		return -EINVAL;
+
+	stats->mTs = TimeSource::now();
+	ret = readRawContent(fd, stats);
+	stats->mAcqEnd = TimeSource::now();
+
+	return ret;
+}
+
+int readRawContent(int fd, RawStats *stats)
 {
 	ssize_t readRet;
 	int ret;
@@ -657,39 +852,39 @@ int readRawStats(int fd, RawStats *stats)
 	if (fd == -1 || !stats)
 		return -EINVAL;
 
-	getTimeNs(&stats->mTs);
-	readRet = pread(fd, stats->mContent, sizeof(stats->mContent), 0);
-	getTimeNs(&stats->mAcqEnd);
+	while (true) {
+		readRet = pread(fd, stats->mContent, stats->mCapacity, 0);
+		if (readRet == -1 || !stats->isFull(readRet))
+			break;
+
+		ret = stats->grow();
+		if (ret < 0) {
+			LOGW("Stats of fd %d truncated to %zu bytes",
+			     fd, stats->mCapacity);
+			break;
+		}
+	}
+
 	if (readRet == -1) {
 		ret = -errno;
 		stats->mPending = false;
-		LOG_ERRNO("read");
+
+		// Exited task, handled by the caller
+		if (ret != -ESRCH)
+			LOG_ERRNO("read");
+
 		return ret;
 	}
 
-	// Remove trailing '\n'
-	stats->mContent[readRet - 1] = '\0';
-	stats->mPending = true;
-
-	return 0;
+	return setRawStatsContent(stats, readRet);
 }
 
 static int getNextLine(char *s, char **end, bool *endOfString)
 {
-	while (true) {
-		if (*s == '\n') {
-			*s = '\0';
-			*end = s;
-			*endOfString = false;
-			break;
-		} else if (*s == '\0') {
-			*end = s;
-			*endOfString = true;
-			break;
-		} else {
-			s++;
-		}
-	}
+	s = (char *) findDelim(s, '\n');
+	*endOfString = (*s == '\0');
+	*s = '\0';
+	*end = s;
 
 	return 0;
 }
@@ -712,6 +907,9 @@ static SysStatLine getSystemStatsLine(const char *s)
 	if (!end)
 		return SYSSTAT_UNKNOWN;
 
+	if (strncmp(s, "cpu", 3) == 0 && s[3] >= '0' && s[3] <= '9')
+		return SYSSTAT_LINE_PERCPU;
+
 	for (size_t i = 0; i < SIZEOF_ARRAY(values); i++) {
 		if (strncmp(s, values[i].s, end - s) == 0)
 			return values[i].v;
@@ -720,9 +918,11 @@ static SysStatLine getSystemStatsLine(const char *s)
 	return SYSSTAT_UNKNOWN;
 }
 
-int readSystemStats(char *s, SystemMonitor::SystemStats *stats)
+int readSystemStats(char *s,
+		    SystemMonitor::SystemStats *stats,
+		    std::vector<SystemMonitor::CpuStats> *cpuStats)
 {
-	TokenizerCb cb;
+	SystemMonitor::CpuStats cpu;
 	SysStatLine lineType;
 	bool endOfString = false;
 	bool process = true;
@@ -732,39 +932,59 @@ int readSystemStats(char *s, SystemMonitor::SystemStats *stats)
 	if (!s || !stats)
 		return -EINVAL;
 
+	if (cpuStats)
+		cpuStats->clear();
+
 	for (int line = 0; process && !endOfString; line++) {
 		ret = getNextLine(s, &end, &endOfString);
 		if (ret < 0)
 			return ret;
 
 		lineType = getSystemStatsLine(s);
-		cb = nullptr;
 		switch (lineType) {
 		case SYSSTAT_LINE_CPU:
-			cb = processCpuCb;
+			ret = parseStatFields<SysStatCpuLayout,
+					SYSSTAT_CPU_FIELDS>(s, stats);
+			break;
+
+		case SYSSTAT_LINE_PERCPU:
+			if (!cpuStats) {
+				ret = 0;
+				break;
+			}
+
+			// A cpu line cut by a full read buffer is dropped
+			ret = parseStatFields<SysStatPerCpuLayout,
+					SYSSTAT_CPU_FIELDS |
+					statFieldBit(SYSSTAT_CPU_IDX_NAME)>(s, &cpu);
+			if (ret == 0)
+				cpuStats->push_back(cpu);
+
+			ret = 0;
 			break;
 
 		case SYSSTAT_IRQ:
-			cb = processIrqCountCb;
+			ret = parseStatFields<SysStatIrqLayout,
+					statFieldBit(SYSSTAT_IRQ_IDX_COUNT)>(s, stats);
 			break;
 
 		case SYSSTAT_SOFT_IRQ:
-			cb = processSoftIrqCountCb;
+			ret = parseStatFields<SysStatSoftIrqLayout,
+					statFieldBit(SYSSTAT_SOFTIRQ_IDX_COUNT)>(s, stats);
 			break;
 
 		case SYSSTAT_CTX_SWITCH:
-			cb = processCtxSwitchCountCb;
+			ret = parseStatFields<SysStatCtxSwitchLayout,
+					statFieldBit(SYSSTAT_CTXSWITCH_COUNT)>(s, stats);
 			break;
 
 		default:
+			ret = 0;
 			break;
 		}
 
-		if (cb) {
-			ret = tokenizeStats(s, cb, stats);
-			if (ret < 0)
-				return ret;
-		}
+		if (ret < 0)
+			return ret;
 
 		s = end + 1;
 	}
@@ -837,18 +1057,12 @@ int readMeminfoStats(char *s, SystemMonitor::SystemStats *stats)
 
 int readProcessStats(const char *s, SystemMonitor::ProcessStats *stats)
 {
-	if (!stats)
-		return -EINVAL;
-
-	return tokenizeStats(s, processStatsCb, stats);
+	return parseStatFields<ProcessStatLayout, PROCESS_STAT_FIELDS>(s, stats);
 }
 
 int readThreadStats(const char *s, SystemMonitor::ThreadStats *stats)
 {
-	if (!stats)
-			return -EINVAL;
-
-	return tokenizeStats(s, threadStatsCb, stats);
+	return parseStatFields<ThreadStatLayout, THREAD_STAT_FIELDS>(s, stats);
 }
 
 } // namespace pfstools
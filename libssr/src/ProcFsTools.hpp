@@ -1,24 +1,70 @@
 #ifndef __PROCSTATPARSER_HPP__
 #define __PROCSTATPARSER_HPP__
 
-#define STAT_SIZE 4096*2
+// Enough for a /proc/<pid>/stat line, bigger files go to the heap
+#define RAW_STATS_INLINE_SIZE 512
+#define RAW_STATS_MAX_SIZE (1024 * 1024)
+
+// Task names are truncated by the kernel (TASK_COMM_LEN - 1)
+#define PROC_COMM_MAX_LEN 15
 
 namespace pfstools {
 
+/**
+ * Content of a procfs file. The buffer starts inline and grows when a read
+ * fills it, the capacity reached is kept for the next reads of the file.
+ */
 struct RawStats {
 	bool mPending;
 	uint64_t mTs;
 	uint64_t mAcqEnd;
-	char mContent[STAT_SIZE];
+
+	char *mContent;
+	size_t mCapacity;
+
+	RawStats();
+	RawStats(const RawStats &other);
+	~RawStats();
+
+	RawStats &operator=(const RawStats &other);
+
+	int grow();
+
+	// A read that filled the buffer may have been truncated
+	bool isFull(ssize_t size) const { return (size_t) size >= mCapacity; }
+
+private:
+	char mInline[RAW_STATS_INLINE_SIZE];
 };
 
-int findProcess(const char *name, int *outPid);
+// Return false from the callback to stop the iteration
+typedef bool (*PidFoundCb) (int pid, void *userdata);
 
-int findAllProcesses(std::list<int> *outPid);
+// Numeric entries of a directory, as /proc or /proc/<pid>/task
+int iteratePidDir(const char *path, PidFoundCb cb, void *userdata);
+
+int iterateAllPid(PidFoundCb cb, void *userdata);
+
+bool matchProcessName(const char *comm, const char *name);
+
+int readProcessName(int pid, char *name, size_t size);
+
+// Arguments are joined by spaces, truncated to size
+int readProcessCmdline(int pid, char *cmdline, size_t size);
+
+int getTimeNs(uint64_t *ns);
 
 int readRawStats(int fd, RawStats *stats);
 
-int readSystemStats(char *s, SystemMonitor::SystemStats *stats);
+// Same as readRawStats(), without setting the timestamps
+int readRawContent(int fd, RawStats *stats);
+
+int setRawStatsContent(RawStats *stats, ssize_t size);
+
+// cpuStats is optional, it is filled with one entry per cpuN line
+int readSystemStats(char *s,
+		    SystemMonitor::SystemStats *stats,
+		    std::vector<SystemMonitor::CpuStats> *cpuStats);
 
 int readMeminfoStats(char *s, SystemMonitor::SystemStats *stats);
 
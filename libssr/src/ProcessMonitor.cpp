@@ -1,34 +1,80 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <dirent.h>
 #include "ssr_priv.hpp"
 
 #define INVALID_PID -1
 
+// Acquisitions with a wrong thread count before a rescan when proc events
+// are used
+#define THREADS_MISMATCH_RESCAN 10
+
+// Minimum delay between two task directory scans of a process
+#define THREADS_RESCAN_INTERVAL_MS 500
+
 ProcessMonitor::ProcessMonitor(const char *name,
 			       const SystemMonitor::Config *config,
-			       const SystemMonitor::SystemConfig *sysSettings)
+			       const SystemMonitor::ProcessConfig &procConfig,
+			       const SystemMonitor::SystemConfig *sysSettings,
+			       FdBudget *fdBudget)
 {
 	mResearchType = ResearchType::byName;
 	mState = AcqState::pending;
 	mStatFd = -1;
+	mLoop = nullptr;
+	mExitCb = nullptr;
+	mPidFd = -1;
+	mTaskFd = -1;
+	mReopenCount = 0;
+	mThreadsSkipped = false;
+	mSkippedReads = 0;
 	mName = name;
 	mPid = INVALID_PID;
 	mConfig = config;
 	mSysSettings = sysSettings;
+	mFdBudget = fdBudget;
+	mRecordThreads = procConfig.mRecordThreads;
+	mThreadsShed = false;
+	mPriority = procConfig.mPriority;
+	mSchedule.mPeriodMs = procConfig.mAcqPeriodMs;
+	mSelector = nullptr;
+	mEventDriven = false;
+	mRescan = false;
+	mThreadsMismatch = 0;
+	mScanGen = 0;
+	mLastScanTs = 0;
 }
 
 ProcessMonitor::ProcessMonitor(int pid,
 			       const SystemMonitor::Config *config,
-			       const SystemMonitor::SystemConfig *sysSettings)
+			       const SystemMonitor::ProcessConfig &procConfig,
+			       const SystemMonitor::SystemConfig *sysSettings,
+			       FdBudget *fdBudget)
 {
 	mResearchType = ResearchType::byPid;
 	mState = AcqState::pending;
 	mStatFd = -1;
+	mLoop = nullptr;
+	mExitCb = nullptr;
+	mPidFd = -1;
+	mTaskFd = -1;
+	mReopenCount = 0;
+	mThreadsSkipped = false;
+	mSkippedReads = 0;
 	mPid = pid;
 	mConfig = config;
 	mSysSettings = sysSettings;
+	mFdBudget = fdBudget;
+	mRecordThreads = procConfig.mRecordThreads;
+	mThreadsShed = false;
+	mPriority = procConfig.mPriority;
+	mSchedule.mPeriodMs = procConfig.mAcqPeriodMs;
+	mSelector = nullptr;
+	mEventDriven = false;
+	mRescan = false;
+	mThreadsMismatch = 0;
+	mScanGen = 0;
+	mLastScanTs = 0;
 }
 
 
@@ -37,122 +83,197 @@ ProcessMonitor::~ProcessMonitor()
 	cleanProcessAndThreadsFd();
 }
 
-int ProcessMonitor::addNewThread(int tid)
+bool ProcessMonitor::useTaskStats() const
 {
-	pfstools::RawStats rawStats;
-	SystemMonitor::ThreadStats stats;
-	ThreadInfo info;
-	char path[128];
-	int ret;
+	return mConfig->mStatsBackend == SystemMonitor::StatsBackend::taskstats;
+}
 
-	// Open thread fd
-	snprintf(path, sizeof(path),
-		 "/proc/%d/task/%d/stat",
-		 mPid, tid);
+bool ProcessMonitor::skipsIdleThreads() const
+{
+	return mConfig->mIdleThreadsRefreshMs > 0;
+}
 
-	ret = open(path, O_RDONLY|O_CLOEXEC);
-	if (ret == -1) {
-		ret = -errno;
-		LOGE("Fail to open %s : %d(%m)", path, errno);
-		return ret;
+void ProcessMonitor::nameThread(ThreadTable::Cold *cold, int tid,
+				const char *name)
+{
+	snprintf(cold->mName, sizeof(cold->mName), "%d-%s", tid, name);
+
+	LOGD("Found new thread %s for process %d", cold->mName, mPid);
+}
+
+int ProcessMonitor::openThreadFd(int tid)
+{
+	char path[128];
+	int fd;
+
+	// Relative to the task directory, the path lookup is shorter
+	if (mTaskFd != -1) {
+		snprintf(path, sizeof(path), "%d/stat", tid);
+		fd = openat(mTaskFd, path, O_RDONLY|O_CLOEXEC);
+	} else {
+		snprintf(path, sizeof(path),
+			 "/proc/%d/task/%d/stat",
+			 mPid, tid);
+		fd = open(path, O_RDONLY|O_CLOEXEC);
 	}
 
-	info.mTid = tid;
-	info.mFd = ret;
+	if (fd == -1) {
+		int ret = -errno;
+
+		// Short lived threads may have exited since the scan
+		if (ret != -ENOENT) {
+			LOGE("Fail to open thread %d of process %d : %d(%m)",
+			     tid, mPid, errno);
+		}
 
-	// Read stats to get its name
-	ret = pfstools::readRawStats(info.mFd, &rawStats);
-	if (ret < 0) {
-		close(info.mFd);
 		return ret;
 	}
 
-	ret = pfstools::readThreadStats(rawStats.mContent, &stats);
-	if (ret < 0)
-		return ret;
+	return fd;
+}
+
+void ProcessMonitor::closeThreadFd(size_t idx)
+{
+	ThreadTable::Hot &hot = mThreads.hot(idx);
+
+	if (hot.mFd == -1)
+		return;
+
+	close(hot.mFd);
+	hot.mFd = -1;
 
-	snprintf(info.mName, sizeof(info.mName),
-		 "%d-%s",
-		 tid,
-		 stats.mName);
+	if (!hot.mTransient)
+		mFdBudget->release();
 
-	LOGD("Found new thread %s for process %d",
-	     info.mName, mPid);
+	hot.mTransient = false;
+}
+
+int ProcessMonitor::addNewThread(int tid)
+{
+	pfstools::RawStats rawStats;
+	SystemMonitor::ThreadStats stats;
+	int fd;
+	int ret;
+
+	// With procfs, the thread is named by its first acquisition. With
+	// taskstats, the stat file is only needed to get the name.
+	if (useTaskStats()) {
+		fd = openThreadFd(tid);
+		if (fd < 0)
+			return fd;
+
+		ret = pfstools::readRawStats(fd, &rawStats);
+		close(fd);
+		fd = -1;
+		if (ret < 0)
+			return ret;
+
+		ret = pfstools::readThreadStats(rawStats.mContent, &stats);
+		if (ret < 0)
+			return ret;
+	} else if (mFdBudget->acquire()) {
+		fd = openThreadFd(tid);
+		if (fd < 0) {
+			mFdBudget->release();
+			return fd;
+		}
+	} else {
+		// Over budget, opened at each acquisition
+		fd = -1;
+	}
 
 	// Register thread
-	auto insertRet = mThreads.insert( {tid, info} );
-	if (!insertRet.second) {
+	ret = mThreads.insert(tid, fd, "");
+	if (ret < 0) {
 		LOGE("Fail to insert thread %d", tid);
-		close(info.mFd);
-		return -EPERM;
+		if (fd != -1) {
+			close(fd);
+			mFdBudget->release();
+		}
+		return ret;
 	}
 
+	mThreads.cold(ret).mScanGen = mScanGen;
+
+	if (useTaskStats())
+		nameThread(&mThreads.cold(ret), tid, stats.mName);
+
 	return 0;
 }
 
+bool ProcessMonitor::findNewThreadsCb(int tid, void *userdata)
+{
+	auto self = (ProcessMonitor *) userdata;
+	int idx;
+
+	idx = self->mThreads.find(tid);
+	if (idx == -1)
+		self->mNewTids.push_back(tid);
+	else
+		self->mThreads.cold(idx).mScanGen = self->mScanGen;
+
+	return true;
+}
+
 int ProcessMonitor::findNewThreads()
 {
-	DIR *d;
-	struct dirent entry;
-	struct dirent *result = nullptr;
 	char path[128];
-	int tid;
-	char *endptr;
+	size_t i = 0;
 	int ret;
 
 	snprintf(path, sizeof(path), "/proc/%d/task", mPid);
 
-	d = opendir(path);
-	if (!d) {
-		ret = -errno;
-		LOGE("Fail to open /proc : %d(%m)", errno);
-		return ret;
-	}
+	mScanGen++;
+	mNewTids.clear();
 
-	while (true) {
-		ret = readdir_r(d, &entry, &result);
-		if (ret > 0) {
-			LOGE("readdir_r() failed : %d(%s)",
-			     ret, strerror(ret));
-			ret = -ret;
-			goto closedir;
-		} else if (ret == 0 && !result) {
-			break;
-		}
+	ret = pfstools::iteratePidDir(path, findNewThreadsCb, this);
+	if (ret < 0)
+		return ret;
 
-		tid = strtol(entry.d_name, &endptr, 10);
-		if (tid == LONG_MIN || tid == LONG_MAX || errno == EINVAL) {
-			LOGE("Ignore %s", entry.d_name);
-			continue;
-		} else if (*endptr != '\0') {
+	// Threads missing from the directory have exited
+	while (i < mThreads.size()) {
+		if (mThreads.cold(i).mScanGen == mScanGen) {
+			i++;
 			continue;
 		}
 
-		// Avoid to add thread if already exists
-		if (mThreads.count(tid) == 0) {
-			ret = addNewThread(tid);
-			if (ret < 0)
-				LOGE("Fail to add thread %d", tid);
-		}
+		closeThreadFd(i);
+		mThreads.remove(i);
 	}
 
-	closedir(d);
+	for (auto tid :mNewTids)
+		addNewThread(tid);
 
 	return 0;
-
-closedir:
-	closedir(d);
-
-	return ret;
 }
 
-int ProcessMonitor::readRawThreadsStats()
+int ProcessMonitor::readRawThreadsStats(RawStatsReader *reader,
+					TaskStats *taskStats)
 {
-	for (auto &thread : mThreads) {
-		ThreadInfo *threadInfo = &thread.second;
+	int fd;
+
+	for (size_t i = 0; i < mThreads.size(); i++) {
+		ThreadTable::Hot &hot = mThreads.hot(i);
+
+		if (taskStats) {
+			taskStats->add(hot.mTid, &mThreads.cold(i).mTaskStats);
+			continue;
+		}
+
+		// Over budget, only opened for this acquisition
+		if (hot.mFd == -1) {
+			fd = openThreadFd(hot.mTid);
+			if (fd < 0) {
+				mThreads.cold(i).mRawStats.mPending = false;
+				continue;
+			}
+
+			hot.mFd = fd;
+			hot.mTransient = true;
+			mReopenCount++;
+		}
 
-		pfstools::readRawStats(threadInfo->mFd,
-				       &threadInfo->mRawStats);
+		reader->add(hot.mFd, &mThreads.cold(i).mRawStats);
 	}
 
 	return 0;
@@ -160,66 +281,102 @@ int ProcessMonitor::readRawThreadsStats()
 
 int ProcessMonitor::processRawThreadsStats(const SystemMonitor::Callbacks &cb)
 {
-	std::list<std::map<int, ThreadInfo>::iterator> removeList;
 	SystemMonitor::ThreadStats threadStats;
+	size_t i = 0;
 	int ret;
 
-	for (auto i = mThreads.begin(); i != mThreads.end(); i++) {
-		ThreadInfo *threadInfo = &i->second;
+	while (i < mThreads.size()) {
+		ThreadTable::Hot &hot = mThreads.hot(i);
+		ThreadTable::Cold &cold = mThreads.cold(i);
+		bool pending;
 
-		if (!threadInfo->mRawStats.mPending) {
-			removeList.push_back(i);
-			continue;
+		if (useTaskStats()) {
+			pending = cold.mTaskStats.mPending;
+
+			// No reply, the thread is kept for the next
+			// acquisition
+			if (!pending && !cold.mTaskStats.mExited) {
+				i++;
+				continue;
+			}
+		} else {
+			pending = cold.mRawStats.mPending;
 		}
 
-		ret = pfstools::readThreadStats(threadInfo->mRawStats.mContent,
-						&threadStats);
-		if (ret < 0)
+		// Thread has exited. The last entry is moved at index i
+		if (!pending) {
+			closeThreadFd(i);
+			mThreads.remove(i);
 			continue;
+		}
+
+		// Content has been read, keep the fd only if an exited thread
+		// has freed a slot
+		if (hot.mTransient) {
+			if (mFdBudget->acquire())
+				hot.mTransient = false;
+			else
+				closeThreadFd(i);
+		}
+
+		if (useTaskStats()) {
+			const TaskStats::Sample &sample = cold.mTaskStats;
+
+			// taskstats CPU times are in microseconds. Clock ticks
+			// are derived from the cumulative times, their sub-tick
+			// part is kept by the nanosecond ones.
+			threadStats.mTid = hot.mTid;
+			threadStats.mUtime = sample.mUtime *
+					     mSysSettings->mClkTck / 1000000;
+			threadStats.mStime = sample.mStime *
+					     mSysSettings->mClkTck / 1000000;
+			threadStats.mUtimeNs = sample.mUtime * 1000;
+			threadStats.mStimeNs = sample.mStime * 1000;
+			threadStats.mTs = sample.mTs;
+			threadStats.mAcqEnd = sample.mAcqEnd;
+		} else {
+			ret = pfstools::readThreadStats(cold.mRawStats.mContent,
+							&threadStats);
+			if (ret < 0) {
+				i++;
+				continue;
+			}
+
+			threadStats.mUtimeNs = threadStats.mUtime *
+					       1000000000ULL /
+					       mSysSettings->mClkTck;
+			threadStats.mStimeNs = threadStats.mStime *
+					       1000000000ULL /
+					       mSysSettings->mClkTck;
+			threadStats.mTs = cold.mRawStats.mTs;
+			threadStats.mAcqEnd = cold.mRawStats.mAcqEnd;
+		}
+
+		// First acquisition of the thread
+		if (cold.mName[0] == '\0')
+			nameThread(&cold, hot.mTid, threadStats.mName);
 
 		if (cb.mThreadStats) {
-			threadStats.mTs = threadInfo->mRawStats.mTs;
-			threadStats.mAcqEnd = threadInfo->mRawStats.mAcqEnd;
 
-			strncpy(threadStats.mName, threadInfo->mName,
+			strncpy(threadStats.mName, cold.mName,
 				sizeof(threadStats.mName));
 
 			threadStats.mPid = mPid;
 
 			cb.mThreadStats(threadStats, cb.mUserdata);
 		}
-	}
 
-	// Clean thread that haven't been found
-	for (auto &i :removeList)
-		mThreads.erase(i);
+		i++;
+	}
 
 	return 0;
 }
 
-int ProcessMonitor::openProcessAndThreadsFd()
+int ProcessMonitor::openPidFd()
 {
 	char path[64];
 	int ret;
 
-	// Open thread
-	switch (mResearchType) {
-	case ResearchType::byName:
-		ret = pfstools::findProcess(mName.c_str(), &mPid);
-		if (ret < 0)
-			return ret;
-
-		break;
-
-	case ResearchType::byPid:
-		// pid already known
-		break;
-
-	default:
-		LOGE("Research type unknown : %d", (int) mResearchType);
-		return -EINVAL;
-	}
-
 	snprintf(path, sizeof(path), "/proc/%d/stat", mPid);
 
 	mStatFd = open(path, O_RDONLY|O_CLOEXEC);
@@ -237,8 +394,20 @@ int ProcessMonitor::openProcessAndThreadsFd()
 	else
 		LOGD("Found process %d", mPid);
 
+	openExitFd();
+
+	// Threads over the fd budget are reopened relative to the task
+	// directory
+	if (mRecordThreads && mFdBudget->isLimited() && !useTaskStats()) {
+		snprintf(path, sizeof(path), "/proc/%d/task", mPid);
+
+		mTaskFd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (mTaskFd == -1)
+			LOGW("Fail to open %s : %d(%m)", path, errno);
+	}
+
 	// Find threads
-	if (mConfig->mRecordThreads) {
+	if (mRecordThreads) {
 		ret = findNewThreads();
 		if (ret < 0)
 			return ret;
@@ -259,75 +428,314 @@ int ProcessMonitor::cleanProcessAndThreadsFd()
 		mStatFd = -1;
 	}
 
+	if (mPidFd != -1) {
+		mLoop->delFd(mPidFd);
+		close(mPidFd);
+		mPidFd = -1;
+	}
+
 	// Close threads fd
-	for (auto p : mThreads)
-		close(p.second.mFd);
+	for (size_t i = 0; i < mThreads.size(); i++)
+		closeThreadFd(i);
 
 	mThreads.clear();
 
-	// Drop process if it doesn't exist anymore. Only when the research
-	// is done by pid.
-	if (mResearchType == ResearchType::byPid)
-		mThreads.erase(mPid);
+	if (mTaskFd != -1) {
+		close(mTaskFd);
+		mTaskFd = -1;
+	}
 
 	return 0;
 }
 
+int ProcessMonitor::openExitFd()
+{
+	int ret;
+
+	if (!mLoop)
+		return 0;
+
+	mPidFd = pidfd_open(mPid, 0);
+	if (mPidFd == -1) {
+		// Kernels older than 5.3 : exits are found by failed reads
+		ret = -errno;
+		LOGD("pidfd_open(%d) failed : %d(%m)", mPid, errno);
+		return ret;
+	}
+
+	ret = mLoop->addFd(EPOLLIN, mPidFd,
+		[this] (int fd, int evt) {
+			onExit();
+		});
+	if (ret < 0) {
+		LOGE("EventLoop::addFd() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		close(mPidFd);
+		mPidFd = -1;
+		return ret;
+	}
+
+	return 0;
+}
+
+void ProcessMonitor::onExit()
+{
+	SystemMonitor::ProcessStats processStats;
+	SystemMonitor::ProcessExit exitStats;
+	int ret;
+
+	if (mStatFd == -1)
+		return;
+
+	// Last sample. The process stays a zombie until it is reaped, its
+	// stat file is readable meanwhile.
+	ret = pfstools::readRawStats(mStatFd, &mRawStats);
+	if (ret == 0) {
+		ret = pfstools::readProcessStats(mRawStats.mContent,
+						 &processStats);
+	}
+
+	if (ret == 0) {
+		if (mName.empty())
+			mName = processStats.mName;
+
+		if (mExitCb->mProcessStats) {
+			processStats.mTs = mRawStats.mTs;
+			processStats.mAcqEnd = mRawStats.mAcqEnd;
+			mExitCb->mProcessStats(processStats, mExitCb->mUserdata);
+		}
+
+		exitStats.mTs = mRawStats.mAcqEnd;
+	} else {
+		exitStats.mTs = TimeSource::now();
+	}
+
+	if (!mName.empty())
+		LOGN("Process %d-%s has stopped", mPid, mName.c_str());
+	else
+		LOGN("Process %d has stopped", mPid);
+
+	if (mExitCb->mProcessExit) {
+		exitStats.mPid = mPid;
+		snprintf(exitStats.mName, sizeof(exitStats.mName), "%s",
+			 mName.c_str());
+		mExitCb->mProcessExit(exitStats, mExitCb->mUserdata);
+	}
+
+	// No more reads of this pid, it may be reused
+	cleanProcessAndThreadsFd();
+	mState = AcqState::failed;
+}
+
 int ProcessMonitor::init()
 {
-	return openProcessAndThreadsFd();
+	// Named processes are attached by the SystemMonitor discovery pass
+	if (mResearchType == ResearchType::byName)
+		return 0;
+
+	return openPidFd();
+}
+
+void ProcessMonitor::watchExit(EventLoop *loop,
+			       const SystemMonitor::Callbacks *cb)
+{
+	mLoop = loop;
+	mExitCb = cb;
+}
+
+void ProcessMonitor::setEventDriven(bool eventDriven)
+{
+	mEventDriven = eventDriven;
+}
+
+void ProcessMonitor::requestRescan()
+{
+	mRescan = true;
+}
+
+bool ProcessMonitor::isWaitingProcess() const
+{
+	return mResearchType == ResearchType::byName && mStatFd == -1;
+}
+
+bool ProcessMonitor::needsDiscovery() const
+{
+	// With proc events, only scan /proc when events may have been lost
+	return isWaitingProcess() && (!mEventDriven || mRescan);
+}
+
+bool ProcessMonitor::isStopped() const
+{
+	return mResearchType == ResearchType::byPid &&
+	       mState == AcqState::failed;
+}
+
+int ProcessMonitor::attach(int pid)
+{
+	if (!isWaitingProcess())
+		return -EPERM;
+
+	mPid = pid;
+
+	return openPidFd();
+}
+
+void ProcessMonitor::release()
+{
+	if (mStatFd == -1)
+		return;
+
+	cleanProcessAndThreadsFd();
+	mState = AcqState::failed;
+
+	// Another running process may match
+	if (mResearchType == ResearchType::byName)
+		mRescan = true;
+}
+
+void ProcessMonitor::addThread(int tid)
+{
+	int ret;
+
+	if (mStatFd == -1 || !mRecordThreads)
+		return;
+	else if (mThreads.find(tid) != -1)
+		return;
+
+	ret = addNewThread(tid);
+	if (ret < 0)
+		LOGD("Fail to add thread %d", tid);
+}
+
+void ProcessMonitor::removeThread(int tid)
+{
+	int idx = mThreads.find(tid);
+
+	if (idx == -1)
+		return;
+
+	closeThreadFd(idx);
+	mThreads.remove(idx);
 }
 
-int ProcessMonitor::readRawStats()
+int ProcessMonitor::readRawStats(RawStatsReader *reader, TaskStats *taskStats)
 {
 	int ret;
 
+	mReopenCount = 0;
+	mSkippedReads = 0;
+	mThreadsSkipped = mThreadsShed;
+
 	if (mStatFd == -1) {
 		mRawStats.mPending = false;
 		return 0;
 	}
 
-	// Read process stats
-	ret = pfstools::readRawStats(mStatFd, &mRawStats);
-	if (ret < 0) {
-		if (!mName.empty()) {
-			LOGN("Process %d-%s has stopped",
-			     mPid, mName.c_str());
-		} else {
-			LOGN("Process %d has stopped", mPid);
-		}
+	if (mConfig->mTsGranularity == SystemMonitor::TimestampGranularity::process)
+		reader->beginGroup();
 
-		cleanProcessAndThreadsFd();
-		mState = AcqState::failed;
+	// Queue process stats. Failures are only known once the reader has
+	// been flushed, they are handled by processRawStats().
+	ret = reader->add(mStatFd, &mRawStats);
+	if (ret < 0) {
+		reader->endGroup();
 		return ret;
 	}
 
-	// Process threads only if requested
-	if (mConfig->mRecordThreads)
-		readRawThreadsStats();
+	// Process threads only if requested. When idle threads are skipped,
+	// they are read by readRawBusyThreadsStats().
+	if (mRecordThreads && !mThreadsSkipped && !skipsIdleThreads())
+		readRawThreadsStats(reader, taskStats);
+
+	reader->endGroup();
 
 	return 0;
 }
 
-int ProcessMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
+int ProcessMonitor::readRawBusyThreadsStats(RawStatsReader *reader,
+					    TaskStats *taskStats)
 {
 	SystemMonitor::ProcessStats processStats;
+	uint64_t cpuTime;
 	int ret;
 
+	if (!mRecordThreads || mThreadsSkipped || mStatFd == -1 ||
+	    !mRawStats.mPending)
+		return 0;
+
+	ret = pfstools::readProcessStats(mRawStats.mContent, &processStats);
+	if (ret < 0)
+		return ret;
+
+	cpuTime = processStats.mUtime + processStats.mStime;
+	if (!mIdleThreads.update(cpuTime, mRawStats.mTs,
+				 mConfig->mIdleThreadsRefreshMs)) {
+		mThreadsSkipped = true;
+		mSkippedReads = mThreads.size();
+		return 0;
+	}
+
+	if (mConfig->mTsGranularity == SystemMonitor::TimestampGranularity::process)
+		reader->beginGroup();
+
+	ret = readRawThreadsStats(reader, taskStats);
+
+	reader->endGroup();
+
+	return ret;
+}
+
+void ProcessMonitor::closeTransientFds()
+{
+	// Only opened by readRawThreadsStats()
+	if (mReopenCount == 0)
+		return;
+
+	for (size_t i = 0; i < mThreads.size(); i++) {
+		if (mThreads.hot(i).mTransient)
+			closeThreadFd(i);
+	}
+}
+
+int ProcessMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
+{
+	SystemMonitor::ProcessStats processStats;
+	int ret = 0;
+
+	if (mStatFd != -1 && !mRawStats.mPending) {
+		// The process has stopped. With a pidfd, it is handled by
+		// onExit() from the loop, as soon as the pidfd is notified.
+		if (mPidFd != -1)
+			goto out;
+
+		// Process stats read has failed : the process has stopped
+		if (!mName.empty()) {
+			LOGN("Process %d-%s has stopped",
+			     mPid, mName.c_str());
+		} else {
+			LOGN("Process %d has stopped", mPid);
+		}
+
+		cleanProcessAndThreadsFd();
+		mState = AcqState::failed;
+	}
+
 	if (mState == AcqState::failed && mResearchType == ResearchType::byPid) {
 		// Acquisition has failed at least once after a snapshot of
 		// all the existing pid. It should mean that the process has
 		// stopped. Avoid any further acquisition
-		return 0;
+		goto out;
 	} else if (!mRawStats.mPending) {
 		// Acquisition has failed. This means the process is currently not
-		// known.
-		ret = openProcessAndThreadsFd();
+		// known. It is attached by the next discovery pass, or by proc
+		// events when it starts.
+		ret = 0;
+		mRescan = false;
 	} else {
 		ret = pfstools::readProcessStats(mRawStats.mContent,
 						 &processStats);
 		if (ret < 0)
-			return ret;
+			goto out;
 
 		if (mName.empty()) {
 			mName = processStats.mName;
@@ -341,16 +749,43 @@ int ProcessMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
 			cb.mProcessStats(processStats, cb.mUserdata);
 		}
 
-		// Process threads only if requested
-		if (mConfig->mRecordThreads) {
+		// Process threads only if requested, and if they have been
+		// read
+		if (mRecordThreads && !mThreadsSkipped) {
 			ret = processRawThreadsStats(cb);
 			if (ret < 0)
-				return ret;
-
-			if (mThreads.size() != processStats.mThreadCount)
+				goto out;
+
+			// Exited threads are dropped when their read fails,
+			// only a higher count means that threads are missing
+			if (processStats.mThreadCount > mThreads.size())
+				mThreadsMismatch++;
+			else
+				mThreadsMismatch = 0;
+
+			// With proc events, threads are added as they are
+			// created. Only rescan if events have been lost or if
+			// the thread count stays wrong. Otherwise rescans are
+			// rate limited, threads created meanwhile are found by
+			// the next one.
+			if (mThreadsMismatch > 0 &&
+			    (!mEventDriven || mRescan ||
+			     mThreadsMismatch >= THREADS_MISMATCH_RESCAN) &&
+			    (mRescan || mRawStats.mTs - mLastScanTs >=
+			     THREADS_RESCAN_INTERVAL_MS * 1000000ULL)) {
 				findNewThreads();
+				mLastScanTs = mRawStats.mTs;
+				mThreadsMismatch = 0;
+			}
 		}
+
+		mRescan = false;
 	}
 
+out:
+	// Threads fds opened over the budget are not kept, whatever the
+	// process stats
+	closeTransientFds();
+
 	return ret;
 }
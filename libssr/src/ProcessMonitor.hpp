@@ -1,6 +1,8 @@
 #ifndef __PROCESS_MONITOR_HPP__
 #define __PROCESS_MONITOR_HPP__
 
+class ProcessSelector;
+
 class ProcessMonitor {
 private:
 	enum class ResearchType : int {
@@ -14,14 +16,6 @@ private:
 		failed
 	};
 
-	struct ThreadInfo {
-		int mTid;
-		int mFd;;
-		char mName[64];
-
-		pfstools::RawStats mRawStats;
-	};
-
 private:
 	ResearchType mResearchType;
 
@@ -31,41 +25,136 @@ private:
 	std::string mName;
 	const SystemMonitor::Config *mConfig;
 	const SystemMonitor::SystemConfig *mSysSettings;
+	FdBudget *mFdBudget;
+	bool mRecordThreads;
+	AcqSchedule mSchedule;
+
+	// Load shedding : threads are not read, and processes of the lowest
+	// priorities are not read first
+	bool mThreadsShed;
+	int mPriority;
+
+	// Selector that has created this monitor, for all instances selectors
+	ProcessSelector *mSelector;
 
 	pfstools::RawStats mRawStats;
 
-	std::map<int, ThreadInfo> mThreads;
+	ThreadTable mThreads;
+
+	// Exit notification, registered in mLoop once the process is found
+	EventLoop *mLoop;
+	const SystemMonitor::Callbacks *mExitCb;
+	int mPidFd;
+
+	// /proc/<pid>/task, only kept with a thread fd budget
+	int mTaskFd;
+	uint32_t mReopenCount;
+
+	// Idle threads skipping
+	IdleThreads mIdleThreads;
+	bool mThreadsSkipped;
+	uint32_t mSkippedReads;
+
+	// Process and threads are discovered by proc events
+	bool mEventDriven;
+	bool mRescan;
+	int mThreadsMismatch;
+
+	// Task directory scans. Known threads are marked with the scan
+	// generation, new ones are opened once the directory has been read.
+	uint32_t mScanGen;
+	uint64_t mLastScanTs;
+	std::vector<int> mNewTids;
 
 private:
-	int openProcessAndThreadsFd();
+	int openPidFd();
 
 	int cleanProcessAndThreadsFd();
 
+	int openExitFd();
+	void onExit();
+
+	int openThreadFd(int tid);
+	void closeThreadFd(size_t idx);
+	void closeTransientFds();
+
 	int addNewThread(int tid);
 
+	void nameThread(ThreadTable::Cold *cold, int tid, const char *name);
+
 	int findNewThreads();
+	static bool findNewThreadsCb(int tid, void *userdata);
 
-	int readRawThreadsStats();
+	bool useTaskStats() const;
+	bool skipsIdleThreads() const;
+
+	int readRawThreadsStats(RawStatsReader *reader, TaskStats *taskStats);
 
 	int processRawThreadsStats(const SystemMonitor::Callbacks &cb);
 
 public:
 	ProcessMonitor(const char *name,
 		       const SystemMonitor::Config *config,
-		       const SystemMonitor::SystemConfig *sysSettings);
+		       const SystemMonitor::ProcessConfig &procConfig,
+		       const SystemMonitor::SystemConfig *sysSettings,
+		       FdBudget *fdBudget);
 
 	ProcessMonitor(int pid,
 		       const SystemMonitor::Config *config,
-		       const SystemMonitor::SystemConfig *sysSettings);
+		       const SystemMonitor::ProcessConfig &procConfig,
+		       const SystemMonitor::SystemConfig *sysSettings,
+		       FdBudget *fdBudget);
 
 
 	~ProcessMonitor();
 
 	int init();
-	int readRawStats();
+	int readRawStats(RawStatsReader *reader, TaskStats *taskStats);
 	int processRawStats(const SystemMonitor::Callbacks &cb);
 
+	// Second read step when idle threads are skipped : threads are read
+	// once the process stats read by readRawStats() are available
+	int readRawBusyThreadsStats(RawStatsReader *reader,
+				    TaskStats *taskStats);
+
+	// Handle the exit as soon as the pidfd is notified. Without it, the
+	// exit is found by the first failed acquisition.
+	void watchExit(EventLoop *loop, const SystemMonitor::Callbacks *cb);
+
+	void setEventDriven(bool eventDriven);
+	void requestRescan();
+
+	bool isWaitingProcess() const;
+	bool needsDiscovery() const;
+
+	// Monitor of a known pid whose process has exited
+	bool isStopped() const;
+
+	int attach(int pid);
+
+	// Stop reading a process that doesn't match its selector anymore.
+	// A named monitor waits for another process, a pid monitor is
+	// stopped.
+	void release();
+
+	void addThread(int tid);
+	void removeThread(int tid);
+
 	const char *getName() const { return mName.c_str(); }
+	int getPid() const { return mPid; }
+	AcqSchedule *getSchedule() { return &mSchedule; }
+
+	int getPriority() const { return mPriority; }
+	void setThreadsShed(bool shed) { mThreadsShed = shed; }
+
+	// Thread fds opened by the last read, not kept because of the budget
+	uint32_t getReopenCount() const { return mReopenCount; }
+
+	// Thread reads skipped by the last read, the process being idle
+	uint32_t getSkippedReads() const { return mSkippedReads; }
+
+	void setSelector(ProcessSelector *selector) { mSelector = selector; }
+	ProcessSelector *getSelector() const { return mSelector; }
 };
 
 #endif // !__PROCESS_MONITOR_HPP__
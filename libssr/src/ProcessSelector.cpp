@@ -0,0 +1,158 @@
+#include "ssr_priv.hpp"
+
+ProcessSelector::ProcessSelector()
+{
+	mHasRegex = false;
+	mMonitor = nullptr;
+	mRescan = true;
+}
+
+ProcessSelector::~ProcessSelector()
+{
+	if (mHasRegex)
+		regfree(&mRegex);
+}
+
+void ProcessSelector::globToRegex(const char *glob, std::string *regex)
+{
+	const char *end;
+	const char *p;
+
+	regex->assign("^");
+
+	for (p = glob; *p != '\0'; p++) {
+		switch (*p) {
+		case '*':
+			regex->append(".*");
+			break;
+
+		case '?':
+			regex->push_back('.');
+			break;
+
+		case '[':
+			// Bracket expressions have the same syntax, except the
+			// negation. A ']' right after the opening is a literal.
+			end = p + 1;
+			if (*end == '!')
+				end++;
+			if (*end == ']')
+				end++;
+			end = strchr(end, ']');
+			if (!end) {
+				regex->append("\\[");
+				break;
+			}
+
+			regex->push_back('[');
+			if (p[1] == '!') {
+				regex->push_back('^');
+				p++;
+			}
+			regex->append(p + 1, end - p);
+			p = end;
+			break;
+
+		case '.': case '^': case '$': case '+':
+		case '(': case ')': case '{': case '}':
+		case '|': case '\\':
+			regex->push_back('\\');
+			regex->push_back(*p);
+			break;
+
+		default:
+			regex->push_back(*p);
+			break;
+		}
+	}
+
+	regex->push_back('$');
+}
+
+int ProcessSelector::init(const char *pattern,
+			  const SystemMonitor::ProcessConfig &config)
+{
+	std::string regex;
+	int ret;
+
+	if (!pattern || pattern[0] == '\0')
+		return -EINVAL;
+
+	mPattern = pattern;
+	mConfig = config;
+	mSchedule.mPeriodMs = config.mAcqPeriodMs;
+
+	switch (config.mMatch) {
+	case SystemMonitor::MatchType::name:
+	case SystemMonitor::MatchType::cmdline:
+	case SystemMonitor::MatchType::all:
+		return 0;
+
+	case SystemMonitor::MatchType::glob:
+		globToRegex(pattern, &regex);
+		break;
+
+	case SystemMonitor::MatchType::regex:
+		regex = pattern;
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	ret = regcomp(&mRegex, regex.c_str(), REG_EXTENDED | REG_NOSUB);
+	if (ret != 0) {
+		char err[128];
+
+		regerror(ret, &mRegex, err, sizeof(err));
+		LOGE("Invalid pattern '%s' : %s", pattern, err);
+		return -EINVAL;
+	}
+
+	mHasRegex = true;
+
+	return 0;
+}
+
+bool ProcessSelector::match(const char *comm, const char *cmdline) const
+{
+	switch (mConfig.mMatch) {
+	case SystemMonitor::MatchType::name:
+		return pfstools::matchProcessName(comm, mPattern.c_str());
+
+	case SystemMonitor::MatchType::glob:
+	case SystemMonitor::MatchType::regex:
+		return regexec(&mRegex, comm, 0, nullptr, 0) == 0;
+
+	case SystemMonitor::MatchType::cmdline:
+		return cmdline && strstr(cmdline, mPattern.c_str()) != nullptr;
+
+	case SystemMonitor::MatchType::all:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool ProcessSelector::usesNameIndex() const
+{
+	return mConfig.mMatch == SystemMonitor::MatchType::name &&
+	       !mConfig.mAllInstances;
+}
+
+bool ProcessSelector::isWaiting() const
+{
+	if (mConfig.mAllInstances)
+		return true;
+
+	return mMonitor && mMonitor->isWaitingProcess();
+}
+
+bool ProcessSelector::needsDiscovery(bool eventDriven) const
+{
+	if (!mConfig.mAllInstances)
+		return mMonitor && mMonitor->needsDiscovery();
+
+	return !eventDriven || mRescan;
+}
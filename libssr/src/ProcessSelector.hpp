@@ -0,0 +1,81 @@
+#ifndef __PROCESS_SELECTOR_HPP__
+#define __PROCESS_SELECTOR_HPP__
+
+/**
+ * Processes selected by an addProcess() call.
+ *
+ * Patterns are compiled once by init(), so that match() stays cheap during
+ * the discovery scans. A single instance selector owns a named monitor,
+ * attached to the first process found. An all instances selector gets one
+ * monitor per matching pid, created by SystemMonitorImpl.
+ */
+class ProcessSelector {
+private:
+	std::string mPattern;
+	SystemMonitor::ProcessConfig mConfig;
+	regex_t mRegex;
+	bool mHasRegex;
+	AcqSchedule mSchedule;
+
+	// Single instance
+	ProcessMonitor *mMonitor;
+
+	// All instances : pids having a monitor
+	std::unordered_set<int> mPids;
+
+	// All instances with proc events : scan /proc once, as events may
+	// have been lost
+	bool mRescan;
+
+private:
+	static void globToRegex(const char *glob, std::string *regex);
+
+public:
+	ProcessSelector();
+	~ProcessSelector();
+
+	int init(const char *pattern, const SystemMonitor::ProcessConfig &config);
+
+	// comm and cmdline are only read when needed, see needsComm() and
+	// needsCmdline()
+	bool match(const char *comm, const char *cmdline) const;
+
+	// Single instance name selectors are matched by a hash lookup
+	bool usesNameIndex() const;
+
+	// A started process may be selected
+	bool isWaiting() const;
+
+	// Discovery scans are needed
+	bool needsDiscovery(bool eventDriven) const;
+
+	void requestRescan() { mRescan = true; }
+	void clearRescan() { mRescan = false; }
+
+	bool needsComm() const
+	{
+		return mConfig.mMatch != SystemMonitor::MatchType::cmdline &&
+		       mConfig.mMatch != SystemMonitor::MatchType::all;
+	}
+
+	bool needsCmdline() const
+	{
+		return mConfig.mMatch == SystemMonitor::MatchType::cmdline;
+	}
+
+	bool isAllInstances() const { return mConfig.mAllInstances; }
+
+	const char *getPattern() const { return mPattern.c_str(); }
+	const SystemMonitor::ProcessConfig &getConfig() const { return mConfig; }
+	AcqSchedule *getSchedule() { return &mSchedule; }
+
+	void setMonitor(ProcessMonitor *monitor) { mMonitor = monitor; }
+	ProcessMonitor *getMonitor() const { return mMonitor; }
+
+	bool hasPid(int pid) const { return mPids.count(pid) != 0; }
+	void addPid(int pid) { mPids.insert(pid); }
+	void removePid(int pid) { mPids.erase(pid); }
+	void clearPids() { mPids.clear(); }
+};
+
+#endif // !__PROCESS_SELECTOR_HPP__
@@ -0,0 +1,505 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ssr_priv.hpp"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define RAWSTATSREADER_URING
+#include <linux/io_uring.h>
+#endif
+
+#define URING_ENTRIES 256
+
+#ifdef RAWSTATSREADER_URING
+
+struct RawStatsReader::Uring {
+	int mFd;
+
+	// Submission ring
+	void *mSqRing;
+	size_t mSqRingSize;
+	uint32_t *mSqHead;
+	uint32_t *mSqTail;
+	uint32_t mSqMask;
+	uint32_t *mSqArray;
+	struct io_uring_sqe *mSqes;
+	size_t mSqesSize;
+
+	// Completion ring
+	void *mCqRing;
+	size_t mCqRingSize;
+	uint32_t *mCqHead;
+	uint32_t *mCqTail;
+	uint32_t mCqMask;
+	struct io_uring_cqe *mCqes;
+
+	// Reads queued by the current batch, indexed by sqe user_data
+	struct Read {
+		int mFd;
+		pfstools::RawStats *mStats;
+		bool mDone;
+	};
+
+	std::vector<Read> mInflight;
+
+	Uring()
+	{
+		mFd = -1;
+		mSqRing = MAP_FAILED;
+		mSqRingSize = 0;
+		mSqHead = nullptr;
+		mSqTail = nullptr;
+		mSqMask = 0;
+		mSqArray = nullptr;
+		mSqes = (struct io_uring_sqe *) MAP_FAILED;
+		mSqesSize = 0;
+		mCqRing = MAP_FAILED;
+		mCqRingSize = 0;
+		mCqHead = nullptr;
+		mCqTail = nullptr;
+		mCqMask = 0;
+		mCqes = nullptr;
+	}
+};
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+		      unsigned flags)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+			     flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+static bool uringSupportsRead(int fd)
+{
+	struct io_uring_probe *probe;
+	size_t size;
+	bool supported = false;
+	int ret;
+
+	size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = (struct io_uring_probe *) calloc(1, size);
+	if (!probe)
+		return false;
+
+	ret = uringRegister(fd, IORING_REGISTER_PROBE, probe, 256);
+	if (ret == 0 && probe->last_op >= IORING_OP_READ) {
+		supported = probe->ops[IORING_OP_READ].flags &
+			    IO_URING_OP_SUPPORTED;
+	}
+
+	free(probe);
+
+	return supported;
+}
+
+int RawStatsReader::initUring()
+{
+	struct io_uring_params params;
+	Uring *uring;
+	int ret;
+
+	uring = new Uring();
+
+	memset(&params, 0, sizeof(params));
+	uring->mFd = uringSetup(URING_ENTRIES, &params);
+	if (uring->mFd == -1) {
+		ret = -errno;
+		LOG_ERRNO("io_uring_setup");
+		goto error;
+	}
+
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		LOGW("io_uring: single mmap not supported by kernel");
+		ret = -ENOSYS;
+		goto error;
+	}
+
+	if (!uringSupportsRead(uring->mFd)) {
+		LOGW("io_uring: IORING_OP_READ not supported by kernel");
+		ret = -ENOSYS;
+		goto error;
+	}
+
+	// Map rings. With IORING_FEAT_SINGLE_MMAP, the completion ring
+	// shares the submission ring mapping.
+	uring->mSqRingSize = params.sq_off.array +
+			     params.sq_entries * sizeof(uint32_t);
+	uring->mCqRingSize = params.cq_off.cqes +
+			     params.cq_entries * sizeof(struct io_uring_cqe);
+	if (uring->mCqRingSize > uring->mSqRingSize)
+		uring->mSqRingSize = uring->mCqRingSize;
+
+	uring->mSqRing = mmap(NULL, uring->mSqRingSize,
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE,
+			      uring->mFd, IORING_OFF_SQ_RING);
+	if (uring->mSqRing == MAP_FAILED) {
+		ret = -errno;
+		LOG_ERRNO("mmap");
+		goto error;
+	}
+
+	uring->mCqRing = uring->mSqRing;
+
+	uring->mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->mSqes = (struct io_uring_sqe *) mmap(NULL, uring->mSqesSize,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,
+			uring->mFd, IORING_OFF_SQES);
+	if (uring->mSqes == MAP_FAILED) {
+		ret = -errno;
+		LOG_ERRNO("mmap");
+		goto error;
+	}
+
+	uring->mSqHead = (uint32_t *) ((char *) uring->mSqRing + params.sq_off.head);
+	uring->mSqTail = (uint32_t *) ((char *) uring->mSqRing + params.sq_off.tail);
+	uring->mSqMask = *(uint32_t *) ((char *) uring->mSqRing + params.sq_off.ring_mask);
+	uring->mSqArray = (uint32_t *) ((char *) uring->mSqRing + params.sq_off.array);
+
+	uring->mCqHead = (uint32_t *) ((char *) uring->mCqRing + params.cq_off.head);
+	uring->mCqTail = (uint32_t *) ((char *) uring->mCqRing + params.cq_off.tail);
+	uring->mCqMask = *(uint32_t *) ((char *) uring->mCqRing + params.cq_off.ring_mask);
+	uring->mCqes = (struct io_uring_cqe *) ((char *) uring->mCqRing + params.cq_off.cqes);
+
+	mUring = uring;
+
+	return 0;
+
+error:
+	mUring = uring;
+	clearUring();
+
+	return ret;
+}
+
+void RawStatsReader::clearUring()
+{
+	if (!mUring)
+		return;
+
+	if (mUring->mSqes != MAP_FAILED)
+		munmap(mUring->mSqes, mUring->mSqesSize);
+
+	if (mUring->mSqRing != MAP_FAILED)
+		munmap(mUring->mSqRing, mUring->mSqRingSize);
+
+	if (mUring->mFd != -1)
+		close(mUring->mFd);
+
+	delete mUring;
+	mUring = nullptr;
+}
+
+int RawStatsReader::queueUring(int fd, pfstools::RawStats *stats)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t tail;
+	uint32_t idx;
+	int ret;
+
+	// Submit pending reads if the submission ring is full. On error,
+	// they have been read with pread() and so is this one if io_uring
+	// was given up.
+	if (mQueued == mUring->mSqMask + 1) {
+		ret = submitUring();
+		if (ret < 0 && !mUring)
+			return pfstools::readRawStats(fd, stats);
+	}
+
+	if (mQueued == 0)
+		mSubmitTs = TimeSource::now();
+
+	tail = *mUring->mSqTail;
+	idx = tail & mUring->mSqMask;
+
+	sqe = &mUring->mSqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = 0;
+	sqe->addr = (uint64_t) (uintptr_t) stats->mContent;
+	sqe->len = stats->mCapacity;
+	sqe->user_data = mUring->mInflight.size();
+
+	mUring->mInflight.push_back({ fd, stats, false });
+
+	mUring->mSqArray[idx] = idx;
+	__atomic_store_n(mUring->mSqTail, tail + 1, __ATOMIC_RELEASE);
+
+	stats->mTs = mSubmitTs;
+	stats->mPending = false;
+	mQueued++;
+
+	return 0;
+}
+
+uint32_t RawStatsReader::reapUring()
+{
+	struct io_uring_cqe *cqe;
+	Uring::Read *read;
+	uint32_t count = 0;
+	uint32_t head;
+	uint32_t tail;
+	uint64_t ts;
+
+	ts = TimeSource::now();
+
+	head = *mUring->mCqHead;
+	tail = __atomic_load_n(mUring->mCqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++, count++) {
+		cqe = &mUring->mCqes[head & mUring->mCqMask];
+		if (cqe->user_data >= mUring->mInflight.size())
+			continue;
+
+		read = &mUring->mInflight[cqe->user_data];
+		read->mDone = true;
+
+		// Buffer too small, read the file again with pread()
+		if (cqe->res > 0 && read->mStats->isFull(cqe->res)) {
+			pfstools::readRawStats(read->mFd, read->mStats);
+			read->mStats->mTs = mSubmitTs;
+			continue;
+		}
+
+		read->mStats->mAcqEnd = ts;
+		pfstools::setRawStatsContent(read->mStats, cqe->res);
+	}
+
+	__atomic_store_n(mUring->mCqHead, head, __ATOMIC_RELEASE);
+
+	mReapTime += TimeSource::now() - ts;
+
+	return count;
+}
+
+void RawStatsReader::abortUring(uint32_t toSubmit, uint32_t remaining)
+{
+	uint32_t inflight = remaining - toSubmit;
+	uint32_t lost = 0;
+	uint64_t ts;
+	int ret;
+
+	// Sqes not consumed by the kernel would be submitted by the next
+	// batch, with indexes of this one : drop them
+	__atomic_store_n(mUring->mSqTail,
+			 __atomic_load_n(mUring->mSqHead, __ATOMIC_ACQUIRE),
+			 __ATOMIC_RELEASE);
+
+	// Submitted reads still write into their buffers, wait for them
+	while (inflight > 0) {
+		ts = TimeSource::now();
+		ret = uringEnter(mUring->mFd, 0, 1, IORING_ENTER_GETEVENTS);
+		mSubmitTime += TimeSource::now() - ts;
+		if (ret < 0 && errno != EINTR) {
+			LOG_ERRNO("io_uring_enter");
+			lost = inflight;
+			break;
+		}
+
+		inflight -= std::min(inflight, reapUring());
+	}
+
+	// Dropped reads are done with pread(). Submitted reads whose
+	// completion is lost may still write into their buffers, they are
+	// left without data.
+	for (size_t i = 0; i < mUring->mInflight.size(); i++) {
+		Uring::Read *read = &mUring->mInflight[i];
+
+		if (read->mDone)
+			continue;
+
+		if (i + toSubmit >= mUring->mInflight.size())
+			pfstools::readRawStats(read->mFd, read->mStats);
+	}
+
+	LOGW("io_uring submission failed (%u reads lost), fallback to pread()",
+	     lost);
+	clearUring();
+}
+
+int RawStatsReader::submitUring()
+{
+	uint32_t toSubmit;
+	uint32_t remaining;
+	uint64_t ts;
+	int ret;
+
+	// Sqes not consumed by the kernel yet, and completions not reaped
+	// yet. io_uring_enter() may consume only a part of the sqes.
+	toSubmit = mQueued;
+	remaining = mQueued;
+	mQueued = 0;
+
+	while (remaining > 0) {
+		ts = TimeSource::now();
+		ret = uringEnter(mUring->mFd, toSubmit, 1,
+				 IORING_ENTER_GETEVENTS);
+		mSubmitTime += TimeSource::now() - ts;
+		if (ret >= 0) {
+			toSubmit -= std::min(toSubmit, (uint32_t) ret);
+		} else if (errno == EINTR) {
+			// Retry
+		} else if ((errno == EAGAIN || errno == EBUSY) &&
+			   remaining > toSubmit) {
+			// Out of resources, wait for submitted reads first
+			ts = TimeSource::now();
+			uringEnter(mUring->mFd, 0, 1, IORING_ENTER_GETEVENTS);
+			mSubmitTime += TimeSource::now() - ts;
+		} else {
+			ret = -errno;
+			LOG_ERRNO("io_uring_enter");
+			abortUring(toSubmit, remaining);
+			return ret;
+		}
+
+		remaining -= std::min(remaining, reapUring());
+	}
+
+	mUring->mInflight.clear();
+
+	return 0;
+}
+
+#else // !RAWSTATSREADER_URING
+
+struct RawStatsReader::Uring {
+};
+
+int RawStatsReader::initUring()
+{
+	return -ENOSYS;
+}
+
+void RawStatsReader::clearUring()
+{
+}
+
+int RawStatsReader::queueUring(int fd, pfstools::RawStats *stats)
+{
+	return -ENOSYS;
+}
+
+uint32_t RawStatsReader::reapUring()
+{
+	return 0;
+}
+
+void RawStatsReader::abortUring(uint32_t toSubmit, uint32_t remaining)
+{
+}
+
+int RawStatsReader::submitUring()
+{
+	return -ENOSYS;
+}
+
+#endif // !RAWSTATSREADER_URING
+
+RawStatsReader::RawStatsReader()
+{
+	mUring = nullptr;
+	mQueued = 0;
+	mReadCount = 0;
+	mSubmitTime = 0;
+	mReapTime = 0;
+	mSubmitTs = 0;
+	mGrouped = false;
+	mGroupTs = 0;
+}
+
+RawStatsReader::~RawStatsReader()
+{
+	clearUring();
+}
+
+int RawStatsReader::init(SystemMonitor::ReadBackend backend)
+{
+	int ret;
+
+	// Already initialized
+	if (mUring)
+		return 0;
+
+	if (backend != SystemMonitor::ReadBackend::uring)
+		return 0;
+
+	ret = initUring();
+	if (ret < 0) {
+		LOGW("io_uring unavailable (%d(%s)), fallback to pread()",
+		     -ret, strerror(-ret));
+	}
+
+	return 0;
+}
+
+SystemMonitor::ReadBackend RawStatsReader::getBackend() const
+{
+	if (mUring)
+		return SystemMonitor::ReadBackend::uring;
+	else
+		return SystemMonitor::ReadBackend::pread;
+}
+
+int RawStatsReader::add(int fd, pfstools::RawStats *stats)
+{
+	if (fd == -1 || !stats)
+		return -EINVAL;
+
+	mReadCount++;
+
+	if (mUring)
+		return queueUring(fd, stats);
+
+	if (mGrouped) {
+		mGroup.push_back(stats);
+		return pfstools::readRawContent(fd, stats);
+	}
+
+	return pfstools::readRawStats(fd, stats);
+}
+
+void RawStatsReader::beginGroup()
+{
+	if (mUring)
+		return;
+
+	mGrouped = true;
+	mGroupTs = TimeSource::now();
+}
+
+void RawStatsReader::endGroup()
+{
+	uint64_t ts;
+
+	if (!mGrouped)
+		return;
+
+	ts = TimeSource::now();
+
+	for (auto stats :mGroup) {
+		stats->mTs = mGroupTs;
+		stats->mAcqEnd = ts;
+	}
+
+	mGroup.clear();
+	mGrouped = false;
+}
+
+int RawStatsReader::flush()
+{
+	if (!mUring || mQueued == 0)
+		return 0;
+
+	return submitUring();
+}
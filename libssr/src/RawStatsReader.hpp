@@ -0,0 +1,71 @@
+#ifndef __RAW_STATS_READER_HPP__
+#define __RAW_STATS_READER_HPP__
+
+/**
+ * Read a batch of procfs files into their RawStats buffers.
+ *
+ * Without io_uring (or if the kernel doesn't support it), add() reads the
+ * file immediately with pread(). With io_uring, reads are queued and
+ * submitted as a single batch by flush(). In both cases, RawStats content
+ * is only valid once flush() has returned. A submission error gives up
+ * io_uring : the reads of the batch not completed yet are done with
+ * pread().
+ *
+ * Reads added between beginGroup() and endGroup() share the timestamps
+ * taken by these calls. io_uring reads are always timestamped once per
+ * submitted batch, groups don't change them.
+ */
+class RawStatsReader {
+private:
+	struct Uring;
+
+private:
+	Uring *mUring;
+	uint32_t mQueued;
+	uint32_t mReadCount;
+	uint64_t mSubmitTime;
+	uint64_t mReapTime;
+	uint64_t mSubmitTs;
+
+	bool mGrouped;
+	uint64_t mGroupTs;
+	std::vector<pfstools::RawStats *> mGroup;
+
+private:
+	int initUring();
+	void clearUring();
+
+	int queueUring(int fd, pfstools::RawStats *stats);
+	int submitUring();
+	uint32_t reapUring();
+	void abortUring(uint32_t toSubmit, uint32_t remaining);
+
+public:
+	RawStatsReader();
+	~RawStatsReader();
+
+	int init(SystemMonitor::ReadBackend backend);
+
+	SystemMonitor::ReadBackend getBackend() const;
+
+	int add(int fd, pfstools::RawStats *stats);
+	int flush();
+
+	void beginGroup();
+	void endGroup();
+
+	// Reads added, and time spent in io_uring_enter() and handling
+	// completions since resetStats()
+	uint32_t getReadCount() const { return mReadCount; }
+	uint64_t getSubmitTime() const { return mSubmitTime; }
+	uint64_t getReapTime() const { return mReapTime; }
+
+	void resetStats()
+	{
+		mReadCount = 0;
+		mSubmitTime = 0;
+		mReapTime = 0;
+	}
+};
+
+#endif // !__RAW_STATS_READER_HPP__
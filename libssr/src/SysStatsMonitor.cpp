@@ -4,18 +4,31 @@
 
 #define PROCSTAT_PATH "/proc/stat"
 #define MEMINFO_PATH "/proc/meminfo"
+#define PRESSURE_PATH "/proc/pressure/%s"
+
+// PSI trigger : tasks stalled for this time in the window. Windows of
+// unprivileged triggers must be multiples of 2s.
+#define PRESSURE_STALL_US 200000
+#define PRESSURE_WINDOW_US 2000000
 
 SysStatsMonitor::SysStatsMonitor()
 {
 	mProcStatFd = -1;
 	mRawProcStats.mPending = false;
+	mLoad = -1;
+	mPrevBusy = 0;
+	mPrevTotal = 0;
 
 	mMeminfoFd = -1;
 	mRawMemInfo.mPending = false;
+
+	mLoop = nullptr;
 }
 
 SysStatsMonitor::~SysStatsMonitor()
 {
+	unwatchPressure();
+
 	if (mProcStatFd != -1)
 		close(mProcStatFd);
 
@@ -47,18 +60,105 @@ int SysStatsMonitor::openFile(const char *path, int *fd)
 	return 0;
 }
 
-int SysStatsMonitor::readRawStats()
+int SysStatsMonitor::openPressureFd(const char *resource)
+{
+	char path[64];
+	char trigger[64];
+	int fd;
+	int ret;
+
+	snprintf(path, sizeof(path), PRESSURE_PATH, resource);
+	snprintf(trigger, sizeof(trigger), "some %d %d",
+		 PRESSURE_STALL_US, PRESSURE_WINDOW_US);
+
+	fd = open(path, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+	if (fd == -1) {
+		ret = -errno;
+		LOGD("Fail to open %s : %d(%m)", path, errno);
+		return ret;
+	}
+
+	// The trigger lives as long as the fd, the nul byte is expected
+	ret = write(fd, trigger, strlen(trigger) + 1);
+	if (ret < 0) {
+		ret = -errno;
+		LOGD("Fail to set %s trigger : %d(%m)", path, errno);
+		goto error;
+	}
+
+	ret = mLoop->addFd(EPOLLPRI, fd,
+		[this, resource] (int fd, int evt) {
+			if (evt & EPOLLPRI)
+				mPressureCb(resource);
+		});
+	if (ret < 0) {
+		LOGE("EventLoop::addFd() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		goto error;
+	}
+
+	mPressureFds.push_back(fd);
+
+	return 0;
+
+error:
+	close(fd);
+
+	return ret;
+}
+
+int SysStatsMonitor::watchPressure(EventLoop *loop, const PressureCb &cb)
+{
+	static const char *resources[] = { "cpu", "io", "memory" };
+	int ret = 0;
+
+	if (!loop || !cb)
+		return -EINVAL;
+
+	unwatchPressure();
+
+	mLoop = loop;
+	mPressureCb = cb;
+
+	for (auto resource : resources) {
+		ret = openPressureFd(resource);
+		if (ret < 0)
+			LOGI("No PSI trigger on %s pressure", resource);
+	}
+
+	if (mPressureFds.empty()) {
+		mLoop = nullptr;
+		mPressureCb = nullptr;
+		return ret;
+	}
+
+	return 0;
+}
+
+void SysStatsMonitor::unwatchPressure()
+{
+	for (auto fd : mPressureFds) {
+		mLoop->delFd(fd);
+		close(fd);
+	}
+
+	mPressureFds.clear();
+	mLoop = nullptr;
+	mPressureCb = nullptr;
+}
+
+int SysStatsMonitor::readRawStats(RawStatsReader *reader)
 {
 	int ret;
 
 	if (mProcStatFd == -1 || mMeminfoFd == -1)
 		return 0;
 
-	ret = pfstools::readRawStats(mProcStatFd, &mRawProcStats);
+	ret = reader->add(mProcStatFd, &mRawProcStats);
 	if (ret < 0)
 		return 0;
 
-	ret = pfstools::readRawStats(mMeminfoFd, &mRawMemInfo);
+	ret = reader->add(mMeminfoFd, &mRawMemInfo);
 	if (ret < 0)
 		return 0;
 
@@ -82,6 +182,23 @@ int SysStatsMonitor::checkStatFile(
 	return ret;
 }
 
+void SysStatsMonitor::updateLoad(const SystemMonitor::SystemStats &stats)
+{
+	uint64_t busy;
+	uint64_t total;
+
+	busy = stats.mUtime + stats.mNice + stats.mStime + stats.mIrq +
+	       stats.mSoftIrq;
+	total = busy + stats.mIdle + stats.mIoWait;
+
+	// iowait may go backward, the sample is dropped
+	if (mPrevTotal != 0 && busy >= mPrevBusy && total > mPrevTotal)
+		mLoad = (busy - mPrevBusy) * 1000 / (total - mPrevTotal);
+
+	mPrevBusy = busy;
+	mPrevTotal = total;
+}
+
 int SysStatsMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
 {
 	SystemMonitor::SystemStats stats;
@@ -96,12 +213,15 @@ int SysStatsMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
 			return ret;
 		}
 
-		ret = pfstools::readSystemStats(mRawProcStats.mContent, &stats);
+		ret = pfstools::readSystemStats(mRawProcStats.mContent, &stats,
+				cb.mCpuStats ? &mCpuStats : nullptr);
 		if (ret < 0) {
 			close(mProcStatFd);
 			mProcStatFd = -1;
 			return ret;
 		}
+
+		updateLoad(stats);
 	} else {
 		dataPending = true;
 	}
@@ -131,5 +251,13 @@ int SysStatsMonitor::processRawStats(const SystemMonitor::Callbacks &cb)
 		cb.mSystemStats(stats, cb.mUserdata);
 	}
 
+	if (!dataPending && cb.mCpuStats) {
+		for (auto &cpu : mCpuStats) {
+			cpu.mTs = mRawProcStats.mTs;
+			cpu.mAcqEnd = mRawProcStats.mAcqEnd;
+			cb.mCpuStats(cpu, cb.mUserdata);
+		}
+	}
+
 	return 0;
 }
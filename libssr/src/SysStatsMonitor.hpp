@@ -2,15 +2,31 @@
 #define __SYS_STATS_MONITOR__
 
 class SysStatsMonitor {
+public:
+	// Called from the event loop when a PSI trigger fires
+	typedef std::function<void(const char *resource)> PressureCb;
+
 private:
 	// /proc/stat
 	int mProcStatFd;
 	pfstools::RawStats mRawProcStats;
+	std::vector<SystemMonitor::CpuStats> mCpuStats;
+
+	// cpu busy per mille between the last two /proc/stat reads, -1 until
+	// two reads are made
+	int mLoad;
+	uint64_t mPrevBusy;
+	uint64_t mPrevTotal;
 
 	// /proc/meminfo
 	int mMeminfoFd;
 	pfstools::RawStats mRawMemInfo;
 
+	// PSI triggers, one per /proc/pressure file
+	EventLoop *mLoop;
+	std::vector<int> mPressureFds;
+	PressureCb mPressureCb;
+
 private:
 	static int checkStatFile(
 		int *fd,
@@ -19,15 +35,24 @@ private:
 
 	static int openFile(const char *path, int *fd);
 
+	void updateLoad(const SystemMonitor::SystemStats &stats);
+	int openPressureFd(const char *resource);
+
 public:
 	SysStatsMonitor();
 	~SysStatsMonitor();
 
 	int init();
 
-	int readRawStats();
+	int readRawStats(RawStatsReader *reader);
 	int processRawStats(const SystemMonitor::Callbacks &cb);
 
+	int getLoad() const { return mLoad; }
+
+	// Arm a trigger on cpu, io and memory pressure. Fails if none of
+	// them is available.
+	int watchPressure(EventLoop *loop, const PressureCb &cb);
+	void unwatchPressure();
 };
 
 #endif // __SYS_STATS_MONITOR__
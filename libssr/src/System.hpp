@@ -1,6 +1,31 @@
 #ifndef __SYSTEM_HPP__
 #define __SYSTEM_HPP__
 
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* pidfd_open() has no libc wrapper before glibc 2.36, and no syscall
+ * number in kernel headers older than linux 5.3 */
+#ifndef __NR_pidfd_open
+	#if defined(__alpha__)
+		/* linux/arch/alpha/kernel/syscalls/syscall.tbl */
+		#define __NR_pidfd_open 544
+	#elif defined(__ia64__)
+		/* linux/arch/ia64/kernel/syscalls/syscall.tbl */
+		#define __NR_pidfd_open 1458
+	#else
+		/* linux/include/uapi/asm-generic/unistd.h, also the number
+		 * of the x86 and arm EABI tables. Other ABIs, like mips, add
+		 * a base to it and need their own define here. */
+		#define __NR_pidfd_open 434
+	#endif
+#endif
+
+static inline int pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(__NR_pidfd_open, pid, flags);
+}
+
 /* eventfd / signalfd / timerfd not supported by bionic
  * __NR_eventfd2 is not defined also in bionic headers */
 #ifdef ANDROID
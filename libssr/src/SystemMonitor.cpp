@@ -1,23 +1,134 @@
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "ssr_priv.hpp"
 
+// Stack touched by real-time threads before their first job, so that reads
+// don't page fault
+#define RT_STACK_PREFAULT_SIZE (64 * 1024)
+
 namespace {
 
-int getTimeNs(uint64_t *ns)
+int gcd(int a, int b)
 {
-	struct timespec ts;
+	while (b != 0) {
+		int r = a % b;
+
+		a = b;
+		b = r;
+	}
+
+	return a;
+}
+
+void prefaultStack()
+{
+	volatile char stack[RT_STACK_PREFAULT_SIZE];
+
+	for (size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+// Errors are only logged, the thread keeps its default scheduling
+void setupRealtimeThread(int priority, int cpu)
+{
+	struct sched_param param;
+	cpu_set_t cpuSet;
 	int ret;
 
-	ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-	if (ret < 0) {
-		ret = -errno;
-		LOG_ERRNO("clock_gettime");
-		return ret;
+	if (cpu >= 0) {
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet),
+					     &cpuSet);
+		if (ret != 0) {
+			LOGW("Fail to bind acquisition thread to cpu %d : "
+			     "%d(%s)", cpu, ret, strerror(ret));
+		}
 	}
 
-	*ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
 
-	return 0;
+	ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (ret != 0) {
+		LOGW("Fail to set SCHED_FIFO priority %d : %d(%s)",
+		     priority, ret, strerror(ret));
+	}
+
+	prefaultStack();
+}
+
+// Per worker acquisition state. Monitors are dispatched in a round-robin
+// way, monitor i being handled by job (i % jobCount).
+struct AcqJob {
+	RawStatsReader mReader;
+	TaskStats *mTaskStats; // only with StatsBackend::taskstats
+	bool mTaskStatsFailed;
+	std::vector<ProcessMonitor *> mMonitors;
+
+	// Results of the processing step, buffered to be notified in the
+	// monitor order once every job is done. mRanges gives, for each
+	// monitor, the end index of its records in mProcessStats and
+	// mThreadStats.
+	std::vector<SystemMonitor::ProcessStats> mProcessStats;
+	std::vector<SystemMonitor::ThreadStats> mThreadStats;
+	std::vector<std::pair<size_t, size_t>> mRanges;
+	SystemMonitor::Callbacks mCb;
+
+	AcqJob();
+	~AcqJob();
+
+	void clearResults();
+
+	static void processStatsCb(
+			const SystemMonitor::ProcessStats &stats,
+			void *userdata);
+
+	static void threadStatsCb(
+			const SystemMonitor::ThreadStats &stats,
+			void *userdata);
+};
+
+AcqJob::AcqJob()
+{
+	mTaskStats = nullptr;
+	mTaskStatsFailed = false;
+	mCb.mProcessStats = processStatsCb;
+	mCb.mThreadStats = threadStatsCb;
+	mCb.mUserdata = this;
+}
+
+AcqJob::~AcqJob()
+{
+	delete mTaskStats;
+}
+
+void AcqJob::clearResults()
+{
+	mProcessStats.clear();
+	mThreadStats.clear();
+	mRanges.clear();
+}
+
+void AcqJob::processStatsCb(
+		const SystemMonitor::ProcessStats &stats,
+		void *userdata)
+{
+	auto job = (AcqJob *) userdata;
+
+	job->mProcessStats.push_back(stats);
+}
+
+void AcqJob::threadStatsCb(
+		const SystemMonitor::ThreadStats &stats,
+		void *userdata)
+{
+	auto job = (AcqJob *) userdata;
+
+	job->mThreadStats.push_back(stats);
 }
 
 class SystemMonitorImpl : public SystemMonitor {
@@ -38,12 +149,98 @@ private:
 	SysStatsMonitor mSysMonitor;
 	std::list<ProcessMonitor *> mProcMonitors;
 
+	// Process discovery by proc events
+	ProcEvents mProcEvents;
+	std::map<int, ProcessMonitor *> mPidIndex;
+
+	// Pids of new processes still held by the monitor of an exited one,
+	// matched again once it has been reclaimed
+	std::unordered_set<int> mReusedPids;
+
+	// One per addProcess() call
+	std::vector<ProcessSelector *> mSelectors;
+
+	// Selectors of a discovery pass. Single instance name selectors are
+	// indexed by the name truncated as the kernel reports it, the other
+	// ones are matched one by one.
+	std::unordered_map<std::string, std::vector<ProcessSelector *>> mDiscoveryIndex;
+	std::vector<ProcessSelector *> mDiscoveryPatterns;
+	std::string mDiscoveryKey;
+
+	FdBudget mFdBudget;
+
+	WorkerPool mWorkers;
+	std::vector<AcqJob *> mJobs;
+	bool mJobsDirty;
+
 	Timer mPeriodTimer;
+	uint32_t mMissedTicks;
+	uint64_t mTickLateness;
+
+	// The timer ticks every mTickMs, the greatest common divisor of all
+	// the periods. mTick is the CLOCK_REALTIME index of the current tick.
+	AcqSchedule mSysSchedule;
+	int mTickMs;
+	uint64_t mTick;
+
+	// Load shedding, see SheddingStep. Monitors up to the shed priority
+	// are not read, and only one tick out of the period factor is used.
+	LoadShedding mShedding;
+	uint64_t mShedNextTick;
+
+	// Adaptive cadence, see CadenceChange. mConfig.mAcqPeriodMs is the
+	// period in use, the cadence base period the one requested.
+	AdaptiveCadence mAdaptiveCadence;
 
 private:
-	int findAllProcesses();
+	int discoverProcesses();
+	void matchSelectors(int pid, const char *comm,
+			    const std::vector<ProcessSelector *> &selectors,
+			    bool rematch = false);
+	bool isSelected(ProcessSelector *selector, int pid) const;
+	bool isPidHeld(int pid) const;
+	void selectProcess(ProcessSelector *selector, int pid);
+	void deselectProcess(ProcessSelector *selector, int pid);
+	void reclaimMonitors();
+	int initJobs();
+	void dispatchMonitors();
+	void readJob(int jobIdx);
+	void processJob(int jobIdx);
+	void notifyJobResults();
+	void disableTaskStats();
 	int makeAcquisition();
 
+	int computeTickMs() const;
+	void resetSchedules();
+	void rescaleSchedules(uint64_t nowMs, int tickMs);
+	bool updateSchedules();
+	int restartAcquisitionTimer();
+
+	void updateShedding(uint64_t duration);
+
+	int changeAcqPeriod(int acqPeriodMs);
+	void setCadence(int periodMs, CadenceReason reason);
+	void updateCadence();
+	void onPressure(const char *resource);
+
+	int startProcEvents();
+	void stopProcEvents();
+	void updatePidIndex();
+	ProcessMonitor *findMonitorByPid(int pid);
+	void onProcessForked(int pid);
+	void onProcessStarted(int pid, const char *comm);
+	void onProcessExec(int pid);
+	void onThreadStarted(int tid, int pid);
+	void onThreadExited(int tid, int pid);
+	void onProcEventsOverrun();
+
+	static void procForkCb(int pid, int tgid, void *userdata);
+	static void procExecCb(int pid, int tgid, void *userdata);
+	static void procCommCb(int pid, int tgid, const char *comm, void *userdata);
+	static void procExitCb(int pid, int tgid, void *userdata);
+	static void procOverrunCb(void *userdata);
+	static bool discoveryPidCb(int pid, void *userdata);
+
 public:
 	SystemMonitorImpl(
 			EventLoop *loop,
@@ -51,229 +248,1271 @@ public:
 			const Callbacks &cb);
 	virtual ~SystemMonitorImpl();
 
-	int startAcquisitionTimer();
+	void probeStatsBackend();
+	void probeClockSource();
+	int startAcquisitionTimer();
+
+	virtual int readSystemConfig(SystemConfig *config);
+	virtual int addProcess(const char *name);
+	virtual int addProcess(const char *name, const ProcessConfig &config);
+	virtual int loadProcesses();
+	virtual int clearProcesses();
+	virtual int setAcqPeriod(int acqPeriodMs);
+	virtual int start();
+	virtual int stop();
+};
+
+SystemMonitorImpl::SystemMonitorImpl(
+		EventLoop *loop,
+		const Config &config,
+		const Callbacks &cb) : SystemMonitor()
+{
+	mState = State::Stopped;
+	mLoop = loop;
+	mConfig = config;
+	mCb = cb;
+	mJobsDirty = true;
+	mMissedTicks = 0;
+	mTickLateness = 0;
+	mSysSchedule.mPeriodMs = config.mSysStatsPeriodMs;
+	mTickMs = 0;
+	mTick = 0;
+	mShedNextTick = 0;
+	mAdaptiveCadence.reset(config.mAcqPeriodMs);
+	mFdBudget.setMax(config.mThreadFdBudget);
+	mSysSettings.mClkTck = sysconf(_SC_CLK_TCK);
+	mSysSettings.mPagesize = getpagesize();
+}
+
+SystemMonitorImpl::~SystemMonitorImpl()
+{
+	for (auto &m :mProcMonitors)
+		delete m;
+
+	for (auto &sel :mSelectors)
+		delete sel;
+
+	mPeriodTimer.clear();
+
+	mWorkers.stop();
+
+	for (auto &job :mJobs)
+		delete job;
+}
+
+int SystemMonitorImpl::computeTickMs() const
+{
+	int tickMs;
+
+	tickMs = mSysSchedule.getPeriodMs(mConfig.mAcqPeriodMs);
+
+	for (auto m :mProcMonitors)
+		tickMs = gcd(tickMs, m->getSchedule()->getPeriodMs(mConfig.mAcqPeriodMs));
+
+	for (auto sel :mSelectors)
+		tickMs = gcd(tickMs, sel->getSchedule()->getPeriodMs(mConfig.mAcqPeriodMs));
+
+	return tickMs;
+}
+
+void SystemMonitorImpl::resetSchedules()
+{
+	mSysSchedule.reset();
+	mShedNextTick = 0;
+
+	for (auto m :mProcMonitors)
+		m->getSchedule()->reset();
+
+	for (auto sel :mSelectors)
+		sel->getSchedule()->reset();
+}
+
+void SystemMonitorImpl::rescaleSchedules(uint64_t nowMs, int tickMs)
+{
+	int periodMs = mConfig.mAcqPeriodMs;
+
+	mSysSchedule.rescale(nowMs, mTickMs, tickMs, periodMs);
+
+	for (auto m :mProcMonitors)
+		m->getSchedule()->rescale(nowMs, mTickMs, tickMs, periodMs);
+
+	for (auto sel :mSelectors)
+		sel->getSchedule()->rescale(nowMs, mTickMs, tickMs, periodMs);
+
+	mShedNextTick = (mShedNextTick * mTickMs + tickMs - 1) / tickMs;
+}
+
+bool SystemMonitorImpl::updateSchedules()
+{
+	bool due;
+
+	due = mSysSchedule.update(mTick, mTickMs, mConfig.mAcqPeriodMs);
+
+	for (auto m :mProcMonitors) {
+		if (!m->getSchedule()->update(mTick, mTickMs, mConfig.mAcqPeriodMs))
+			continue;
+
+		// Shed by priority
+		if (m->getPriority() <= mShedding.getShedPriority()) {
+			m->getSchedule()->mDue = false;
+			continue;
+		}
+
+		due = true;
+	}
+
+	// Selectors are due for discovery
+	for (auto sel :mSelectors) {
+		if (sel->getSchedule()->update(mTick, mTickMs, mConfig.mAcqPeriodMs))
+			due = true;
+	}
+
+	return due;
+}
+
+void SystemMonitorImpl::updateShedding(uint64_t duration)
+{
+	uint64_t budget = mConfig.mAcqBudgetMs * 1000000ULL;
+	SheddingStep step;
+	char priority[16];
+
+	if (mConfig.mAcqBudgetMs <= 0)
+		return;
+
+	if (!mShedding.update(duration, budget, mProcMonitors))
+		return;
+
+	for (auto m :mProcMonitors)
+		m->setThreadsShed(mShedding.getThreadsShed());
+
+	if (mShedding.getShedPriority() == INT32_MIN) {
+		snprintf(priority, sizeof(priority), "none");
+	} else {
+		snprintf(priority, sizeof(priority), "<= %d",
+			 mShedding.getShedPriority());
+	}
+
+	LOGN("Acquisition took %u us, load shedding : threads %s, "
+	     "processes shed %s, period x%d", (unsigned) (duration / 1000),
+	     mShedding.getThreadsShed() ? "off" : "on", priority,
+	     mShedding.getPeriodFactor());
+
+	if (!mCb.mShedding)
+		return;
+
+	// Same time base as the read timestamps
+	step.mTs = TimeSource::now();
+	step.mDuration = duration;
+	step.mThreadsShed = mShedding.getThreadsShed();
+	step.mShedPriority = mShedding.getShedPriority();
+	step.mPeriodFactor = mShedding.getPeriodFactor();
+
+	mCb.mShedding(step, mCb.mUserdata);
+}
+
+void SystemMonitorImpl::setCadence(int periodMs, CadenceReason reason)
+{
+	CadenceChange change;
+	int load = mSysMonitor.getLoad();
+	int ret;
+
+	ret = changeAcqPeriod(periodMs);
+	if (ret < 0)
+		return;
+
+	if (reason == CadenceReason::pressure) {
+		LOGN("Acquisition period : %d ms, pressure stall", periodMs);
+	} else {
+		LOGN("Acquisition period : %d ms, cpu load %d.%d%%",
+		     periodMs, load / 10, load % 10);
+	}
+
+	if (!mCb.mCadence)
+		return;
+
+	// Same time base as the read timestamps
+	change.mTs = TimeSource::now();
+	change.mPeriodMs = periodMs;
+	change.mLoad = load;
+	change.mReason = (uint8_t) reason;
+
+	mCb.mCadence(change, mCb.mUserdata);
+}
+
+void SystemMonitorImpl::updateCadence()
+{
+	CadenceReason reason;
+	int load = mSysMonitor.getLoad();
+	int periodMs;
+
+	if (mConfig.mAdaptiveMaxPeriodMs <= 0 || !mSysSchedule.mDue ||
+	    load < 0)
+		return;
+
+	periodMs = mAdaptiveCadence.update(mConfig.mAcqPeriodMs, load,
+					   mConfig.mIdleLoad,
+					   mConfig.mAdaptiveMaxPeriodMs,
+					   &reason);
+	if (periodMs > 0)
+		setCadence(periodMs, reason);
+}
+
+void SystemMonitorImpl::onPressure(const char *resource)
+{
+	int periodMs;
+
+	LOGD("PSI trigger on %s pressure", resource);
+
+	periodMs = mAdaptiveCadence.onPressure(mConfig.mAcqPeriodMs);
+	if (periodMs > 0)
+		setCadence(periodMs, CadenceReason::pressure);
+}
+
+int SystemMonitorImpl::startAcquisitionTimer()
+{
+	struct timespec ts;
+	uint64_t nowMs;
+	int tickMs;
+	int ret;
+
+	auto cb = [this] () {
+		// From the exact wall clock deadline of the tick
+		mTickLateness = mPeriodTimer.getLateness();
+
+		if (mPeriodTimer.getMissed() > 0) {
+			LOGD("%u acquisitions missed",
+			     (unsigned) mPeriodTimer.getMissed());
+			mMissedTicks += mPeriodTimer.getMissed();
+		}
+
+		mTick += 1 + mPeriodTimer.getMissed();
+
+		LOGD("Start new acquisition");
+		makeAcquisition();
+	};
+
+	if (mConfig.mAcqPeriodMs <= 0 || mConfig.mSysStatsPeriodMs < 0)
+		return -EINVAL;
+
+	ret = clock_gettime(CLOCK_REALTIME, &ts);
+	if (ret < 0) {
+		ret = -errno;
+		LOG_ERRNO("clock_gettime");
+		return ret;
+	}
+
+	nowMs = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+
+	// Tick indexes depend on the tick duration. Collectors using the
+	// default period may also have a new one.
+	tickMs = computeTickMs();
+	if (tickMs != mTickMs)
+		LOGD("Acquisition tick : %d ms", tickMs);
+
+	if (mTickMs > 0)
+		rescaleSchedules(nowMs, tickMs);
+
+	mTickMs = tickMs;
+	mTick = nowMs / mTickMs;
+
+	ts.tv_sec = mTickMs / 1000;
+	ts.tv_nsec = (mTickMs % 1000) * 1000000;
+
+	ret = mPeriodTimer.setPeriodicAligned(mLoop, ts, cb);
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+int SystemMonitorImpl::restartAcquisitionTimer()
+{
+	int ret;
+
+	mPeriodTimer.clear();
+
+	ret = startAcquisitionTimer();
+	if (ret < 0) {
+		LOGW("startAcquisitionTimer() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		return ret;
+	}
+
+	return 0;
+}
+
+int SystemMonitorImpl::readSystemConfig(SystemConfig *config)
+{
+	if (!config)
+		return -EINVAL;
+
+	*config = mSysSettings;
+
+	return 0;
+}
+
+int SystemMonitorImpl::addProcess(const char *name)
+{
+	ProcessConfig config;
+
+	config.mRecordThreads = mConfig.mRecordThreads;
+
+	return addProcess(name, config);
+}
+
+int SystemMonitorImpl::addProcess(const char *name, const ProcessConfig &config)
+{
+	ProcessSelector *selector;
+	ProcessMonitor *monitor;
+	int ret;
+
+	if (!name || config.mAcqPeriodMs < 0)
+		return -EINVAL;
+
+	selector = new ProcessSelector();
+	if (!selector)
+		return -ENOMEM;
+
+	ret = selector->init(name, config);
+	if (ret < 0) {
+		delete selector;
+		return ret;
+	}
+
+	// All instances monitors are created by the discovery
+	if (!config.mAllInstances) {
+		monitor = new ProcessMonitor(name, &mConfig, config,
+					     &mSysSettings, &mFdBudget);
+		if (!monitor) {
+			delete selector;
+			return -ENOMEM;
+		}
+
+		monitor->watchExit(mLoop, &mCb);
+		monitor->setThreadsShed(mShedding.getThreadsShed());
+		selector->setMonitor(monitor);
+		mProcMonitors.push_back(monitor);
+		mJobsDirty = true;
+	}
+
+	mSelectors.push_back(selector);
+
+	// The new period may not be a multiple of the current tick
+	if (mState == State::Started && computeTickMs() != mTickMs)
+		return restartAcquisitionTimer();
+
+	return 0;
+}
+
+int SystemMonitorImpl::discoverProcesses()
+{
+	int ret;
+
+	mDiscoveryIndex.clear();
+	mDiscoveryPatterns.clear();
+
+	for (auto sel :mSelectors) {
+		if (!sel->getSchedule()->mDue ||
+		    !sel->needsDiscovery(mProcEvents.isStarted()))
+			continue;
+
+		sel->clearRescan();
+
+		if (sel->usesNameIndex()) {
+			mDiscoveryKey.assign(sel->getPattern(), 0, PROC_COMM_MAX_LEN);
+			mDiscoveryIndex[mDiscoveryKey].push_back(sel);
+		} else {
+			mDiscoveryPatterns.push_back(sel);
+		}
+	}
+
+	if (mDiscoveryIndex.empty() && mDiscoveryPatterns.empty())
+		return 0;
+
+	ret = pfstools::iterateAllPid(discoveryPidCb, this);
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+bool SystemMonitorImpl::discoveryPidCb(int pid, void *userdata)
+{
+	auto self = (SystemMonitorImpl *) userdata;
+	const char *comm = nullptr;
+	char name[64];
+	int ret;
+
+	if (!self->mDiscoveryIndex.empty()) {
+		ret = pfstools::readProcessName(pid, name, sizeof(name));
+		if (ret < 0)
+			return true;
+
+		comm = name;
+		self->mDiscoveryKey.assign(name);
+
+		// First process found wins, as several may have the same
+		// name
+		auto i = self->mDiscoveryIndex.find(self->mDiscoveryKey);
+		if (i != self->mDiscoveryIndex.end()) {
+			for (auto sel :i->second)
+				self->selectProcess(sel, pid);
+
+			self->mDiscoveryIndex.erase(i);
+		}
+	}
+
+	if (!self->mDiscoveryPatterns.empty()) {
+		auto &patterns = self->mDiscoveryPatterns;
+		size_t i = 0;
+
+		self->matchSelectors(pid, comm, patterns);
+
+		// Single instance selectors are done once they have found
+		// their process. The last one is moved at index i.
+		while (i < patterns.size()) {
+			if (patterns[i]->isWaiting()) {
+				i++;
+				continue;
+			}
+
+			patterns[i] = patterns.back();
+			patterns.pop_back();
+		}
+	}
+
+	return !self->mDiscoveryIndex.empty() ||
+	       !self->mDiscoveryPatterns.empty();
+}
+
+// comm is read if needed when nullptr. With rematch, the selectors that
+// have already selected the pid drop it if it doesn't match anymore.
+void SystemMonitorImpl::matchSelectors(
+		int pid,
+		const char *comm,
+		const std::vector<ProcessSelector *> &selectors,
+		bool rematch)
+{
+	char cmdline[4096];
+	bool hasCmdline = false;
+	bool selected;
+	bool matched;
+	char name[64];
+	int ret;
+
+	for (auto sel :selectors) {
+		selected = isSelected(sel, pid);
+		if (selected ? !rematch : !sel->isWaiting())
+			continue;
+
+		// Only read the name and the command line once, if a selector
+		// needs them
+		if (sel->needsComm() && !comm) {
+			ret = pfstools::readProcessName(pid, name, sizeof(name));
+			if (ret < 0)
+				return;
+
+			comm = name;
+		}
+
+		if (sel->needsCmdline() && !hasCmdline) {
+			ret = pfstools::readProcessCmdline(pid, cmdline,
+							   sizeof(cmdline));
+			if (ret < 0)
+				cmdline[0] = '\0';
+
+			hasCmdline = true;
+		}
+
+		matched = sel->match(comm, hasCmdline ? cmdline : nullptr);
+		if (matched && !selected)
+			selectProcess(sel, pid);
+		else if (!matched && selected)
+			deselectProcess(sel, pid);
+	}
+}
+
+bool SystemMonitorImpl::isSelected(ProcessSelector *selector, int pid) const
+{
+	if (selector->isAllInstances())
+		return selector->hasPid(pid);
+
+	return !selector->isWaiting() && selector->getMonitor()->getPid() == pid;
+}
+
+// Some all instances selector has a monitor for pid
+bool SystemMonitorImpl::isPidHeld(int pid) const
+{
+	for (auto sel :mSelectors) {
+		if (sel->isAllInstances() && sel->hasPid(pid))
+			return true;
+	}
+
+	return false;
+}
+
+void SystemMonitorImpl::selectProcess(ProcessSelector *selector, int pid)
+{
+	ProcessMonitor *monitor;
+	int ret;
+
+	if (!selector->isAllInstances()) {
+		monitor = selector->getMonitor();
+
+		ret = monitor->attach(pid);
+		if (ret == 0 && mProcEvents.isStarted())
+			mPidIndex[pid] = monitor;
+
+		return;
+	}
+
+	// New instance
+	monitor = new ProcessMonitor(pid, &mConfig, selector->getConfig(),
+				     &mSysSettings, &mFdBudget);
+	if (!monitor)
+		return;
+
+	monitor->watchExit(mLoop, &mCb);
+	monitor->setThreadsShed(mShedding.getThreadsShed());
+
+	ret = monitor->init();
+	if (ret < 0) {
+		delete monitor;
+		return;
+	}
+
+	LOGD("Process %d selected by '%s'", pid, selector->getPattern());
+
+	monitor->setSelector(selector);
+	monitor->setEventDriven(mProcEvents.isStarted());
+	selector->addPid(pid);
+
+	mProcMonitors.push_back(monitor);
+	mJobsDirty = true;
+
+	if (mProcEvents.isStarted())
+		mPidIndex[pid] = monitor;
+}
+
+void SystemMonitorImpl::deselectProcess(ProcessSelector *selector, int pid)
+{
+	LOGD("Process %d no longer selected by '%s'", pid,
+	     selector->getPattern());
+
+	if (!selector->isAllInstances()) {
+		selector->getMonitor()->release();
+		return;
+	}
+
+	// Dropped by the next reclaim
+	for (auto m :mProcMonitors) {
+		if (m->getSelector() == selector && m->getPid() == pid) {
+			m->release();
+			break;
+		}
+	}
+}
+
+void SystemMonitorImpl::reclaimMonitors()
+{
+	ProcessSelector *selector;
+	ProcessMonitor *monitor;
+
+	// Instances of an all instances selector are dropped when they exit,
+	// their pid may be selected again
+	for (auto i = mProcMonitors.begin(); i != mProcMonitors.end();) {
+		monitor = *i;
+		selector = monitor->getSelector();
+		if (!selector || !monitor->isStopped()) {
+			i++;
+			continue;
+		}
+
+		auto pidIdx = mPidIndex.find(monitor->getPid());
+		if (pidIdx != mPidIndex.end() && pidIdx->second == monitor)
+			mPidIndex.erase(pidIdx);
+
+		selector->removePid(monitor->getPid());
+		delete monitor;
+
+		i = mProcMonitors.erase(i);
+		mJobsDirty = true;
+	}
+
+	for (auto i = mReusedPids.begin(); i != mReusedPids.end();) {
+		if (isPidHeld(*i)) {
+			i++;
+			continue;
+		}
+
+		matchSelectors(*i, nullptr, mSelectors);
+		i = mReusedPids.erase(i);
+	}
+}
+
+int SystemMonitorImpl::loadProcesses()
+{
+	int ret;
+
+	// Record every process, started ones are found by the discovery and
+	// exited ones dropped like all instances selectors ones
+	if (mSelectors.empty()) {
+		ProcessConfig config;
+
+		config.mRecordThreads = mConfig.mRecordThreads;
+		config.mMatch = MatchType::all;
+		config.mAllInstances = true;
+
+		ret = addProcess("*", config);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (auto m :mProcMonitors)
+		m->init();
+
+	ret = discoverProcesses();
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+int SystemMonitorImpl::clearProcesses()
+{
+	for (auto m :mProcMonitors)
+		delete m;
+
+	for (auto sel :mSelectors)
+		delete sel;
+
+	mProcMonitors.clear();
+	mSelectors.clear();
+	mPidIndex.clear();
+	mReusedPids.clear();
+	mJobsDirty = true;
+
+	return 0;
+}
+
+int SystemMonitorImpl::setAcqPeriod(int acqPeriodMs)
+{
+	if (acqPeriodMs <= 0)
+		return -EINVAL;
+
+	// The adaptive cadence starts again from this period
+	mAdaptiveCadence.reset(acqPeriodMs);
+
+	return changeAcqPeriod(acqPeriodMs);
+}
+
+int SystemMonitorImpl::changeAcqPeriod(int acqPeriodMs)
+{
+	// Collectors using the default period are rescaled by the timer
+	// restart, the others keep their schedule
+	mConfig.mAcqPeriodMs = acqPeriodMs;
+
+	if (mState == State::Started)
+		return restartAcquisitionTimer();
+
+	return 0;
+}
+
+int SystemMonitorImpl::start()
+{
+	int ret;
+
+	ret = initJobs();
+	if (ret < 0) {
+		LOGW("initJobs() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		return ret;
+	}
+
+	ret = mSysMonitor.init();
+	if (ret < 0) {
+		LOGW("mSysMonitor.init() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		return ret;
+	}
+
+	// Each start is made at full rate
+	if (mConfig.mAdaptiveMaxPeriodMs > 0) {
+		mConfig.mAcqPeriodMs = mAdaptiveCadence.getBasePeriodMs();
+		mAdaptiveCadence.reset(mConfig.mAcqPeriodMs);
+
+		ret = mSysMonitor.watchPressure(mLoop,
+			[this] (const char *resource) {
+				onPressure(resource);
+			});
+		if (ret < 0) {
+			LOGW("PSI triggers unavailable (%d(%s)), the cadence "
+			     "only follows the cpu load", -ret, strerror(-ret));
+		}
+	}
+
+	if (mConfig.mProcEvents) {
+		ret = startProcEvents();
+		if (ret < 0) {
+			LOGW("Proc events unavailable (%d(%s)), "
+			     "fallback to /proc scans",
+			     -ret, strerror(-ret));
+		}
+	}
+
+	// First acquisition reads every collector
+	resetSchedules();
+
+	ret = startAcquisitionTimer();
+	if (ret < 0) {
+		LOGW("startAcquisitionTimer() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		return ret;
+	}
+
+	ret = makeAcquisition();
+	if (ret < 0) {
+		LOGW("makeAcquisition() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		return ret;
+
+	}
+
+	mState = State::Started;
+
+	return 0;
+}
+
+int SystemMonitorImpl::stop()
+{
+	int ret;
+
+	// The timer is not armed if its last restart has failed
+	ret = mPeriodTimer.clear();
+	if (ret < 0 && ret != -EPERM)
+		return ret;
+
+	stopProcEvents();
+	mSysMonitor.unwatchPressure();
+
+	mState = State::Stopped;
+
+	return 0;
+}
+
+void SystemMonitorImpl::probeStatsBackend()
+{
+	TaskStats taskStats;
+	int ret;
+
+	if (mConfig.mStatsBackend != StatsBackend::taskstats)
+		return;
+
+	// Process monitors need to know the backend as soon as they are
+	// initialized, check now that netlink taskstats is usable.
+	ret = taskStats.init();
+	if (ret == 0)
+		ret = taskStats.probe();
+
+	if (ret < 0) {
+		LOGW("taskstats unavailable (%d(%s)), fallback to procfs",
+		     -ret, strerror(-ret));
+		mConfig.mStatsBackend = StatsBackend::procfs;
+	}
+}
+
+void SystemMonitorImpl::probeClockSource()
+{
+	int ret;
+
+	if (mConfig.mClockSource != ClockSource::tsc)
+		return;
+
+	// Calibrated once, before any read
+	ret = TimeSource::init(mConfig.mClockSource);
+	if (ret < 0) {
+		LOGW("TSC unavailable (%d(%s)), fallback to clock_gettime()",
+		     -ret, strerror(-ret));
+		mConfig.mClockSource = ClockSource::monotonic;
+	}
+}
+
+int SystemMonitorImpl::initJobs()
+{
+	int jobCount;
+	AcqJob *job;
+	int ret;
+
+	// Jobs are kept across stop()/start()
+	if (!mJobs.empty())
+		return 0;
+
+	jobCount = mConfig.mJobs > 0 ? mConfig.mJobs : 1;
+
+	// Locked before the real-time threads start, so that their stacks
+	// are locked too
+	if (mConfig.mRtPriority > 0) {
+		ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+		if (ret < 0)
+			LOGW("mlockall() failed : %d(%m)", errno);
+	}
+
+	for (int i = 0; i < jobCount; i++) {
+		job = new AcqJob();
+		if (!job)
+			return -ENOMEM;
+
+		mJobs.push_back(job);
+
+		ret = job->mReader.init(mConfig.mReadBackend);
+		if (ret < 0)
+			return ret;
+
+		if (mConfig.mStatsBackend == StatsBackend::taskstats) {
+			job->mTaskStats = new TaskStats();
+			if (!job->mTaskStats)
+				return -ENOMEM;
+
+			ret = job->mTaskStats->init();
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	if (mConfig.mRtPriority > 0) {
+		int priority = mConfig.mRtPriority;
+		int cpu = mConfig.mRtCpu;
+
+		ret = mWorkers.start(jobCount, true, [priority, cpu] () {
+			setupRealtimeThread(priority, cpu);
+		});
+	} else {
+		ret = mWorkers.start(jobCount);
+	}
+
+	if (ret < 0)
+		return ret;
+
+	LOGD("Acquisition dispatched on %d job(s)", jobCount);
+	mJobsDirty = true;
+
+	return 0;
+}
+
+void SystemMonitorImpl::dispatchMonitors()
+{
+	size_t i = 0;
+
+	for (auto &job :mJobs)
+		job->mMonitors.clear();
+
+	for (auto m :mProcMonitors) {
+		mJobs[i % mJobs.size()]->mMonitors.push_back(m);
+		i++;
+	}
+
+	mJobsDirty = false;
+}
+
+void SystemMonitorImpl::readJob(int jobIdx)
+{
+	AcqJob *job = mJobs[jobIdx];
+	int ret;
+
+	job->mReader.resetStats();
+
+	if (jobIdx == 0 && mSysSchedule.mDue)
+		mSysMonitor.readRawStats(&job->mReader);
+
+	for (auto m :job->mMonitors) {
+		if (m->getSchedule()->mDue)
+			m->readRawStats(&job->mReader, job->mTaskStats);
+	}
+
+	// Wait for queued reads
+	ret = job->mReader.flush();
+	if (ret < 0) {
+		LOGW("RawStatsReader::flush() failed : %d(%s)",
+		     -ret, strerror(-ret));
+	}
+
+	// Threads of the processes that have used CPU, now that their
+	// process stats are known
+	if (mConfig.mIdleThreadsRefreshMs > 0) {
+		for (auto m :job->mMonitors) {
+			if (m->getSchedule()->mDue)
+				m->readRawBusyThreadsStats(&job->mReader,
+							   job->mTaskStats);
+		}
+
+		ret = job->mReader.flush();
+		if (ret < 0) {
+			LOGW("RawStatsReader::flush() failed : %d(%s)",
+			     -ret, strerror(-ret));
+		}
+	}
+
+	if (job->mTaskStats) {
+		ret = job->mTaskStats->flush();
+		if (ret < 0) {
+			LOGW("TaskStats::flush() failed : %d(%s)",
+			     -ret, strerror(-ret));
+
+			// Missing replies are only retried
+			if (ret != -ETIMEDOUT)
+				job->mTaskStatsFailed = true;
+		}
+	}
+}
+
+void SystemMonitorImpl::disableTaskStats()
+{
+	LOGW("taskstats requests are failing, fallback to procfs");
+
+	// Threads found meanwhile have no fd, they are opened by their next
+	// read and kept within the fd budget
+	mConfig.mStatsBackend = StatsBackend::procfs;
 
-	virtual int readSystemConfig(SystemConfig *config);
-	virtual int addProcess(const char *name);
-	virtual int loadProcesses();
-	virtual int clearProcesses();
-	virtual int setAcqPeriod(int acqPeriod);
-	virtual int start();
-	virtual int stop();
-};
+	for (auto &job :mJobs) {
+		delete job->mTaskStats;
+		job->mTaskStats = nullptr;
+		job->mTaskStatsFailed = false;
+	}
+}
 
-SystemMonitorImpl::SystemMonitorImpl(
-		EventLoop *loop,
-		const Config &config,
-		const Callbacks &cb) : SystemMonitor()
+void SystemMonitorImpl::processJob(int jobIdx)
 {
-	mState = State::Stopped;
-	mLoop = loop;
-	mConfig = config;
-	mCb = cb;
-	mSysSettings.mClkTck = sysconf(_SC_CLK_TCK);
-	mSysSettings.mPagesize = getpagesize();
+	AcqJob *job = mJobs[jobIdx];
+
+	job->clearResults();
+
+	for (auto m :job->mMonitors) {
+		if (m->getSchedule()->mDue)
+			m->processRawStats(job->mCb);
+
+		job->mRanges.push_back({ job->mProcessStats.size(),
+					 job->mThreadStats.size() });
+	}
 }
 
-SystemMonitorImpl::~SystemMonitorImpl()
+void SystemMonitorImpl::notifyJobResults()
 {
-	for (auto &m :mProcMonitors)
-		delete m;
+	std::vector<size_t> rangeIdx(mJobs.size(), 0);
+	size_t processIdx;
+	size_t threadIdx;
+	size_t jobIdx;
+	AcqJob *job;
+
+	for (size_t i = 0; i < mProcMonitors.size(); i++) {
+		jobIdx = i % mJobs.size();
+		job = mJobs[jobIdx];
+
+		// Records of the previous monitor handled by this job
+		if (rangeIdx[jobIdx] == 0) {
+			processIdx = 0;
+			threadIdx = 0;
+		} else {
+			processIdx = job->mRanges[rangeIdx[jobIdx] - 1].first;
+			threadIdx = job->mRanges[rangeIdx[jobIdx] - 1].second;
+		}
 
-	mPeriodTimer.clear();
+		auto &range = job->mRanges[rangeIdx[jobIdx]];
+		rangeIdx[jobIdx]++;
+
+		if (mCb.mProcessStats) {
+			for (; processIdx < range.first; processIdx++) {
+				mCb.mProcessStats(job->mProcessStats[processIdx],
+						  mCb.mUserdata);
+			}
+		}
+
+		if (mCb.mThreadStats) {
+			for (; threadIdx < range.second; threadIdx++) {
+				mCb.mThreadStats(job->mThreadStats[threadIdx],
+						 mCb.mUserdata);
+			}
+		}
+	}
 }
 
-int SystemMonitorImpl::startAcquisitionTimer()
+int SystemMonitorImpl::makeAcquisition()
 {
-	struct timespec ts;
+	AcquisitionDuration stats;
+	uint64_t acqStart;
+	uint64_t acqEnd;
 	int ret;
 
-	auto cb = [this] () {
-		LOGD("Start new acquisition");
-		makeAcquisition();
-	};
+	// Period lengthened by load shedding. Missed ticks may skip the
+	// multiples of the factor, the next tick is kept instead.
+	if (mTick < mShedNextTick)
+		return 0;
 
-	ts.tv_sec = mConfig.mAcqPeriod;
-	ts.tv_nsec = 0;
+	mShedNextTick = (mTick / mShedding.getPeriodFactor() + 1) *
+			mShedding.getPeriodFactor();
 
-	ret = mPeriodTimer.setPeriodic(mLoop, ts, cb);
-	if (ret < 0)
-		return ret;
+	// Only read the collectors whose period has elapsed
+	if (!updateSchedules())
+		return 0;
 
-	return 0;
-}
+	acqStart = TimeSource::now();
 
-int SystemMonitorImpl::readSystemConfig(SystemConfig *config)
-{
-	if (!config)
-		return -EINVAL;
+	// Single /proc walk for every waiting selector
+	ret = discoverProcesses();
+	if (ret < 0) {
+		LOGW("discoverProcesses() failed : %d(%s)",
+		     -ret, strerror(-ret));
+	}
 
-	*config = mSysSettings;
+	if (mJobsDirty)
+		dispatchMonitors();
 
-	return 0;
-}
+	// Workers are idle, the TSC scale can be updated
+	TimeSource::resync();
 
-int SystemMonitorImpl::addProcess(const char *name)
-{
-	ProcessMonitor *monitor;
+	// Same time base as the read timestamps
+	stats.mStart = TimeSource::now();
 
-	if (!name)
-		return -EINVAL;
+	mWorkers.run([this] (int job) { readJob(job); });
 
-	monitor = new ProcessMonitor(name, &mConfig, &mSysSettings);
-	if (!monitor)
-		return -ENOMEM;
+	stats.mEnd = TimeSource::now();
 
-	mProcMonitors.push_back(monitor);
+	stats.mReadBackend = (uint8_t) mJobs[0]->mReader.getBackend();
+	stats.mReadCount = 0;
+	stats.mSubmitTime = 0;
+	stats.mReapTime = 0;
+	for (auto &job :mJobs) {
+		stats.mReadCount += job->mReader.getReadCount();
+		stats.mSubmitTime += job->mReader.getSubmitTime();
+		stats.mReapTime += job->mReader.getReapTime();
+	}
+
+	stats.mMissedTicks = mMissedTicks;
+	mMissedTicks = 0;
+
+	stats.mTickLateness = mTickLateness;
+	mTickLateness = 0;
+
+	stats.mThreadFdCount = mFdBudget.getUsed();
+	stats.mReopenCount = 0;
+	stats.mSkippedReads = 0;
+	for (auto m :mProcMonitors) {
+		if (!m->getSchedule()->mDue)
+			continue;
+
+		stats.mReopenCount += m->getReopenCount();
+		stats.mSkippedReads += m->getSkippedReads();
+	}
+
+	if (mCb.mResultsBegin)
+		mCb.mResultsBegin(stats, mCb.mUserdata);
+
+	// Process fetched data
+	if (mSysSchedule.mDue)
+		mSysMonitor.processRawStats(mCb);
+
+	if (mJobs.size() == 1) {
+		for (auto &m :mProcMonitors) {
+			if (m->getSchedule()->mDue)
+				m->processRawStats(mCb);
+		}
+	} else {
+		mWorkers.run([this] (int job) { processJob(job); });
+		notifyJobResults();
+	}
+
+	if (mCb.mResultsEnd)
+		mCb.mResultsEnd(mCb.mUserdata);
+
+	// Once the samples have been processed with the backend that read
+	// them
+	for (auto &job :mJobs) {
+		if (job->mTaskStatsFailed) {
+			disableTaskStats();
+			break;
+		}
+	}
+
+	reclaimMonitors();
+
+	if (mProcEvents.isStarted())
+		updatePidIndex();
+
+	// No budget decision without a valid duration
+	acqEnd = TimeSource::now();
+	if (acqStart != 0 && acqEnd >= acqStart)
+		updateShedding(acqEnd - acqStart);
+
+	// May restart the timer, done last
+	updateCadence();
 
 	return 0;
 }
 
-int SystemMonitorImpl::findAllProcesses()
+int SystemMonitorImpl::startProcEvents()
 {
-	std::list<int> processList;
-	ProcessMonitor *monitor;
+	ProcEvents::Callbacks cb;
 	int ret;
 
-	ret = pfstools::findAllProcesses(&processList);
+	cb.mFork = procForkCb;
+	cb.mExec = procExecCb;
+	cb.mComm = procCommCb;
+	cb.mExit = procExitCb;
+	cb.mOverrun = procOverrunCb;
+	cb.mUserdata = this;
+
+	ret = mProcEvents.init(mLoop, cb);
 	if (ret < 0)
 		return ret;
 
-	for (auto pid :processList) {
-		monitor = new ProcessMonitor(pid, &mConfig, &mSysSettings);
-		if (!monitor)
-			return -ENOMEM;
-
-		mProcMonitors.push_back(monitor);
+	// Tasks created before the subscription are found by a last scan,
+	// done at the next acquisition.
+	for (auto m :mProcMonitors) {
+		m->setEventDriven(true);
+		m->requestRescan();
 	}
 
+	for (auto sel :mSelectors)
+		sel->requestRescan();
+
+	updatePidIndex();
+
+	LOGI("Using proc events for process discovery");
+
 	return 0;
 }
 
-int SystemMonitorImpl::loadProcesses()
+void SystemMonitorImpl::stopProcEvents()
 {
-	if (mProcMonitors.empty()) {
-		int ret;
+	if (!mProcEvents.isStarted())
+		return;
 
-		ret = findAllProcesses();
-		if (ret < 0)
-			return ret;
-	}
+	mProcEvents.clear();
 
 	for (auto m :mProcMonitors)
-		m->init();
+		m->setEventDriven(false);
 
-	return 0;
+	mPidIndex.clear();
+	mReusedPids.clear();
 }
 
-int SystemMonitorImpl::clearProcesses()
+void SystemMonitorImpl::updatePidIndex()
 {
-	for (auto m :mProcMonitors)
-		delete m;
+	int pid;
 
-	mProcMonitors.clear();
+	mPidIndex.clear();
 
-	return 0;
+	for (auto m :mProcMonitors) {
+		pid = m->getPid();
+		if (pid > 0)
+			mPidIndex[pid] = m;
+	}
 }
 
-int SystemMonitorImpl::setAcqPeriod(int acqPeriod)
+ProcessMonitor *SystemMonitorImpl::findMonitorByPid(int pid)
 {
-	mConfig.mAcqPeriod = acqPeriod;
+	auto i = mPidIndex.find(pid);
 
-	if (mState == State::Started) {
-		int ret;
+	if (i == mPidIndex.end())
+		return nullptr;
 
-		mPeriodTimer.clear();
-
-		ret = startAcquisitionTimer();
-		if (ret < 0) {
-			LOGW("startAcquisitionTimer() failed : %d(%s)",
-			     -ret, strerror(-ret));
-			return ret;
-		}
-	}
+	// Index may be outdated until the next acquisition
+	if (i->second->getPid() != pid)
+		return nullptr;
 
-	return 0;
+	return i->second;
 }
 
-int SystemMonitorImpl::start()
+void SystemMonitorImpl::onProcessForked(int pid)
 {
-	int ret;
-
-	ret = mSysMonitor.init();
-	if (ret < 0) {
-		LOGW("mSysMonitor.init() failed : %d(%s)",
-		     -ret, strerror(-ret));
-		return ret;
-	}
+	// The previous process of this pid has exited, but its monitor may
+	// not have been reclaimed yet
+	if (isPidHeld(pid))
+		mReusedPids.insert(pid);
 
-	ret = startAcquisitionTimer();
-	if (ret < 0) {
-		LOGW("startAcquisitionTimer() failed : %d(%s)",
-		     -ret, strerror(-ret));
-		return ret;
-	}
+	onProcessStarted(pid, nullptr);
+}
 
-	ret = makeAcquisition();
-	if (ret < 0) {
-		LOGW("makeAcquisition() failed : %d(%s)",
-		     -ret, strerror(-ret));
-		return ret;
+void SystemMonitorImpl::onProcessStarted(int pid, const char *comm)
+{
+	// The name is only read if a waiting selector needs it
+	matchSelectors(pid, comm, mSelectors);
+}
 
-	}
+void SystemMonitorImpl::onProcessExec(int pid)
+{
+	// Matched at fork time with the image of the parent : the new one
+	// may select or deselect it
+	matchSelectors(pid, nullptr, mSelectors, true);
+}
 
-	mState = State::Started;
+void SystemMonitorImpl::onThreadStarted(int tid, int pid)
+{
+	ProcessMonitor *m;
 
-	return 0;
+	m = findMonitorByPid(pid);
+	if (m)
+		m->addThread(tid);
 }
 
-int SystemMonitorImpl::stop()
+void SystemMonitorImpl::onThreadExited(int tid, int pid)
 {
-	int ret;
+	ProcessMonitor *m;
 
-	ret = mPeriodTimer.clear();
-	if (ret < 0)
-		return ret;
+	m = findMonitorByPid(pid);
+	if (m)
+		m->removeThread(tid);
+}
 
-	mState = State::Stopped;
+void SystemMonitorImpl::onProcEventsOverrun()
+{
+	for (auto m :mProcMonitors)
+		m->requestRescan();
 
-	return 0;
+	for (auto sel :mSelectors)
+		sel->requestRescan();
 }
 
-int SystemMonitorImpl::makeAcquisition()
+void SystemMonitorImpl::procForkCb(int pid, int tgid, void *userdata)
 {
-	AcquisitionDuration stats;
-	int ret;
+	auto self = (SystemMonitorImpl *) userdata;
 
-	// Compute delay between two calls
-	ret = getTimeNs(&stats.mStart);
-	if (ret < 0)
-		return ret;
+	if (pid == tgid)
+		self->onProcessForked(pid);
+	else
+		self->onThreadStarted(pid, tgid);
+}
 
-	mSysMonitor.readRawStats();
+void SystemMonitorImpl::procExecCb(int pid, int tgid, void *userdata)
+{
+	auto self = (SystemMonitorImpl *) userdata;
 
-	// Start process monitors
-	for (auto m :mProcMonitors)
-		m->readRawStats();
+	self->onProcessExec(tgid);
+}
 
-	// Compute acquisition duration
-	ret = getTimeNs(&stats.mEnd);
-	if (ret < 0)
-		return ret;
+void SystemMonitorImpl::procCommCb(int pid, int tgid, const char *comm,
+				   void *userdata)
+{
+	auto self = (SystemMonitorImpl *) userdata;
 
-	if (mCb.mResultsBegin)
-		mCb.mResultsBegin(stats, mCb.mUserdata);
+	if (pid == tgid)
+		self->onProcessStarted(tgid, comm);
+}
 
-	// Process fetched data
-	mSysMonitor.processRawStats(mCb);
+void SystemMonitorImpl::procExitCb(int pid, int tgid, void *userdata)
+{
+	auto self = (SystemMonitorImpl *) userdata;
 
-	for (auto &m :mProcMonitors)
-		m->processRawStats(mCb);
+	// Process exits are notified by their pidfd, or found by the next
+	// acquisition
+	if (pid != tgid)
+		self->onThreadExited(pid, tgid);
+}
 
-	if (mCb.mResultsEnd)
-		mCb.mResultsEnd(mCb.mUserdata);
+void SystemMonitorImpl::procOverrunCb(void *userdata)
+{
+	auto self = (SystemMonitorImpl *) userdata;
 
-	return 0;
+	self->onProcEventsOverrun();
 }
 
 } // anonymous namespace
@@ -293,6 +1532,9 @@ int SystemMonitor::create(
 	if (!monitor)
 		return -ENOMEM;
 
+	monitor->probeStatsBackend();
+	monitor->probeClockSource();
+
 	*outMonitor = monitor;
 
 	return 0;
@@ -367,6 +1609,42 @@ int SystemMonitor::initStructDescs()
 	ret = REGISTER_RAW_VALUE(desc, SystemStats, mRamFree, "ramfree");
 	RETURN_IF_REGISTER_FAILED(ret);
 
+	// CpuStats
+	type = "cpustats";
+
+	ret = StructDescRegistry::registerType<CpuStats>(type, &desc);
+	RETURN_IF_REGISTER_TYPE_FAILED(ret, type);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mTs, "ts");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mAcqEnd, "acqend");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mCpu, "cpu");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mUtime, "utime");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mNice, "nice");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mStime, "stime");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mIdle, "idle");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mIoWait, "iowait");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mIrq, "irq");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CpuStats, mSoftIrq, "softirq");
+	RETURN_IF_REGISTER_FAILED(ret);
+
 	// ProcessStats
 	type = "processstats";
 
@@ -427,6 +1705,66 @@ int SystemMonitor::initStructDescs()
 	ret = REGISTER_RAW_VALUE(desc, ThreadStats, mStime, "stime");
 	RETURN_IF_REGISTER_FAILED(ret);
 
+	ret = REGISTER_RAW_VALUE(desc, ThreadStats, mUtimeNs, "utimens");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, ThreadStats, mStimeNs, "stimens");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	// SheddingStep
+	type = "shedding";
+
+	ret = StructDescRegistry::registerType<SheddingStep>(type, &desc);
+	RETURN_IF_REGISTER_TYPE_FAILED(ret, type);
+
+	ret = REGISTER_RAW_VALUE(desc, SheddingStep, mTs, "ts");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, SheddingStep, mDuration, "duration");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, SheddingStep, mThreadsShed, "threadsshed");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, SheddingStep, mShedPriority, "shedpriority");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, SheddingStep, mPeriodFactor, "periodfactor");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	// CadenceChange
+	type = "cadence";
+
+	ret = StructDescRegistry::registerType<CadenceChange>(type, &desc);
+	RETURN_IF_REGISTER_TYPE_FAILED(ret, type);
+
+	ret = REGISTER_RAW_VALUE(desc, CadenceChange, mTs, "ts");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CadenceChange, mPeriodMs, "periodms");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CadenceChange, mLoad, "load");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, CadenceChange, mReason, "reason");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	// ProcessExit
+	type = "processexit";
+
+	ret = StructDescRegistry::registerType<ProcessExit>(type, &desc);
+	RETURN_IF_REGISTER_TYPE_FAILED(ret, type);
+
+	ret = REGISTER_RAW_VALUE(desc, ProcessExit, mTs, "ts");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, ProcessExit, mPid, "pid");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_STRING(desc, ProcessExit, mName, "name");
+	RETURN_IF_REGISTER_FAILED(ret);
+
 	// Acquisition duration
 	type = "acqduration";
 
@@ -439,5 +1777,32 @@ int SystemMonitor::initStructDescs()
 	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mEnd, "end");
 	RETURN_IF_REGISTER_FAILED(ret);
 
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mReadBackend, "readbackend");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mReadCount, "readcount");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mSubmitTime, "submittime");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mReapTime, "reaptime");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mMissedTicks, "missedticks");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mThreadFdCount, "threadfds");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mReopenCount, "reopencount");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mTickLateness, "ticklateness");
+	RETURN_IF_REGISTER_FAILED(ret);
+
+	ret = REGISTER_RAW_VALUE(desc, AcquisitionDuration, mSkippedReads, "skippedreads");
+	RETURN_IF_REGISTER_FAILED(ret);
+
 	return 0;
 }
@@ -0,0 +1,392 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include "ssr_priv.hpp"
+
+// Requests sent before waiting for their replies
+#define TASKSTATS_WINDOW 64
+
+#define TASKSTATS_BUFFER_SIZE (64 * 1024)
+
+// Longest wait for a reply, so that a lost one doesn't stall the
+// acquisition
+#define TASKSTATS_RECV_TIMEOUT_MS 100
+
+#define GENLMSG_DATA(n) \
+	((void *) ((char *) NLMSG_DATA(n) + GENL_HDRLEN))
+
+#define NLA_DATA(a) \
+	((void *) ((char *) (a) + NLA_HDRLEN))
+
+namespace {
+
+struct GenlRequest {
+	struct nlmsghdr mNlh;
+	struct genlmsghdr mGenlh;
+	char mAttrs[64];
+};
+
+void addAttr(GenlRequest *req, uint16_t type, const void *data, uint16_t len)
+{
+	struct nlattr *attr;
+
+	attr = (struct nlattr *) ((char *) req + NLMSG_ALIGN(req->mNlh.nlmsg_len));
+	attr->nla_type = type;
+	attr->nla_len = NLA_HDRLEN + len;
+	memcpy(NLA_DATA(attr), data, len);
+
+	req->mNlh.nlmsg_len = NLMSG_ALIGN(req->mNlh.nlmsg_len) +
+			      NLA_ALIGN(attr->nla_len);
+}
+
+void initRequest(GenlRequest *req, uint16_t family, uint8_t cmd, uint32_t seq)
+{
+	memset(req, 0, sizeof(*req));
+	req->mNlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	req->mNlh.nlmsg_type = family;
+	req->mNlh.nlmsg_flags = NLM_F_REQUEST;
+	req->mNlh.nlmsg_seq = seq;
+	req->mGenlh.cmd = cmd;
+	req->mGenlh.version = 1;
+}
+
+} // anonymous namespace
+
+TaskStats::TaskStats()
+{
+	mFd = -1;
+	mFamilyId = 0;
+	mSeq = 1;
+	mBuffer = nullptr;
+}
+
+TaskStats::~TaskStats()
+{
+	if (mFd != -1)
+		close(mFd);
+
+	free(mBuffer);
+}
+
+int TaskStats::init()
+{
+	struct sockaddr_nl addr;
+	struct timeval timeout;
+	int ret;
+
+	if (mFd != -1)
+		return -EPERM;
+
+	mBuffer = (uint8_t *) malloc(TASKSTATS_BUFFER_SIZE);
+	if (!mBuffer)
+		return -ENOMEM;
+
+	mFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (mFd == -1) {
+		ret = -errno;
+		LOG_ERRNO("socket");
+		goto error;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	ret = bind(mFd, (struct sockaddr *) &addr, sizeof(addr));
+	if (ret == -1) {
+		ret = -errno;
+		LOG_ERRNO("bind");
+		goto error;
+	}
+
+	timeout.tv_sec = TASKSTATS_RECV_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (TASKSTATS_RECV_TIMEOUT_MS % 1000) * 1000;
+
+	ret = setsockopt(mFd, SOL_SOCKET, SO_RCVTIMEO,
+			 &timeout, sizeof(timeout));
+	if (ret == -1) {
+		ret = -errno;
+		LOG_ERRNO("setsockopt");
+		goto error;
+	}
+
+	ret = resolveFamily();
+	if (ret < 0)
+		goto error;
+
+	return 0;
+
+error:
+	if (mFd != -1) {
+		close(mFd);
+		mFd = -1;
+	}
+
+	free(mBuffer);
+	mBuffer = nullptr;
+
+	return ret;
+}
+
+int TaskStats::probe()
+{
+	Sample sample;
+	int ret;
+
+	// Resolving the family is allowed to anyone, TASKSTATS_CMD_GET needs
+	// CAP_NET_ADMIN : query the calling process
+	ret = add(getpid(), &sample);
+	if (ret < 0)
+		return ret;
+
+	ret = flush();
+	if (ret < 0)
+		return ret;
+
+	return sample.mPending ? 0 : -ENOENT;
+}
+
+int TaskStats::resolveFamily()
+{
+	GenlRequest req;
+	struct nlmsghdr *nlh;
+	struct nlattr *attr;
+	ssize_t len;
+	int attrLen;
+	int ret;
+
+	initRequest(&req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, mSeq++);
+	addAttr(&req, CTRL_ATTR_FAMILY_NAME,
+		TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+
+	len = send(mFd, &req, req.mNlh.nlmsg_len, 0);
+	if (len == -1) {
+		ret = -errno;
+		LOG_ERRNO("send");
+		return ret;
+	}
+
+	len = recv(mFd, mBuffer, TASKSTATS_BUFFER_SIZE, 0);
+	if (len == -1) {
+		ret = -errno;
+		LOG_ERRNO("recv");
+		return ret;
+	}
+
+	nlh = (struct nlmsghdr *) mBuffer;
+	if (!NLMSG_OK(nlh, len))
+		return -EPROTO;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
+		ret = ((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+		return ret < 0 ? ret : -EPROTO;
+	}
+
+	attr = (struct nlattr *) GENLMSG_DATA(nlh);
+	attrLen = NLMSG_PAYLOAD(nlh, GENL_HDRLEN);
+	while (attrLen >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN &&
+	       attr->nla_len <= attrLen) {
+		if (attr->nla_type == CTRL_ATTR_FAMILY_ID) {
+			mFamilyId = *(uint16_t *) NLA_DATA(attr);
+			return 0;
+		}
+
+		attrLen -= NLA_ALIGN(attr->nla_len);
+		attr = (struct nlattr *) ((char *) attr + NLA_ALIGN(attr->nla_len));
+	}
+
+	return -ENOENT;
+}
+
+int TaskStats::sendRequest(int pid, uint32_t seq)
+{
+	GenlRequest req;
+	uint32_t u32Pid = pid;
+	ssize_t len;
+	int ret;
+
+	initRequest(&req, mFamilyId, TASKSTATS_CMD_GET, seq);
+	addAttr(&req, TASKSTATS_CMD_ATTR_PID, &u32Pid, sizeof(u32Pid));
+
+	do {
+		len = send(mFd, &req, req.mNlh.nlmsg_len, 0);
+	} while (len == -1 && errno == EINTR);
+
+	if (len == -1) {
+		ret = -errno;
+		LOG_ERRNO("send");
+		return ret;
+	}
+
+	return 0;
+}
+
+int TaskStats::parseReply(const void *data, size_t len, Sample *sample)
+{
+	const struct nlattr *attr = (const struct nlattr *) data;
+	const struct nlattr *nested;
+	struct taskstats stats;
+	int attrLen = len;
+	int nestedLen;
+	size_t statsLen;
+
+	while (attrLen >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN &&
+	       attr->nla_len <= attrLen) {
+		if (attr->nla_type != TASKSTATS_TYPE_AGGR_PID &&
+		    attr->nla_type != TASKSTATS_TYPE_AGGR_TGID)
+			goto next;
+
+		nested = (const struct nlattr *) NLA_DATA(attr);
+		nestedLen = attr->nla_len - NLA_HDRLEN;
+		while (nestedLen >= NLA_HDRLEN &&
+		       nested->nla_len >= NLA_HDRLEN &&
+		       nested->nla_len <= nestedLen) {
+			if (nested->nla_type != TASKSTATS_TYPE_STATS)
+				goto nextNested;
+
+			// The kernel struct version may differ from ours
+			memset(&stats, 0, sizeof(stats));
+			statsLen = nested->nla_len - NLA_HDRLEN;
+			if (statsLen > sizeof(stats))
+				statsLen = sizeof(stats);
+
+			memcpy(&stats, NLA_DATA(nested), statsLen);
+
+			sample->mPid = stats.ac_pid;
+			snprintf(sample->mComm, sizeof(sample->mComm),
+				 "%s", stats.ac_comm);
+			sample->mUtime = stats.ac_utime;
+			sample->mStime = stats.ac_stime;
+			sample->mPending = true;
+
+			return 0;
+
+nextNested:
+			nestedLen -= NLA_ALIGN(nested->nla_len);
+			nested = (const struct nlattr *) ((const char *) nested +
+					NLA_ALIGN(nested->nla_len));
+		}
+
+next:
+		attrLen -= NLA_ALIGN(attr->nla_len);
+		attr = (const struct nlattr *) ((const char *) attr +
+				NLA_ALIGN(attr->nla_len));
+	}
+
+	return -ENOENT;
+}
+
+int TaskStats::recvReplies(size_t start, uint32_t firstSeq, size_t count)
+{
+	struct nlmsghdr *nlh;
+	size_t received = 0;
+	Sample *sample;
+	uint32_t idx;
+	uint64_t ts;
+	ssize_t len;
+	int err;
+	int ret = 0;
+
+	while (received < count) {
+		len = recv(mFd, mBuffer, TASKSTATS_BUFFER_SIZE, 0);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+
+			// Samples without reply are left not read
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				LOGW("%zu taskstats replies missing",
+				     count - received);
+				return -ETIMEDOUT;
+			}
+
+			ret = -errno;
+			LOG_ERRNO("recv");
+			return ret;
+		}
+
+		ts = TimeSource::now();
+
+		for (nlh = (struct nlmsghdr *) mBuffer;
+		     NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			idx = nlh->nlmsg_seq - firstSeq;
+			if (idx >= count)
+				continue;
+
+			sample = mQueue[start + idx].second;
+			sample->mAcqEnd = ts;
+			received++;
+
+			if (nlh->nlmsg_type != NLMSG_ERROR) {
+				parseReply(GENLMSG_DATA(nlh),
+					   NLMSG_PAYLOAD(nlh, GENL_HDRLEN),
+					   sample);
+				continue;
+			}
+
+			// Only a task that has exited is expected. Any other
+			// error, like EPERM without CAP_NET_ADMIN, fails the
+			// flush once every reply is received.
+			err = ((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+			if (err == -ESRCH)
+				sample->mExited = true;
+			else if (err < 0 && ret == 0)
+				ret = err;
+		}
+	}
+
+	return ret;
+}
+
+int TaskStats::add(int pid, Sample *sample)
+{
+	if (mFd == -1)
+		return -EPERM;
+	else if (!sample)
+		return -EINVAL;
+
+	sample->mPending = false;
+	sample->mExited = false;
+	mQueue.push_back({ pid, sample });
+
+	return 0;
+}
+
+int TaskStats::flush()
+{
+	uint32_t firstSeq;
+	size_t start;
+	size_t count;
+	uint64_t ts;
+	int ret = 0;
+
+	for (start = 0; start < mQueue.size(); start += count) {
+		count = mQueue.size() - start;
+		if (count > TASKSTATS_WINDOW)
+			count = TASKSTATS_WINDOW;
+
+		ts = TimeSource::now();
+		firstSeq = mSeq;
+
+		for (size_t i = 0; i < count; i++) {
+			mQueue[start + i].second->mTs = ts;
+
+			ret = sendRequest(mQueue[start + i].first, mSeq + i);
+			if (ret < 0)
+				goto out;
+		}
+
+		mSeq += count;
+
+		ret = recvReplies(start, firstSeq, count);
+		if (ret < 0)
+			goto out;
+	}
+
+out:
+	mQueue.clear();
+
+	return ret;
+}
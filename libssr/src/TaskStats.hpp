@@ -0,0 +1,67 @@
+#ifndef __TASK_STATS_HPP__
+#define __TASK_STATS_HPP__
+
+/**
+ * Client of the TASKSTATS generic netlink family.
+ *
+ * Per-task accounting is queried in binary form, without opening any file
+ * in /proc. Like RawStatsReader, requests are queued by add() and Sample
+ * content is only valid once flush() has returned.
+ *
+ * A Sample neither pending nor exited has not been read : its reply is
+ * missing or the flush has failed.
+ */
+class TaskStats {
+public:
+	struct Sample {
+		bool mPending;
+		bool mExited;
+		uint64_t mTs;
+		uint64_t mAcqEnd;
+
+		uint32_t mPid;
+		char mComm[32];
+
+		// CPU times (microseconds)
+		uint64_t mUtime;
+		uint64_t mStime;
+
+		Sample()
+		{
+			mPending = false;
+			mExited = false;
+			mTs = 0;
+			mAcqEnd = 0;
+			mPid = 0;
+			mComm[0] = '\0';
+			mUtime = 0;
+			mStime = 0;
+		}
+	};
+
+private:
+	int mFd;
+	uint16_t mFamilyId;
+	uint32_t mSeq;
+
+	std::vector<std::pair<int, Sample *>> mQueue;
+	uint8_t *mBuffer;
+
+private:
+	int resolveFamily();
+	int sendRequest(int pid, uint32_t seq);
+	int recvReplies(size_t start, uint32_t firstSeq, size_t count);
+	int parseReply(const void *data, size_t len, Sample *sample);
+
+public:
+	TaskStats();
+	~TaskStats();
+
+	int init();
+	int probe();
+
+	int add(int pid, Sample *sample);
+	int flush();
+};
+
+#endif // !__TASK_STATS_HPP__
@@ -0,0 +1,128 @@
+#include "ssr_priv.hpp"
+
+// Slot count is a power of two, kept at least twice the entry count
+#define THREAD_TABLE_MIN_SLOTS 16
+
+namespace {
+
+inline size_t hashTid(int tid)
+{
+	return (uint32_t) tid * 2654435761U;
+}
+
+} // anonymous namespace
+
+ThreadTable::ThreadTable()
+{
+	mSlots.assign(THREAD_TABLE_MIN_SLOTS, -1);
+}
+
+size_t ThreadTable::findSlot(int tid) const
+{
+	size_t mask = mSlots.size() - 1;
+	size_t slot = hashTid(tid) & mask;
+
+	// Return the slot of tid or the empty slot ending its probe sequence
+	while (mSlots[slot] != -1 && mHot[mSlots[slot]].mTid != tid)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+void ThreadTable::eraseSlot(size_t slot)
+{
+	size_t mask = mSlots.size() - 1;
+	size_t next = slot;
+	size_t ideal;
+
+	// Backward shift : move up the entries whose probe sequence crossed
+	// the freed slot, no tombstone is needed
+	while (true) {
+		mSlots[slot] = -1;
+
+		while (true) {
+			next = (next + 1) & mask;
+			if (mSlots[next] == -1)
+				return;
+
+			ideal = hashTid(mHot[mSlots[next]].mTid) & mask;
+			if (slot <= next ?
+			    (slot < ideal && ideal <= next) :
+			    (slot < ideal || ideal <= next))
+				continue;
+
+			mSlots[slot] = mSlots[next];
+			slot = next;
+			break;
+		}
+	}
+}
+
+void ThreadTable::rehash(size_t slotCount)
+{
+	mSlots.assign(slotCount, -1);
+
+	for (size_t i = 0; i < mHot.size(); i++)
+		mSlots[findSlot(mHot[i].mTid)] = i;
+}
+
+int ThreadTable::find(int tid) const
+{
+	return mSlots[findSlot(tid)];
+}
+
+int ThreadTable::insert(int tid, int fd, const char *name)
+{
+	size_t slot;
+	Hot hot;
+
+	if (!name)
+		return -EINVAL;
+
+	if ((mHot.size() + 1) * 2 > mSlots.size())
+		rehash(mSlots.size() * 2);
+
+	slot = findSlot(tid);
+	if (mSlots[slot] != -1)
+		return -EEXIST;
+
+	hot.mTid = tid;
+	hot.mFd = fd;
+	hot.mTransient = false;
+	mHot.push_back(hot);
+
+	mCold.emplace_back();
+	snprintf(mCold.back().mName, sizeof(mCold.back().mName), "%s", name);
+	mCold.back().mScanGen = 0;
+
+	mSlots[slot] = mHot.size() - 1;
+
+	return mHot.size() - 1;
+}
+
+void ThreadTable::remove(size_t idx)
+{
+	size_t last = mHot.size() - 1;
+
+	if (idx > last)
+		return;
+
+	eraseSlot(findSlot(mHot[idx].mTid));
+
+	// Move the last entry in the hole
+	if (idx != last) {
+		mHot[idx] = mHot[last];
+		mCold[idx] = mCold[last];
+		mSlots[findSlot(mHot[idx].mTid)] = idx;
+	}
+
+	mHot.pop_back();
+	mCold.pop_back();
+}
+
+void ThreadTable::clear()
+{
+	mHot.clear();
+	mCold.clear();
+	mSlots.assign(THREAD_TABLE_MIN_SLOTS, -1);
+}
@@ -0,0 +1,56 @@
+#ifndef __THREAD_TABLE_HPP__
+#define __THREAD_TABLE_HPP__
+
+/**
+ * Threads of a monitored process, indexed by tid.
+ *
+ * Entries are stored contiguously, split in a hot part walked at each
+ * acquisition and a cold part only accessed through the hot one. An open
+ * addressing index maps a tid to its entry. remove() moves the last entry
+ * into the freed one, so indexes are only stable until the next remove().
+ */
+class ThreadTable {
+public:
+	struct Hot {
+		int mTid;
+		int mFd;
+		bool mTransient; // mFd only opened for the current acquisition
+	};
+
+	struct Cold {
+		char mName[64]; // empty until the first stat read
+		uint32_t mScanGen; // last task directory scan that found it
+
+		pfstools::RawStats mRawStats;
+		TaskStats::Sample mTaskStats;
+	};
+
+private:
+	std::vector<Hot> mHot;
+	std::vector<Cold> mCold;
+
+	// Entry index for each slot, -1 if the slot is empty
+	std::vector<int> mSlots;
+
+private:
+	size_t findSlot(int tid) const;
+	void eraseSlot(size_t slot);
+	void rehash(size_t slotCount);
+
+public:
+	ThreadTable();
+
+	size_t size() const { return mHot.size(); }
+
+	Hot &hot(size_t idx) { return mHot[idx]; }
+	Cold &cold(size_t idx) { return mCold[idx]; }
+
+	// Return the entry index of tid, -1 if not found
+	int find(int tid) const;
+
+	int insert(int tid, int fd, const char *name);
+	void remove(size_t idx);
+	void clear();
+};
+
+#endif // !__THREAD_TABLE_HPP__
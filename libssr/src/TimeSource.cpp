@@ -0,0 +1,138 @@
+#include <unistd.h>
+#include "ssr_priv.hpp"
+
+// Interval between the two references of the initial calibration
+#define TSC_CALIBRATION_US 20000
+
+// Pairs read to find the closest TSC bracket of a clock_gettime() call
+#define TSC_REFERENCE_TRIES 5
+
+bool TimeSource::sUseTsc = false;
+uint64_t TimeSource::sOriginTsc = 0;
+uint64_t TimeSource::sOriginNs = 0;
+uint64_t TimeSource::sBaseTsc = 0;
+uint64_t TimeSource::sBaseNs = 0;
+uint64_t TimeSource::sMult = 0;
+
+bool TimeSource::hasInvariantTsc()
+{
+#ifdef __x86_64__
+	unsigned int eax, ebx, ecx, edx;
+
+	// Invariant TSC : constant rate, not stopped in deep C-states
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (edx & (1 << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+void TimeSource::readReference(uint64_t *tsc, uint64_t *ns)
+{
+#ifdef __x86_64__
+	uint64_t bestSpan = UINT64_MAX;
+	uint64_t before;
+	uint64_t after;
+	uint64_t t;
+
+	*tsc = 0;
+	*ns = 0;
+
+	// Keep the clock_gettime() call the least likely to be interrupted
+	for (int i = 0; i < TSC_REFERENCE_TRIES; i++) {
+		before = __rdtsc();
+		pfstools::getTimeNs(&t);
+		after = __rdtsc();
+
+		if (after - before < bestSpan) {
+			bestSpan = after - before;
+			*tsc = before + (after - before) / 2;
+			*ns = t;
+		}
+	}
+#endif
+}
+
+int TimeSource::init(SystemMonitor::ClockSource source)
+{
+	uint64_t tsc;
+	uint64_t ns;
+
+	sUseTsc = false;
+
+	if (source != SystemMonitor::ClockSource::tsc)
+		return 0;
+	else if (!hasInvariantTsc())
+		return -ENOTSUP;
+
+	readReference(&sOriginTsc, &sOriginNs);
+	usleep(TSC_CALIBRATION_US);
+	readReference(&tsc, &ns);
+
+	if (tsc <= sOriginTsc)
+		return -EIO;
+
+	sMult = ((ns - sOriginNs) << 32) / (tsc - sOriginTsc);
+	sBaseTsc = tsc;
+	sBaseNs = ns;
+	sUseTsc = true;
+
+	LOGI("TSC timestamps : %.3f MHz",
+	     (tsc - sOriginTsc) * 1000.0 / (ns - sOriginNs));
+
+	return 0;
+}
+
+void TimeSource::resync()
+{
+	uint64_t tsc;
+	uint64_t ns;
+
+	if (!sUseTsc)
+		return;
+
+	readReference(&tsc, &ns);
+	resync(tsc, ns);
+}
+
+void TimeSource::resync(uint64_t tsc, uint64_t ns)
+{
+#ifdef __x86_64__
+	uint64_t lineNs;
+	uint64_t mult;
+	uint64_t slew;
+
+	if (!sUseTsc || tsc <= sOriginTsc || ns <= sOriginNs || tsc <= sBaseTsc)
+		return;
+
+	// The scale gets more precise as the interval since the origin
+	// grows, the base removes the drift of the previous scale
+	mult = (uint64_t) (((unsigned __int128) (ns - sOriginNs) << 32) /
+			   (tsc - sOriginTsc));
+
+	// Timestamps up to lineNs may have been given : keep the base there,
+	// and catch the reference up over an interval like the last one. At
+	// most half of the scale is removed, a later resync slows down more.
+	lineNs = tscToNs(tsc);
+	if (lineNs > ns) {
+		slew = (uint64_t) (((unsigned __int128) (lineNs - ns) << 32) /
+				   (tsc - sBaseTsc));
+		mult -= std::min(slew, mult / 2);
+		ns = lineNs;
+	}
+
+	sMult = mult;
+	sBaseTsc = tsc;
+	sBaseNs = ns;
+#endif
+}
+
+SystemMonitor::ClockSource TimeSource::getSource()
+{
+	if (sUseTsc)
+		return SystemMonitor::ClockSource::tsc;
+	else
+		return SystemMonitor::ClockSource::monotonic;
+}
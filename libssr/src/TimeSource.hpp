@@ -0,0 +1,73 @@
+#ifndef __TIME_SOURCE_HPP__
+#define __TIME_SOURCE_HPP__
+
+/**
+ * Timestamps of the procfs reads, in CLOCK_MONOTONIC nanoseconds.
+ *
+ * With SystemMonitor::ClockSource::tsc, an invariant TSC is read and scaled
+ * instead of calling clock_gettime(). The scale is calibrated by init(), and
+ * refined against CLOCK_MONOTONIC by each resync(). Resyncs must not run
+ * while other threads read timestamps.
+ *
+ * Like the kernel timekeeping, timestamps never go back : a resync finding
+ * the reference behind the timestamps already given slows the scale down
+ * instead of moving the base back.
+ */
+class TimeSource {
+private:
+	static bool sUseTsc;
+
+	// First and last CLOCK_MONOTONIC references
+	static uint64_t sOriginTsc;
+	static uint64_t sOriginNs;
+	static uint64_t sBaseTsc;
+	static uint64_t sBaseNs;
+
+	// Nanoseconds per TSC cycle, as a 32.32 fixed point value
+	static uint64_t sMult;
+
+private:
+	static bool hasInvariantTsc();
+	static void readReference(uint64_t *tsc, uint64_t *ns);
+
+#ifdef __x86_64__
+	static uint64_t tscToNs(uint64_t tsc)
+	{
+		unsigned __int128 delta;
+
+		// The TSC of another cpu may be slightly behind the base
+		delta = tsc > sBaseTsc ? tsc - sBaseTsc : 0;
+
+		return sBaseNs + (uint64_t) ((delta * sMult) >> 32);
+	}
+#endif
+
+public:
+	static int init(SystemMonitor::ClockSource source);
+	static void resync();
+
+	// Refine the scale with a reference read at the given TSC value
+	static void resync(uint64_t tsc, uint64_t ns);
+
+	static SystemMonitor::ClockSource getSource();
+
+	// 0 if the clock can't be read
+	static uint64_t now()
+	{
+		uint64_t ns = 0;
+		int ret;
+
+#ifdef __x86_64__
+		if (sUseTsc)
+			return tscToNs(__rdtsc());
+#endif
+
+		ret = pfstools::getTimeNs(&ns);
+		if (ret < 0)
+			return 0;
+
+		return ns;
+	}
+};
+
+#endif // !__TIME_SOURCE_HPP__
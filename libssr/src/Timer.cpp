@@ -1,10 +1,35 @@
 #include <unistd.h>
+#include <sys/timerfd.h>
 #include "ssr_priv.hpp"
 
+namespace {
+
+uint64_t timespecToNs(const struct timespec &ts)
+{
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void nsToTimespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+} // anonymous namespace
+
 Timer::Timer()
 {
 	mLoop = nullptr;
+	mExpiry = 0;
+	mPeriod = 0;
+	mMissed = 0;
+	mDeadline = 0;
+	mLateness = 0;
 	mFd = -1;
+	mLink.mPrev = nullptr;
+	mLink.mNext = nullptr;
+	mLink.mTimer = this;
+	mSlot = -1;
 }
 
 Timer::~Timer()
@@ -12,41 +37,105 @@ Timer::~Timer()
 	clear();
 }
 
-int Timer::setInternal(EventLoop *loop, const struct itimerspec &ts, TimerCb cb)
+int Timer::setInternal(EventLoop *loop, uint64_t delay, uint64_t period, TimerCb cb)
 {
+	uint64_t now;
 	int ret;
 
-	if (!loop)
+	if (!loop || !cb)
 		return -EINVAL;
 
-	if (mFd != -1)
+	if (mLoop)
+		return -EPERM;
+
+	if (!loop->mTimerWheel)
 		return -EPERM;
 
-	// Setup timer
-	mFd = timerfd_create(CLOCK_MONOTONIC, EFD_CLOEXEC);
+	ret = pfstools::getTimeNs(&now);
+	if (ret < 0)
+		return ret;
+
+	mCb = cb;
+	mExpiry = now + delay;
+	mPeriod = period;
+	mMissed = 0;
+
+	ret = loop->mTimerWheel->arm(this);
+	if (ret < 0) {
+		LOGE("TimerWheel::arm() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		mCb = nullptr;
+		return ret;
+	}
+
+	mLoop = loop;
+
+	return 0;
+}
+
+int Timer::set(EventLoop *loop, const struct timespec &ts, TimerCb cb)
+{
+	return setInternal(loop, timespecToNs(ts), 0, cb);
+}
+
+int Timer::setPeriodic(EventLoop *loop, const struct timespec &ts, TimerCb cb)
+{
+	uint64_t period = timespecToNs(ts);
+
+	if (period == 0)
+		return -EINVAL;
+
+	return setInternal(loop, period, period, cb);
+}
+
+int Timer::setPeriodicAligned(EventLoop *loop, const struct timespec &ts, TimerCb cb)
+{
+	uint64_t period = timespecToNs(ts);
+	struct itimerspec timerConf;
+	struct timespec realTs;
+	int ret;
+
+	if (!loop || !cb || period == 0)
+		return -EINVAL;
+
+	if (mLoop)
+		return -EPERM;
+
+	// The wheel would round the deadlines up to its ticks, in
+	// CLOCK_MONOTONIC time
+	mFd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
 	if (mFd == -1) {
 		ret = -errno;
 		LOG_ERRNO("timerfd_create");
 		return ret;
 	}
 
-	ret = timerfd_settime(mFd, 0, &ts, NULL);
+	ret = clock_gettime(CLOCK_REALTIME, &realTs);
 	if (ret < 0) {
-		LOG_ERRNO("timerfd_settime");
+		ret = -errno;
+		LOG_ERRNO("clock_gettime");
 		goto clear_timer;
 	}
 
-	// Register timer in loop
-	ret = loop->addFd(EPOLLIN, mFd,
-		[this, cb] (int fd, int evt) {
-			uint64_t expirations;
-			int ret;
+	// First expiry on the next wall clock boundary. The kernel keeps the
+	// next ones on its multiples.
+	mExpiry = (timespecToNs(realTs) / period + 1) * period;
+	mPeriod = period;
+	mMissed = 0;
 
-			ret = read(mFd, &expirations, sizeof(expirations));
-			if (ret < 0)
-				LOG_ERRNO("read");
+	nsToTimespec(mExpiry, &timerConf.it_value);
+	timerConf.it_interval = ts;
 
-			cb();
+	ret = timerfd_settime(mFd, TFD_TIMER_ABSTIME, &timerConf, NULL);
+	if (ret < 0) {
+		ret = -errno;
+		LOG_ERRNO("timerfd_settime");
+		goto clear_timer;
+	}
+
+	ret = loop->addFd(EPOLLIN, mFd,
+		[this] (int fd, int evt) {
+			onFdEvent();
 		});
 	if (ret < 0) {
 		LOGE("EventLoop::addFd() failed : %d(%s)",
@@ -54,6 +143,7 @@ int Timer::setInternal(EventLoop *loop, const struct itimerspec &ts, TimerCb cb)
 		goto clear_timer;
 	}
 
+	mCb = cb;
 	mLoop = loop;
 
 	return 0;
@@ -65,44 +155,52 @@ clear_timer:
 	return ret;
 }
 
-int Timer::set(EventLoop *loop, const struct timespec &ts, TimerCb cb)
+void Timer::onFdEvent()
 {
-	struct itimerspec timerConf;
+	uint64_t expirations;
+	struct timespec realTs;
+	TimerCb cb;
+	ssize_t ret;
 
-	timerConf.it_value = ts;
+	ret = read(mFd, &expirations, sizeof(expirations));
+	if (ret < 0) {
+		if (errno != EAGAIN)
+			LOG_ERRNO("read");
+		return;
+	} else if (expirations == 0) {
+		return;
+	}
 
-	timerConf.it_interval.tv_sec = 0;
-	timerConf.it_interval.tv_nsec = 0;
+	// Same deadlines as the kernel : the last expired one is current
+	mMissed = expirations - 1;
+	mDeadline = mExpiry + mMissed * mPeriod;
+	mExpiry = mDeadline + mPeriod;
 
-	return setInternal(loop, timerConf, cb);
-}
+	mLateness = 0;
+	if (clock_gettime(CLOCK_REALTIME, &realTs) == 0 &&
+	    timespecToNs(realTs) > mDeadline)
+		mLateness = timespecToNs(realTs) - mDeadline;
 
-int Timer::setPeriodic(EventLoop *loop, const struct timespec &ts, TimerCb cb)
-{
-	struct itimerspec timerConf;
-
-	timerConf.it_value = ts;
-	timerConf.it_interval = ts;
-
-	return setInternal(loop, timerConf, cb);
+	// The callback may clear or set the timer again
+	cb = mCb;
+	cb();
 }
 
 int Timer::clear()
 {
-	int ret;
-
-	if (mFd == -1)
+	if (!mLoop)
 		return -EPERM;
 
-	ret = mLoop->delFd(mFd);
-	if (ret < 0) {
-		LOGE("EventLoop::delFd() failed : %d(%s)",
-		     -ret, strerror(-ret));
+	if (mFd != -1) {
+		mLoop->delFd(mFd);
+		close(mFd);
+		mFd = -1;
+	} else if (mLoop->mTimerWheel) {
+		mLoop->mTimerWheel->cancel(this);
 	}
 
-	close(mFd);
-	mFd = -1;
-
+	// The callback may be the one running, it is only released by the
+	// next set()
 	mLoop = nullptr;
 
 	return 0;
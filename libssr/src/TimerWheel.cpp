@@ -0,0 +1,385 @@
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "ssr_priv.hpp"
+
+#define TICK_NS 1000000ULL
+
+// Timer::mSlot of a timer that is not in the wheel
+#define SLOT_NONE -1
+// Timer::mSlot of a timer moved aside by expire()
+#define SLOT_EXPIRING -2
+
+namespace {
+
+inline uint64_t rotateRight(uint64_t v, int shift)
+{
+	shift &= 63;
+
+	return shift == 0 ? v : (v >> shift) | (v << (64 - shift));
+}
+
+inline bool isListEmpty(const Timer::Link *head)
+{
+	return head->mNext == head;
+}
+
+} // anonymous namespace
+
+TimerWheel::TimerWheel()
+{
+	mLoop = nullptr;
+	mFd = -1;
+	mOrigin = 0;
+	mTick = 0;
+	mPendingTick = 1;
+	mArmedTick = UINT64_MAX;
+	mAdvancing = false;
+
+	for (int i = 0; i < LEVELS * LEVEL_SLOTS; i++) {
+		mSlots[i].mPrev = &mSlots[i];
+		mSlots[i].mNext = &mSlots[i];
+		mSlots[i].mTimer = nullptr;
+	}
+
+	for (int i = 0; i < LEVELS; i++)
+		mBitmap[i] = 0;
+}
+
+TimerWheel::~TimerWheel()
+{
+	// Detach remaining timers
+	for (int i = 0; i < LEVELS * LEVEL_SLOTS; i++) {
+		while (!isListEmpty(&mSlots[i]))
+			unlink(mSlots[i].mNext->mTimer);
+	}
+
+	if (mFd != -1) {
+		mLoop->delFd(mFd);
+		close(mFd);
+	}
+}
+
+int TimerWheel::init(EventLoop *loop)
+{
+	int ret;
+
+	if (!loop)
+		return -EINVAL;
+	else if (mFd != -1)
+		return -EPERM;
+
+	ret = pfstools::getTimeNs(&mOrigin);
+	if (ret < 0)
+		return ret;
+
+	mFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (mFd == -1) {
+		ret = -errno;
+		LOG_ERRNO("timerfd_create");
+		return ret;
+	}
+
+	ret = loop->addFd(EPOLLIN, mFd,
+		[this] (int fd, int evt) {
+			onTimerFdEvent();
+		});
+	if (ret < 0) {
+		LOGE("EventLoop::addFd() failed : %d(%s)",
+		     -ret, strerror(-ret));
+		close(mFd);
+		mFd = -1;
+		return ret;
+	}
+
+	mLoop = loop;
+
+	return 0;
+}
+
+uint64_t TimerWheel::nsToTick(uint64_t ns) const
+{
+	// Round up, a timer never expires early
+	if (ns <= mOrigin)
+		return 0;
+
+	return (ns - mOrigin + TICK_NS - 1) / TICK_NS;
+}
+
+void TimerWheel::insert(Timer *timer)
+{
+	uint64_t expiry = nsToTick(timer->mExpiry);
+	uint64_t maxDelta = 1ULL << (LEVEL_BITS * LEVELS);
+	uint64_t delta;
+	Timer::Link *head;
+	int level;
+	int slot;
+
+	if (expiry < mPendingTick)
+		expiry = mPendingTick;
+
+	// Timers beyond the wheel range wait in the last level, they are put
+	// back at the right place when it cascades
+	delta = expiry - mTick;
+	if (delta >= maxDelta) {
+		expiry = mTick + maxDelta - 1;
+		delta = maxDelta - 1;
+	}
+
+	for (level = 0; level < LEVELS - 1; level++) {
+		if (delta < (1ULL << (LEVEL_BITS * (level + 1))))
+			break;
+	}
+
+	slot = level * LEVEL_SLOTS +
+	       ((expiry >> (LEVEL_BITS * level)) & (LEVEL_SLOTS - 1));
+
+	head = &mSlots[slot];
+	timer->mLink.mPrev = head->mPrev;
+	timer->mLink.mNext = head;
+	head->mPrev->mNext = &timer->mLink;
+	head->mPrev = &timer->mLink;
+	timer->mSlot = slot;
+
+	mBitmap[level] |= 1ULL << (slot & (LEVEL_SLOTS - 1));
+}
+
+void TimerWheel::unlink(Timer *timer)
+{
+	int slot = timer->mSlot;
+
+	if (slot == SLOT_NONE)
+		return;
+
+	timer->mLink.mPrev->mNext = timer->mLink.mNext;
+	timer->mLink.mNext->mPrev = timer->mLink.mPrev;
+	timer->mLink.mPrev = nullptr;
+	timer->mLink.mNext = nullptr;
+	timer->mSlot = SLOT_NONE;
+
+	// Timers being expired are in no slot
+	if (slot >= 0 && isListEmpty(&mSlots[slot])) {
+		mBitmap[slot / LEVEL_SLOTS] &=
+			~(1ULL << (slot & (LEVEL_SLOTS - 1)));
+	}
+}
+
+void TimerWheel::cascade(int level, int slot)
+{
+	Timer::Link *head = &mSlots[level * LEVEL_SLOTS + slot];
+	Timer *timer;
+
+	while (!isListEmpty(head)) {
+		timer = head->mNext->mTimer;
+		unlink(timer);
+		insert(timer);
+	}
+}
+
+void TimerWheel::expire(int slot)
+{
+	Timer::Link *head = &mSlots[slot];
+	Timer::Link expired;
+	uint64_t now;
+	TimerCb cb;
+	Timer *timer;
+
+	if (isListEmpty(head))
+		return;
+
+	// Move the slot content aside : callbacks may arm timers in it again
+	expired.mNext = head->mNext;
+	expired.mPrev = head->mPrev;
+	expired.mNext->mPrev = &expired;
+	expired.mPrev->mNext = &expired;
+	head->mNext = head;
+	head->mPrev = head;
+	mBitmap[0] &= ~(1ULL << slot);
+
+	for (Timer::Link *l = expired.mNext; l != &expired; l = l->mNext)
+		l->mTimer->mSlot = SLOT_EXPIRING;
+
+	pfstools::getTimeNs(&now);
+
+	// Callbacks may also cancel the timers that are still in the list
+	while (!isListEmpty(&expired)) {
+		timer = expired.mNext->mTimer;
+
+		expired.mNext = timer->mLink.mNext;
+		expired.mNext->mPrev = &expired;
+		timer->mLink.mPrev = nullptr;
+		timer->mLink.mNext = nullptr;
+		timer->mSlot = SLOT_NONE;
+
+		// Periodic timers keep their phase, missed periods are skipped
+		// and counted
+		timer->mDeadline = timer->mExpiry;
+		timer->mMissed = 0;
+		if (timer->mPeriod != 0) {
+			timer->mExpiry += timer->mPeriod;
+			if (timer->mExpiry <= now) {
+				timer->mMissed = (now - timer->mExpiry) /
+						 timer->mPeriod + 1;
+				timer->mExpiry += timer->mMissed * timer->mPeriod;
+				timer->mDeadline = timer->mExpiry - timer->mPeriod;
+			}
+
+			insert(timer);
+		}
+
+		// Includes the rounding of the expiry to its tick
+		timer->mLateness = now > timer->mDeadline ?
+				   now - timer->mDeadline : 0;
+
+		// The callback may clear or set the timer again
+		cb = timer->mCb;
+		cb();
+	}
+}
+
+void TimerWheel::advance(uint64_t tick)
+{
+	uint64_t span;
+	uint64_t next;
+	int level;
+
+	mAdvancing = true;
+
+	while (mTick < tick) {
+		// Skip ticks that have nothing to expire or cascade
+		for (level = 0; level < LEVELS; level++) {
+			if (mBitmap[level] != 0)
+				break;
+		}
+
+		if (level == LEVELS) {
+			mTick = tick;
+			break;
+		}
+
+		span = 1ULL << (LEVEL_BITS * level);
+		next = (mTick / span + 1) * span;
+		if (next > tick) {
+			mTick = tick;
+			break;
+		}
+
+		mTick = next;
+		mPendingTick = next;
+
+		for (level = LEVELS - 1; level > 0; level--) {
+			if (next & ((1ULL << (LEVEL_BITS * level)) - 1))
+				continue;
+
+			cascade(level, (next >> (LEVEL_BITS * level)) &
+				       (LEVEL_SLOTS - 1));
+		}
+
+		mPendingTick = next + 1;
+		expire(next & (LEVEL_SLOTS - 1));
+	}
+
+	mPendingTick = mTick + 1;
+	mAdvancing = false;
+}
+
+uint64_t TimerWheel::getNextTick() const
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t base;
+	uint64_t bits;
+	uint64_t tick;
+
+	// Level 0 slots hold the ticks mTick + 1 to mTick + 63
+	if (mBitmap[0] != 0) {
+		bits = rotateRight(mBitmap[0], (mTick + 1) & (LEVEL_SLOTS - 1));
+		return mTick + 1 + __builtin_ctzll(bits);
+	}
+
+	// Upper levels : tick of the next cascade of a non-empty slot
+	for (int level = 1; level < LEVELS; level++) {
+		if (mBitmap[level] == 0)
+			continue;
+
+		base = (mTick >> (LEVEL_BITS * level)) + 1;
+		bits = rotateRight(mBitmap[level], base & (LEVEL_SLOTS - 1));
+		tick = (base + __builtin_ctzll(bits)) << (LEVEL_BITS * level);
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+int TimerWheel::program()
+{
+	struct itimerspec ts;
+	uint64_t next;
+	uint64_t ns;
+	int ret;
+
+	next = getNextTick();
+	if (next == mArmedTick)
+		return 0;
+
+	memset(&ts, 0, sizeof(ts));
+	if (next != UINT64_MAX) {
+		ns = mOrigin + next * TICK_NS;
+		ts.it_value.tv_sec = ns / 1000000000ULL;
+		ts.it_value.tv_nsec = ns % 1000000000ULL;
+	}
+
+	ret = timerfd_settime(mFd, TFD_TIMER_ABSTIME, &ts, NULL);
+	if (ret < 0) {
+		ret = -errno;
+		LOG_ERRNO("timerfd_settime");
+		return ret;
+	}
+
+	mArmedTick = next;
+
+	return 0;
+}
+
+void TimerWheel::onTimerFdEvent()
+{
+	uint64_t expirations;
+	uint64_t now;
+	int ret;
+
+	ret = read(mFd, &expirations, sizeof(expirations));
+	if (ret < 0 && errno != EAGAIN)
+		LOG_ERRNO("read");
+
+	mArmedTick = UINT64_MAX;
+
+	pfstools::getTimeNs(&now);
+	advance((now - mOrigin) / TICK_NS);
+
+	program();
+}
+
+int TimerWheel::arm(Timer *timer)
+{
+	if (!timer)
+		return -EINVAL;
+	else if (mFd == -1)
+		return -EPERM;
+
+	unlink(timer);
+	insert(timer);
+
+	// The timerfd is programmed once all expired timers have been run
+	if (mAdvancing)
+		return 0;
+
+	return program();
+}
+
+void TimerWheel::cancel(Timer *timer)
+{
+	if (!timer)
+		return;
+
+	// An extra wakeup is cheaper than finding the next timer here
+	unlink(timer);
+}
@@ -0,0 +1,63 @@
+#ifndef __TIMER_WHEEL_HPP__
+#define __TIMER_WHEEL_HPP__
+
+/**
+ * Hierarchical timer wheel driven by one timerfd.
+ *
+ * Level 0 has one slot per tick (1 ms), each upper level slot covers a
+ * whole lower level. Timers are armed and cancelled in O(1), and are moved
+ * down one level when the lower level wraps to their slot. The timerfd is
+ * only armed for the next tick that has work, so timers expiring in the
+ * same tick share one wakeup.
+ */
+class TimerWheel {
+private:
+	static const int LEVEL_BITS = 6;
+	static const int LEVEL_SLOTS = 1 << LEVEL_BITS;
+	static const int LEVELS = 4;
+
+private:
+	EventLoop *mLoop;
+	int mFd;
+
+	// Tick 0 date, in nanoseconds
+	uint64_t mOrigin;
+
+	// Last processed tick, and first tick a new timer can be put in
+	uint64_t mTick;
+	uint64_t mPendingTick;
+
+	// Tick the timerfd is armed for, UINT64_MAX if disarmed
+	uint64_t mArmedTick;
+	bool mAdvancing;
+
+	// Slot lists sentinels, and non-empty slots bitmap of each level
+	Timer::Link mSlots[LEVELS * LEVEL_SLOTS];
+	uint64_t mBitmap[LEVELS];
+
+private:
+	uint64_t nsToTick(uint64_t ns) const;
+
+	void insert(Timer *timer);
+	void unlink(Timer *timer);
+
+	void cascade(int level, int slot);
+	void expire(int slot);
+	void advance(uint64_t tick);
+
+	uint64_t getNextTick() const;
+	int program();
+
+	void onTimerFdEvent();
+
+public:
+	TimerWheel();
+	~TimerWheel();
+
+	int init(EventLoop *loop);
+
+	int arm(Timer *timer);
+	void cancel(Timer *timer);
+};
+
+#endif // !__TIMER_WHEEL_HPP__
@@ -0,0 +1,120 @@
+#include "ssr_priv.hpp"
+
+WorkerPool::WorkerPool()
+{
+	mGeneration = 0;
+	mRemaining = 0;
+	mStop = false;
+	mCb = nullptr;
+	mDedicated = false;
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+int WorkerPool::start(int jobCount)
+{
+	return start(jobCount, false, nullptr);
+}
+
+int WorkerPool::start(int jobCount, bool dedicated, const InitCb &initCb)
+{
+	if (jobCount <= 0)
+		return -EINVAL;
+	else if (!mThreads.empty())
+		return -EPERM;
+
+	// Workers start from generation 0, a previous start() has left it
+	// at its last run
+	mGeneration = 0;
+	mStop = false;
+	mDedicated = dedicated;
+	mInitCb = initCb;
+
+	// Without dedicated threads, job 0 is run by the caller of run()
+	for (int i = dedicated ? 0 : 1; i < jobCount; i++)
+		mThreads.push_back(std::thread(&WorkerPool::workerMain, this, i));
+
+	return 0;
+}
+
+int WorkerPool::stop()
+{
+	if (mThreads.empty())
+		return 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+
+	mStartCond.notify_all();
+
+	for (auto &t : mThreads)
+		t.join();
+
+	mThreads.clear();
+
+	return 0;
+}
+
+void WorkerPool::workerMain(int job)
+{
+	uint64_t generation = 0;
+
+	if (mInitCb)
+		mInitCb();
+
+	while (true) {
+		const JobCb *cb;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			mStartCond.wait(lock, [this, generation] () {
+				return mStop || mGeneration != generation;
+			});
+
+			if (mStop)
+				break;
+
+			generation = mGeneration;
+			cb = mCb;
+		}
+
+		(*cb)(job);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mRemaining--;
+			if (mRemaining == 0)
+				mDoneCond.notify_one();
+		}
+	}
+}
+
+void WorkerPool::run(const JobCb &cb)
+{
+	if (mThreads.empty()) {
+		cb(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCb = &cb;
+		mRemaining = mThreads.size();
+		mGeneration++;
+	}
+
+	mStartCond.notify_all();
+
+	if (!mDedicated)
+		cb(0);
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDoneCond.wait(lock, [this] () { return mRemaining == 0; });
+	mCb = nullptr;
+}
@@ -0,0 +1,47 @@
+#ifndef __WORKER_POOL_HPP__
+#define __WORKER_POOL_HPP__
+
+/**
+ * Fixed set of threads running the same job function in parallel.
+ *
+ * run() calls the job function once per job index, job 0 being executed by
+ * the calling thread, and returns when every job is done. With dedicated
+ * threads, every job has its own thread and the caller only waits.
+ */
+class WorkerPool {
+public:
+	typedef std::function<void(int job)> JobCb;
+
+	// Run by each thread before its first job
+	typedef std::function<void()> InitCb;
+
+private:
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mStartCond;
+	std::condition_variable mDoneCond;
+
+	uint64_t mGeneration;
+	int mRemaining;
+	bool mStop;
+	const JobCb *mCb;
+	bool mDedicated;
+	InitCb mInitCb;
+
+private:
+	void workerMain(int job);
+
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	int start(int jobCount);
+	int start(int jobCount, bool dedicated, const InitCb &initCb);
+	int stop();
+
+	int getJobCount() const { return mThreads.size() + (mDedicated ? 0 : 1); }
+
+	void run(const JobCb &cb);
+};
+
+#endif // !__WORKER_POOL_HPP__
@@ -3,9 +3,37 @@
 
 #include <ssr.hpp>
 
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <regex.h>
+
+#ifdef __x86_64__
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
 #include "ProcFsTools.hpp"
 #include "System.hpp"
+#include "TimeSource.hpp"
+#include "TimerWheel.hpp"
+#include "RawStatsReader.hpp"
+#include "TaskStats.hpp"
+#include "ProcEvents.hpp"
+#include "WorkerPool.hpp"
+#include "ThreadTable.hpp"
+#include "FdBudget.hpp"
+#include "AcqSchedule.hpp"
+#include "IdleThreads.hpp"
+#include "LoadShedding.hpp"
+#include "AdaptiveCadence.hpp"
 #include "ProcessMonitor.hpp"
+#include "ProcessSelector.hpp"
 #include "SysStatsMonitor.hpp"
 
 #endif // !__SSR_PRIV_HPP__
@@ -1,6 +1,7 @@
 #include <limits.h>
 #include <getopt.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/stat.h>
 
 #include <string>
@@ -22,17 +23,45 @@ struct Params {
 	bool help;
 	bool verbose;
 	std::string output;
-	int period;
+	int periodMs;
+	int sysPeriodMs;
 	int duration;
+	int jobs;
+	int fdBudget;
+	int idleThreadsRefreshMs;
+	int budgetMs;
+	int adaptiveMaxPeriodMs;
+	int idleLoad;
+	int rtPriority;
+	int rtCpu;
 	int recordThreads;
+	int useUring;
+	int useTaskStats;
+	int useProcEvents;
+	int useTsc;
+	int tsPerProcess;
 
 	Params()
 	{
 		help = false;
 		verbose = false;
-		period = 1;
+		periodMs = 1000;
+		sysPeriodMs = 0;
 		duration = -1;
+		jobs = 1;
+		fdBudget = 0;
+		idleThreadsRefreshMs = 0;
+		budgetMs = 0;
+		adaptiveMaxPeriodMs = 0;
+		idleLoad = 10;
+		rtPriority = 0;
+		rtCpu = -1;
 		recordThreads = true;
+		useUring = false;
+		useTaskStats = false;
+		useProcEvents = false;
+		useTsc = false;
+		tsPerProcess = false;
 	}
 };
 
@@ -67,6 +96,182 @@ static int readDecimalParam(int *out_v, const char *name)
 	return 0;
 }
 
+// Period in seconds, or in milliseconds with a "ms" suffix
+static int readPeriodParam(int *out_ms, const char *name, const char *arg)
+{
+	char *end;
+	long int v;
+
+	errno = 0;
+	v = strtol(arg, &end, 10);
+	if (v == LONG_MIN || v == LONG_MAX || errno == EINVAL) {
+		int ret = -errno;
+		fprintf(stderr, "Unable to parse '%s' %s : %d(%m)\n",
+			name, arg, errno);
+		return ret;
+	} else if (v <= 0) {
+		fprintf(stderr, "'%s' arg '%s' is negative or null\n",
+			name, arg);
+		return -EINVAL;
+	}
+
+	if (strcmp(end, "ms") == 0) {
+		*out_ms = v;
+	} else if (*end == '\0' || strcmp(end, "s") == 0) {
+		if (v > INT_MAX / 1000) {
+			fprintf(stderr, "'%s' arg '%s' is too big\n",
+				name, arg);
+			return -ERANGE;
+		}
+
+		*out_ms = v * 1000;
+	} else {
+		fprintf(stderr, "'%s' arg '%s' is not a period\n",
+			name, arg);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+// Real-time argument : PRIORITY[,CPU]
+static int readRtParam(int *priority, int *cpu, const char *arg)
+{
+	char *end;
+	long int v;
+
+	errno = 0;
+	v = strtol(arg, &end, 10);
+	if (errno != 0 || end == arg || v < 1 || v > 99) {
+		fprintf(stderr, "'rt' priority '%s' is not in [1, 99]\n", arg);
+		return -EINVAL;
+	}
+
+	*priority = v;
+
+	if (*end == '\0')
+		return 0;
+	else if (*end != ',') {
+		fprintf(stderr, "'rt' arg '%s' is invalid\n", arg);
+		return -EINVAL;
+	}
+
+	arg = end + 1;
+	v = strtol(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || v < 0 ||
+	    v >= CPU_SETSIZE) {
+		fprintf(stderr, "'rt' cpu '%s' is invalid\n", arg);
+		return -EINVAL;
+	}
+
+	*cpu = v;
+
+	return 0;
+}
+
+// Adaptive cadence argument : MAXPERIOD[,IDLE]
+static int readAdaptiveParam(int *maxPeriodMs, int *idleLoad, const char *arg)
+{
+	std::string period;
+	const char *sep;
+	char *end;
+	long int v;
+	int ret;
+
+	sep = strchr(arg, ',');
+	if (!sep)
+		return readPeriodParam(maxPeriodMs, "adaptive", arg);
+
+	period.assign(arg, sep - arg);
+	ret = readPeriodParam(maxPeriodMs, "adaptive", period.c_str());
+	if (ret < 0)
+		return ret;
+
+	arg = sep + 1;
+	errno = 0;
+	v = strtol(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || v < 1 || v > 100) {
+		fprintf(stderr, "'adaptive' idle load '%s' is not in [1, 100]\n",
+			arg);
+		return -EINVAL;
+	}
+
+	*idleLoad = v;
+
+	return 0;
+}
+
+// Process argument :
+// NAME[,period=PERIOD][,threads=0|1][,match=name|glob|regex|cmdline][,all]
+//     [,prio=PRIORITY]
+static int readProcessParam(
+		const char *arg,
+		std::string *name,
+		SystemMonitor::ProcessConfig *config)
+{
+	std::string option;
+	const char *start;
+	const char *end;
+	int ret;
+
+	end = strchr(arg, ',');
+	if (!end) {
+		*name = arg;
+		return 0;
+	}
+
+	name->assign(arg, end - arg);
+
+	while (*end == ',') {
+		start = end + 1;
+		end = strchr(start, ',');
+		if (!end)
+			end = start + strlen(start);
+
+		option.assign(start, end - start);
+
+		if (option.compare(0, 7, "period=") == 0) {
+			ret = readPeriodParam(&config->mAcqPeriodMs,
+					      name->c_str(),
+					      option.c_str() + 7);
+			if (ret < 0)
+				return ret;
+		} else if (option == "threads=0") {
+			config->mRecordThreads = false;
+		} else if (option == "threads=1") {
+			config->mRecordThreads = true;
+		} else if (option == "match=name") {
+			config->mMatch = SystemMonitor::MatchType::name;
+		} else if (option == "match=glob") {
+			config->mMatch = SystemMonitor::MatchType::glob;
+		} else if (option == "match=regex") {
+			config->mMatch = SystemMonitor::MatchType::regex;
+		} else if (option == "match=cmdline") {
+			config->mMatch = SystemMonitor::MatchType::cmdline;
+		} else if (option == "all") {
+			config->mAllInstances = true;
+		} else if (option.compare(0, 5, "prio=") == 0) {
+			char *prioEnd;
+
+			errno = 0;
+			config->mPriority = strtol(option.c_str() + 5,
+						   &prioEnd, 10);
+			if (errno != 0 || *prioEnd != '\0' ||
+			    prioEnd == option.c_str() + 5) {
+				fprintf(stderr, "'%s' invalid priority '%s'\n",
+					name->c_str(), option.c_str() + 5);
+				return -EINVAL;
+			}
+		} else {
+			fprintf(stderr, "'%s' unknown option '%s'\n",
+				name->c_str(), option.c_str());
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 int parseArgs(int argc, char *argv[], Params *params)
 {
 	int optionIndex = 0;
@@ -79,12 +284,24 @@ int parseArgs(int argc, char *argv[], Params *params)
 		{ "period",          optional_argument, 0, 'p' },
 		{ "duration",        optional_argument, 0, 'd' },
 		{ "output",          required_argument, 0, 'o' },
+		{ "jobs",            required_argument, 0, 'j' },
+		{ "sys-period",      required_argument, 0, 's' },
+		{ "fd-budget",       required_argument, 0, 'f' },
+		{ "rt",              required_argument, 0, 'r' },
+		{ "idle-threads",    required_argument, 0, 'i' },
+		{ "budget",          required_argument, 0, 'b' },
+		{ "adaptive",        required_argument, 0, 'a' },
 		{ "disable-threads", optional_argument, &params->recordThreads, 0 },
+		{ "io-uring",        optional_argument, &params->useUring, 1 },
+		{ "taskstats",       optional_argument, &params->useTaskStats, 1 },
+		{ "proc-events",     optional_argument, &params->useProcEvents, 1 },
+		{ "tsc",             optional_argument, &params->useTsc, 1 },
+		{ "ts-per-process",  optional_argument, &params->tsPerProcess, 1 },
 		{ 0, 0, 0, 0 }
 	};
 
 	while (true) {
-		value = getopt_long(argc, argv, "hvo:p:d:", argsOptions, &optionIndex);
+		value = getopt_long(argc, argv, "hvo:p:d:j:", argsOptions, &optionIndex);
 		if (value == -1 || value == '?')
 			break;
 
@@ -108,7 +325,53 @@ int parseArgs(int argc, char *argv[], Params *params)
 			break;
 
 		case 'p':
-			ret = readDecimalParam(&params->period, "period");
+			ret = readPeriodParam(&params->periodMs, "period", optarg);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 's':
+			ret = readPeriodParam(&params->sysPeriodMs, "sys-period", optarg);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'j':
+			ret = readDecimalParam(&params->jobs, "jobs");
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'f':
+			ret = readDecimalParam(&params->fdBudget, "fd-budget");
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'i':
+			ret = readPeriodParam(&params->idleThreadsRefreshMs,
+					      "idle-threads", optarg);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'b':
+			ret = readPeriodParam(&params->budgetMs, "budget",
+					      optarg);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'a':
+			ret = readAdaptiveParam(&params->adaptiveMaxPeriodMs,
+						&params->idleLoad, optarg);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case 'r':
+			ret = readRtParam(&params->rtPriority, &params->rtCpu,
+					  optarg);
 			if (ret < 0)
 				return ret;
 			break;
@@ -123,23 +386,38 @@ int parseArgs(int argc, char *argv[], Params *params)
 
 void printUsage(int argc, char *argv[])
 {
-	printf("Usage  %s [-h] [-p PERIOD] -o OUTPUT [process...]\n",
+	printf("Usage  %s [-h] [-p PERIOD] [-j JOBS] -o OUTPUT [process...]\n",
 	       argv[0]);
 
 	printf("\n");
 
 	printf("positional arguments:\n");
-	printf("  %-20s %s\n", "process", "Process name to monitor");
+	printf("  %-20s %s\n", "process", "Process name to monitor, with optional settings :");
+	printf("  %-20s %s\n", "", "NAME[,period=PERIOD][,threads=0|1][,match=name|glob|regex|cmdline][,all][,prio=PRIORITY]");
+	printf("  %-20s %s\n", "", "'all' monitors every matching process instead of the first one");
+	printf("  %-20s %s\n", "", "'prio' processes of the lowest priorities are the first ones shed, see --budget. Default : 0");
 
 	printf("\n");
 
 	printf("optional arguments:\n");
 	printf("  %-20s %s\n", "-h, --help", "show this help message and exit");
 	printf("  %-20s %s\n", "-v, --verbose", "add extra logs");
-	printf("  %-20s %s\n", "-p, --period", "sample acquisition period (seconds). Default : 1");
+	printf("  %-20s %s\n", "-p, --period", "sample acquisition period (seconds, or milliseconds with a 'ms' suffix). Default : 1");
+	printf("  %-20s %s\n", "--sys-period", "system stats acquisition period. Default : same as --period");
 	printf("  %-20s %s\n", "-d, --duration", "acquisition duration (seconds). Default : infinite");
 	printf("  %-20s %s\n", "-o, --output", "output record file");
+	printf("  %-20s %s\n", "-j, --jobs", "acquisition threads. Default : 1");
 	printf("  %-20s %s\n", "--disable-threads", "disable threads recording");
+	printf("  %-20s %s\n", "--fd-budget", "thread stat fds kept open, other threads are reopened at each acquisition. Default : unlimited");
+	printf("  %-20s %s\n", "--idle-threads", "PERIOD : skip thread reads of processes whose CPU time is unchanged, read them all at least every PERIOD (same units as --period). Default : always read");
+	printf("  %-20s %s\n", "--budget", "acquisition duration above which threads, then low priority processes, then the period are degraded. Default : none");
+	printf("  %-20s %s\n", "--adaptive", "MAXPERIOD[,IDLE] : double the period up to MAXPERIOD while the cpu load is under IDLE percent, back to --period on load or PSI rise. Default IDLE : 10");
+	printf("  %-20s %s\n", "--rt", "PRIORITY[,CPU] : read with dedicated SCHED_FIFO threads, bound to CPU, and lock memory");
+	printf("  %-20s %s\n", "--io-uring", "batch procfs reads with io_uring (fallback to pread)");
+	printf("  %-20s %s\n", "--taskstats", "read threads stats with netlink taskstats (fallback to procfs)");
+	printf("  %-20s %s\n", "--proc-events", "discover processes and threads with proc events (fallback to /proc scans)");
+	printf("  %-20s %s\n", "--tsc", "timestamp reads with the invariant TSC (fallback to clock_gettime)");
+	printf("  %-20s %s\n", "--ts-per-process", "timestamp the reads of a process and its threads once");
 }
 
 static void sighandler(int s)
@@ -184,6 +462,18 @@ static void systemStatsCb(
 		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
 }
 
+static void cpuStatsCb(
+		const SystemMonitor::CpuStats &stats,
+		void *userdata)
+{
+	SystemRecorder *recorder = (SystemRecorder *) userdata;
+	int ret;
+
+	ret = recorder->record(stats);
+	if (ret < 0)
+		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
+}
+
 static void processStatsCb(
 		const SystemMonitor::ProcessStats &stats,
 		void *userdata)
@@ -208,6 +498,42 @@ static void threadStatsCb(
 		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
 }
 
+static void processExitCb(
+		const SystemMonitor::ProcessExit &stats,
+		void *userdata)
+{
+	SystemRecorder *recorder = (SystemRecorder *) userdata;
+	int ret;
+
+	ret = recorder->record(stats);
+	if (ret < 0)
+		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
+}
+
+static void sheddingCb(
+		const SystemMonitor::SheddingStep &step,
+		void *userdata)
+{
+	SystemRecorder *recorder = (SystemRecorder *) userdata;
+	int ret;
+
+	ret = recorder->record(step);
+	if (ret < 0)
+		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
+}
+
+static void cadenceCb(
+		const SystemMonitor::CadenceChange &change,
+		void *userdata)
+{
+	SystemRecorder *recorder = (SystemRecorder *) userdata;
+	int ret;
+
+	ret = recorder->record(change);
+	if (ret < 0)
+		LOGE("record() failed : %d(%s)", -ret, strerror(-ret));
+}
+
 static void resultsBeginCb(
 		const SystemMonitor::AcquisitionDuration &stats,
 		void *userdata)
@@ -324,13 +650,39 @@ int main(int argc, char *argv[])
 
 	// Create monitor
 	cb.mSystemStats = systemStatsCb;
+	cb.mCpuStats = cpuStatsCb;
 	cb.mProcessStats = processStatsCb;
 	cb.mThreadStats = threadStatsCb;
+	cb.mProcessExit = processExitCb;
+	cb.mShedding = sheddingCb;
+	cb.mCadence = cadenceCb;
 	cb.mResultsBegin = resultsBeginCb;
 	cb.mUserdata = recorder;
 
 	monConfig.mRecordThreads = params.recordThreads;
-	monConfig.mAcqPeriod = params.period;
+	monConfig.mAcqPeriodMs = params.periodMs;
+	monConfig.mSysStatsPeriodMs = params.sysPeriodMs;
+	monConfig.mJobs = params.jobs;
+	monConfig.mThreadFdBudget = params.fdBudget;
+	monConfig.mIdleThreadsRefreshMs = params.idleThreadsRefreshMs;
+	monConfig.mAcqBudgetMs = params.budgetMs;
+	monConfig.mAdaptiveMaxPeriodMs = params.adaptiveMaxPeriodMs;
+	monConfig.mIdleLoad = params.idleLoad;
+	monConfig.mRtPriority = params.rtPriority;
+	monConfig.mRtCpu = params.rtCpu;
+	monConfig.mProcEvents = params.useProcEvents;
+
+	if (params.useUring)
+		monConfig.mReadBackend = SystemMonitor::ReadBackend::uring;
+
+	if (params.useTaskStats)
+		monConfig.mStatsBackend = SystemMonitor::StatsBackend::taskstats;
+
+	if (params.useTsc)
+		monConfig.mClockSource = SystemMonitor::ClockSource::tsc;
+
+	if (params.tsPerProcess)
+		monConfig.mTsGranularity = SystemMonitor::TimestampGranularity::process;
 
 	ret = SystemMonitor::create(&ctx.loop, monConfig, cb, &mon);
 	if (ret < 0)
@@ -338,7 +690,16 @@ int main(int argc, char *argv[])
 
 	if (!recordAllProcesses) {
 		for (int i = optind; i < argc; i++) {
-			ret = mon->addProcess(argv[i]);
+			SystemMonitor::ProcessConfig procConfig;
+			std::string name;
+
+			procConfig.mRecordThreads = params.recordThreads;
+
+			ret = readProcessParam(argv[i], &name, &procConfig);
+			if (ret < 0)
+				goto error;
+
+			ret = mon->addProcess(name.c_str(), procConfig);
 			if (ret < 0) {
 				LOGE("addProcessFailed() : %d(%s)",
 				       -ret, strerror(-ret));
@@ -0,0 +1,246 @@
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Adaptive cadence switching by AdaptiveCadence, and the AcqSchedule ratios
+ * of the collectors, which follow the default period it sets without losing
+ * their phase.
+ */
+
+#define BASE_MS 100
+#define MAX_MS 1000
+#define IDLE_LOAD 10 // percent
+
+// Cpu loads, per mille
+#define IDLE (IDLE_LOAD * 10 - 1)
+#define BUSY (IDLE_LOAD * 10)
+
+namespace {
+
+typedef SystemMonitor::CadenceReason CadenceReason;
+
+// Period after the given load, 0 if unchanged
+int feed(AdaptiveCadence *cadence, int *periodMs, int load,
+	 CadenceReason *reason)
+{
+	int ret;
+
+	ret = cadence->update(*periodMs, load, IDLE_LOAD, MAX_MS, reason);
+	if (ret > 0)
+		*periodMs = ret;
+
+	return ret;
+}
+
+// Idle stats until the period changes, count of stats fed
+int feedIdle(AdaptiveCadence *cadence, int *periodMs, CadenceReason *reason)
+{
+	for (int i = 1; i <= 2 * CADENCE_IDLE_COUNT; i++) {
+		if (feed(cadence, periodMs, IDLE, reason) > 0)
+			return i;
+	}
+
+	return 0;
+}
+
+void checkSlowDown()
+{
+	const int periods[] = { 200, 400, 800, MAX_MS };
+	AdaptiveCadence cadence;
+	CadenceReason reason;
+	int periodMs = BASE_MS;
+
+	cadence.reset(BASE_MS);
+	CHECK_EQ(cadence.getBasePeriodMs(), BASE_MS);
+
+	// Doubled every CADENCE_IDLE_COUNT idle stats, the last step is
+	// clamped to the max
+	for (auto expected : periods) {
+		reason = CadenceReason::load;
+		CHECK_EQ(feedIdle(&cadence, &periodMs, &reason),
+			 CADENCE_IDLE_COUNT);
+		CHECK_EQ(periodMs, expected);
+		CHECK(reason == CadenceReason::idle);
+	}
+
+	// Not above the max
+	CHECK_EQ(feedIdle(&cadence, &periodMs, &reason), 0);
+	CHECK_EQ(periodMs, MAX_MS);
+
+	// Back to the base period at once, the threshold load is not idle
+	CHECK_EQ(feed(&cadence, &periodMs, BUSY, &reason), BASE_MS);
+	CHECK(reason == CadenceReason::load);
+
+	// Already at full rate
+	CHECK_EQ(feed(&cadence, &periodMs, 1000, &reason), 0);
+	CHECK_EQ(periodMs, BASE_MS);
+}
+
+void checkIdleCount()
+{
+	AdaptiveCadence cadence;
+	CadenceReason reason;
+	int periodMs = BASE_MS;
+
+	cadence.reset(BASE_MS);
+
+	// Only idle stats in a row count
+	for (int i = 0; i < CADENCE_IDLE_COUNT - 1; i++)
+		CHECK_EQ(feed(&cadence, &periodMs, IDLE, &reason), 0);
+
+	CHECK_EQ(feed(&cadence, &periodMs, BUSY, &reason), 0);
+
+	for (int i = 0; i < CADENCE_IDLE_COUNT - 1; i++)
+		CHECK_EQ(feed(&cadence, &periodMs, IDLE, &reason), 0);
+
+	// So does a PSI trigger, which keeps the base period
+	CHECK_EQ(cadence.onPressure(periodMs), 0);
+	CHECK_EQ(feedIdle(&cadence, &periodMs, &reason), CADENCE_IDLE_COUNT);
+	CHECK_EQ(periodMs, 2 * BASE_MS);
+
+	// A PSI trigger restores the base period
+	CHECK_EQ(cadence.onPressure(periodMs), BASE_MS);
+}
+
+void checkReset()
+{
+	AdaptiveCadence cadence;
+	CadenceReason reason;
+	int periodMs = BASE_MS;
+
+	cadence.reset(BASE_MS);
+	CHECK_EQ(feedIdle(&cadence, &periodMs, &reason), CADENCE_IDLE_COUNT);
+	CHECK_EQ(periodMs, 2 * BASE_MS);
+
+	// A new requested period clears the idle count too
+	for (int i = 0; i < CADENCE_IDLE_COUNT - 1; i++)
+		CHECK_EQ(feed(&cadence, &periodMs, IDLE, &reason), 0);
+
+	cadence.reset(300);
+	periodMs = 300;
+	CHECK_EQ(feedIdle(&cadence, &periodMs, &reason), CADENCE_IDLE_COUNT);
+	CHECK_EQ(periodMs, 600);
+	CHECK_EQ(feedIdle(&cadence, &periodMs, &reason), CADENCE_IDLE_COUNT);
+	CHECK_EQ(periodMs, MAX_MS);
+
+	CHECK_EQ(feed(&cadence, &periodMs, BUSY, &reason), 300);
+}
+
+// Ticks on which a schedule is due, out of tickCount
+std::vector<uint64_t> dueTicks(AcqSchedule *schedule, uint64_t firstTick,
+			       int tickCount, int tickMs, int defaultPeriodMs)
+{
+	std::vector<uint64_t> ticks;
+
+	for (uint64_t tick = firstTick; tick < firstTick + tickCount; tick++) {
+		if (schedule->update(tick, tickMs, defaultPeriodMs))
+			ticks.push_back(tick);
+	}
+
+	return ticks;
+}
+
+void checkSchedules()
+{
+	AcqSchedule fixed;
+	AcqSchedule byDefault;
+	std::vector<uint64_t> ticks;
+
+	fixed.mPeriodMs = 300;
+	CHECK_EQ(fixed.getPeriodMs(BASE_MS), 300);
+	CHECK_EQ(byDefault.getPeriodMs(BASE_MS), BASE_MS);
+
+	// First update is due, then the multiples of the ratio
+	ticks = dueTicks(&fixed, 1001, 10, BASE_MS, BASE_MS);
+	CHECK_EQ(ticks.size(), 4);
+	if (ticks.size() == 4) {
+		CHECK_EQ(ticks[0], 1001);
+		CHECK_EQ(ticks[1], 1002);
+		CHECK_EQ(ticks[2], 1005);
+		CHECK_EQ(ticks[3], 1008);
+	}
+
+	ticks = dueTicks(&byDefault, 1000, 10, BASE_MS, BASE_MS);
+	CHECK_EQ(ticks.size(), 10);
+
+	// The cadence doubles the default period : collectors using it
+	// follow, the others keep their ratio
+	byDefault.reset();
+	ticks = dueTicks(&byDefault, 1010, 10, BASE_MS, 2 * BASE_MS);
+	CHECK_EQ(ticks.size(), 5);
+	for (auto tick : ticks)
+		CHECK_EQ(tick % 2, 0);
+
+	ticks = dueTicks(&fixed, 1011, 9, BASE_MS, 2 * BASE_MS);
+	CHECK_EQ(ticks.size(), 3);
+
+	// Missed ticks : due on the next one, then aligned again
+	CHECK(fixed.update(1027, BASE_MS, BASE_MS));
+	CHECK_EQ(fixed.mNextTick, 1029);
+	CHECK(!fixed.update(1028, BASE_MS, BASE_MS));
+	CHECK(fixed.update(1029, BASE_MS, BASE_MS));
+
+	// A longer tick gives a lower ratio
+	fixed.reset();
+	ticks = dueTicks(&fixed, 330, 6, 150, BASE_MS);
+	CHECK_EQ(ticks.size(), 3);
+	for (auto tick : ticks)
+		CHECK_EQ(tick % 2, 0);
+}
+
+// Period changes keep the next reads instead of reading everything again
+void checkRescale()
+{
+	AcqSchedule fixed;
+	AcqSchedule byDefault;
+	uint64_t nowMs;
+
+	fixed.mPeriodMs = 300;
+
+	// Tick 1000 : due on multiples of 3 and 4 ticks of BASE_MS
+	CHECK(fixed.update(1000, BASE_MS, 4 * BASE_MS));
+	CHECK(byDefault.update(1000, BASE_MS, 4 * BASE_MS));
+	CHECK_EQ(fixed.mNextTick, 1002);
+	CHECK_EQ(byDefault.mNextTick, 1004);
+
+	// Default period halved, same tick : the fixed period is kept, the
+	// default one is moved to the next multiple of 2 ticks
+	nowMs = 1000 * BASE_MS;
+	fixed.rescale(nowMs, BASE_MS, BASE_MS, 2 * BASE_MS);
+	byDefault.rescale(nowMs, BASE_MS, BASE_MS, 2 * BASE_MS);
+	CHECK_EQ(fixed.mNextTick, 1002);
+	CHECK_EQ(byDefault.mNextTick, 1002);
+	CHECK(!byDefault.update(1001, BASE_MS, 2 * BASE_MS));
+	CHECK(byDefault.update(1002, BASE_MS, 2 * BASE_MS));
+
+	// Default period quadrupled, with a tick of the same length : the
+	// next read is kept, in the new tick unit
+	byDefault.reset();
+	CHECK(byDefault.update(1000, BASE_MS, BASE_MS));
+	CHECK_EQ(byDefault.mNextTick, 1001);
+
+	byDefault.rescale(nowMs, BASE_MS, 4 * BASE_MS, 4 * BASE_MS);
+	CHECK_EQ(byDefault.mNextTick, 251);
+	CHECK(!byDefault.update(250, 4 * BASE_MS, 4 * BASE_MS));
+	CHECK(byDefault.update(251, 4 * BASE_MS, 4 * BASE_MS));
+	CHECK_EQ(byDefault.mNextTick, 252);
+
+	// Not read yet : still due at once
+	AcqSchedule fresh;
+
+	fresh.rescale(nowMs, BASE_MS, 4 * BASE_MS, 4 * BASE_MS);
+	CHECK_EQ(fresh.mNextTick, 0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkSlowDown();
+	checkIdleCount();
+	checkReset();
+	checkSchedules();
+	checkRescale();
+
+	return testResult("cadence");
+}
@@ -0,0 +1,285 @@
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include "ssr_priv.hpp"
+
+/**
+ * EventLoop registration and dispatch cost with thousands of fds : the
+ * slab dispatched through epoll data.ptr, against the previous loop which
+ * found each fd in a list and fetched 8 events per epoll_wait().
+ *
+ * Each round makes READY_COUNT random eventfds readable, then waits until
+ * every callback has run. Fds are removed from the last added one, which
+ * the list only finds at its end.
+ *
+ * Usage : eventloop_bench [ROUNDS]
+ */
+
+#define DEFAULT_ROUNDS 200
+#define READY_COUNT 64
+
+namespace {
+
+// Previous EventLoop, without its stop fd
+class ListEventLoop {
+private:
+	struct InternalFd {
+		int mFd;
+		EventLoopCb mCb;
+	};
+
+private:
+	int mEpollFd;
+	std::list<InternalFd> mFdList;
+
+private:
+	int findInternalFd(int fd, std::list<InternalFd>::iterator *internalFd)
+	{
+		for (auto i = mFdList.begin(); i != mFdList.end(); i++) {
+			if (i->mFd == fd) {
+				*internalFd = i;
+				return 0;
+			}
+		}
+
+		return -ENOENT;
+	}
+
+public:
+	ListEventLoop()
+	{
+		mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	}
+
+	~ListEventLoop()
+	{
+		close(mEpollFd);
+	}
+
+	int wait(int timeout)
+	{
+		std::list<InternalFd>::iterator internalFd;
+		struct epoll_event events[8];
+		int ret;
+
+		ret = epoll_wait(mEpollFd, events, SIZEOF_ARRAY(events), timeout);
+		if (ret < 0)
+			return -errno;
+
+		for (int i = 0; i < ret; i++) {
+			if (findInternalFd(events[i].data.fd, &internalFd) < 0)
+				continue;
+
+			internalFd->mCb(events[i].data.fd, events[i].events);
+		}
+
+		return 0;
+	}
+
+	int addFd(int op, int fd, EventLoopCb cb)
+	{
+		std::list<InternalFd>::iterator internalFd;
+		struct epoll_event evt;
+
+		if (findInternalFd(fd, &internalFd) == 0)
+			return -EPERM;
+
+		memset(&evt, 0, sizeof(evt));
+		evt.events = op;
+		evt.data.fd = fd;
+
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &evt) < 0)
+			return -errno;
+
+		mFdList.push_back({ fd, cb });
+
+		return 0;
+	}
+
+	int delFd(int fd)
+	{
+		std::list<InternalFd>::iterator internalFd;
+
+		if (findInternalFd(fd, &internalFd) < 0)
+			return -EPERM;
+
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL) < 0)
+			return -errno;
+
+		mFdList.erase(internalFd);
+
+		return 0;
+	}
+};
+
+struct Result {
+	double mAddNs; // per fd
+	double mDispatchNs; // per event
+	double mDelNs; // per fd
+
+	Result()
+	{
+		mAddNs = 0;
+		mDispatchNs = 0;
+		mDelNs = 0;
+	}
+};
+
+uint64_t nowNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template <typename Loop>
+int runBench(Loop *loop,
+	     const std::vector<int> &fds,
+	     const std::vector<int> &ready,
+	     int readyCount,
+	     int rounds,
+	     Result *result)
+{
+	int dispatched = 0;
+	uint64_t value = 1;
+	uint64_t start;
+	uint64_t dispatchNs = 0;
+	int ret;
+
+	auto cb = [&dispatched] (int fd, int evt) {
+		uint64_t v;
+
+		if (read(fd, &v, sizeof(v)) == sizeof(v))
+			dispatched++;
+	};
+
+	start = nowNs();
+	for (auto fd : fds) {
+		ret = loop->addFd(EPOLLIN, fd, cb);
+		if (ret < 0)
+			return ret;
+	}
+	result->mAddNs = (double) (nowNs() - start) / fds.size();
+
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < readyCount; i++) {
+			int fd = fds[ready[round * readyCount + i]];
+
+			if (write(fd, &value, sizeof(value)) != sizeof(value))
+				return -errno;
+		}
+
+		dispatched = 0;
+		start = nowNs();
+		while (dispatched < readyCount) {
+			ret = loop->wait(-1);
+			if (ret < 0)
+				return ret;
+		}
+		dispatchNs += nowNs() - start;
+	}
+	result->mDispatchNs = (double) dispatchNs / rounds / readyCount;
+
+	start = nowNs();
+	for (auto fd = fds.rbegin(); fd != fds.rend(); fd++)
+		loop->delFd(*fd);
+	result->mDelNs = (double) (nowNs() - start) / fds.size();
+
+	return 0;
+}
+
+void raiseFdLimit()
+{
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+		return;
+
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	const int fdCounts[] = { 16, 1000, 4000, 16000 };
+	int rounds = DEFAULT_ROUNDS;
+	Result listResult;
+	Result slabResult;
+	int ret;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+
+	raiseFdLimit();
+	srand(42);
+
+	printf("%8s %26s %26s %26s\n", "fds", "add ns/fd (list/slab)",
+	       "dispatch ns/evt", "del ns/fd");
+
+	for (auto count : fdCounts) {
+		std::vector<int> fds;
+		std::vector<int> ready;
+		int readyCount = std::min(READY_COUNT, count);
+
+		for (int i = 0; i < count; i++) {
+			int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			if (fd < 0) {
+				fprintf(stderr, "eventfd : %d(%m), %d fds\n",
+					errno, i);
+				break;
+			}
+
+			fds.push_back(fd);
+		}
+
+		if ((int) fds.size() != count) {
+			for (auto fd : fds)
+				close(fd);
+
+			continue;
+		}
+
+		// Same ready fds for both loops, spread over the whole set
+		// without duplicates in a round
+		for (int round = 0; round < rounds; round++) {
+			int first = rand() % count;
+
+			for (int i = 0; i < readyCount; i++)
+				ready.push_back((first + i * (count / readyCount)) % count);
+		}
+
+		ListEventLoop listLoop;
+		ret = runBench(&listLoop, fds, ready, readyCount, rounds, &listResult);
+		if (ret < 0) {
+			fprintf(stderr, "list loop : %d(%s)\n", -ret, strerror(-ret));
+			return 1;
+		}
+
+		EventLoop loop;
+		ret = loop.init();
+		if (ret < 0)
+			return 1;
+
+		ret = runBench(&loop, fds, ready, readyCount, rounds, &slabResult);
+		if (ret < 0) {
+			fprintf(stderr, "slab loop : %d(%s)\n", -ret, strerror(-ret));
+			return 1;
+		}
+
+		printf("%8d %12.0f / %-11.0f %12.0f / %-11.0f %12.0f / %-11.0f\n",
+		       count,
+		       listResult.mAddNs, slabResult.mAddNs,
+		       listResult.mDispatchNs, slabResult.mDispatchNs,
+		       listResult.mDelNs, slabResult.mDelNs);
+
+		for (auto fd : fds)
+			close(fd);
+	}
+
+	return 0;
+}
@@ -0,0 +1,304 @@
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Thread fd budget : FdBudget accounting, then a child with more threads
+ * than the budget. The threads over the budget are opened at each
+ * acquisition and closed once it is processed, the fds of the test
+ * process must not grow, and must be back to their initial count once the
+ * child has exited.
+ */
+
+#define CHILD_NAME "ssr_fds_test"
+#define CHILD_THREAD_COUNT 8
+
+#define FD_BUDGET 3
+
+#define ACQ_PERIOD_MS 50
+#define RUN_MS 600
+#define EXIT_TIMEOUT_MS 2000
+
+namespace {
+
+void checkAccounting()
+{
+	FdBudget budget;
+
+	// Unlimited by default
+	CHECK(!budget.isLimited());
+	for (int i = 0; i < 10; i++)
+		CHECK(budget.acquire());
+
+	CHECK_EQ(budget.getUsed(), 10);
+	for (int i = 0; i < 10; i++)
+		budget.release();
+
+	budget.setMax(2);
+	CHECK(budget.isLimited());
+	CHECK(budget.acquire());
+	CHECK(budget.acquire());
+	CHECK(!budget.acquire());
+	CHECK_EQ(budget.getUsed(), 2);
+
+	// A released slot is taken again
+	budget.release();
+	CHECK(budget.acquire());
+	CHECK(!budget.acquire());
+}
+
+int countFds()
+{
+	struct dirent *entry;
+	int count = 0;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir)) != nullptr) {
+		if (entry->d_name[0] != '.')
+			count++;
+	}
+
+	closedir(dir);
+
+	// The directory fd itself
+	return count - 1;
+}
+
+pid_t startChild()
+{
+	int fds[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		prctl(PR_SET_NAME, CHILD_NAME);
+
+		for (int i = 0; i < CHILD_THREAD_COUNT; i++) {
+			std::thread([] () {
+				while (true)
+					pause();
+			}).detach();
+		}
+
+		if (write(fds[1], &c, 1) != 1)
+			_exit(1);
+
+		while (true)
+			pause();
+	}
+
+	close(fds[1]);
+	if (pid > 0 && read(fds[0], &c, 1) != 1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+
+	close(fds[0]);
+
+	return pid;
+}
+
+struct TestCtx {
+	pid_t mChild;
+	int mThreadReads;
+	int mExitCount;
+
+	// After the child has been found
+	int mAcqCount;
+	uint32_t mMaxThreadFds;
+	uint32_t mMinReopens;
+	int mMinFds;
+	int mMaxFds;
+
+	// Once its exit has been handled
+	int mExitFds;
+
+	TestCtx()
+	{
+		mChild = -1;
+		mThreadReads = 0;
+		mExitCount = 0;
+		mAcqCount = 0;
+		mMaxThreadFds = 0;
+		mMinReopens = UINT32_MAX;
+		mMinFds = INT_MAX;
+		mMaxFds = 0;
+		mExitFds = -1;
+	}
+};
+
+void threadStatsCb(const SystemMonitor::ThreadStats &stats, void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+
+	if ((pid_t) stats.mPid == ctx->mChild)
+		ctx->mThreadReads++;
+}
+
+void processExitCb(const SystemMonitor::ProcessExit &exit, void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+
+	if ((pid_t) exit.mPid == ctx->mChild)
+		ctx->mExitCount++;
+}
+
+void resultsBeginCb(const SystemMonitor::AcquisitionDuration &stats,
+		    void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+
+	if (ctx->mThreadReads == 0 || ctx->mExitCount > 0)
+		return;
+
+	ctx->mMaxThreadFds = std::max(ctx->mMaxThreadFds, stats.mThreadFdCount);
+	ctx->mMinReopens = std::min(ctx->mMinReopens, stats.mReopenCount);
+}
+
+// Once the stats have been processed
+void resultsEndCb(void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+	int fds;
+
+	fds = countFds();
+	if (ctx->mExitCount > 0) {
+		ctx->mExitFds = fds;
+		return;
+	} else if (ctx->mThreadReads == 0) {
+		return;
+	}
+
+	ctx->mAcqCount++;
+	ctx->mMinFds = std::min(ctx->mMinFds, fds);
+	ctx->mMaxFds = std::max(ctx->mMaxFds, fds);
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void checkMonitor()
+{
+	SystemMonitor::ProcessConfig procConfig;
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	EventLoop loop;
+	TestCtx ctx;
+	uint64_t deadline;
+	int initialFds;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	ctx.mChild = startChild();
+	CHECK(ctx.mChild > 0);
+	if (ctx.mChild < 0)
+		return;
+
+	cb.mThreadStats = threadStatsCb;
+	cb.mProcessExit = processExitCb;
+	cb.mResultsBegin = resultsBeginCb;
+	cb.mResultsEnd = resultsEndCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mThreadFdBudget = FD_BUDGET;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	initialFds = countFds();
+
+	procConfig.mRecordThreads = true;
+	CHECK_EQ(mon->addProcess(CHILD_NAME, procConfig), 0);
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	deadline = nowMs() + RUN_MS;
+	while (nowMs() < deadline)
+		loop.wait(ACQ_PERIOD_MS);
+
+	// Main thread and CHILD_THREAD_COUNT threads, FD_BUDGET kept open
+	CHECK(ctx.mAcqCount > 2);
+	CHECK_EQ(ctx.mMaxThreadFds, FD_BUDGET);
+	CHECK_EQ(ctx.mMinReopens, CHILD_THREAD_COUNT + 1 - FD_BUDGET);
+
+	// The reopened threads are closed by each acquisition
+	CHECK_EQ(ctx.mMaxFds, ctx.mMinFds);
+
+	// Reaped at once : the reads of the next acquisition may fail
+	// before the pidfd is handled
+	kill(ctx.mChild, SIGKILL);
+	waitpid(ctx.mChild, nullptr, 0);
+
+	deadline = nowMs() + EXIT_TIMEOUT_MS;
+	while (ctx.mExitCount == 0 && nowMs() < deadline)
+		loop.wait(ACQ_PERIOD_MS);
+
+	// Some more acquisitions without the child
+	deadline = nowMs() + 4 * ACQ_PERIOD_MS;
+	while (nowMs() < deadline)
+		loop.wait(ACQ_PERIOD_MS);
+
+	mon->stop();
+
+	// Only the stat, pidfd and task directory of the child, and its
+	// kept threads were open
+	CHECK_EQ(ctx.mExitCount, 1);
+	CHECK_EQ(ctx.mMaxFds - ctx.mExitFds, 3 + FD_BUDGET);
+	ctx.mChild = -1;
+
+	delete mon;
+	mon = nullptr;
+	CHECK_EQ(countFds(), initialFds);
+
+out:
+	delete mon;
+
+	if (ctx.mChild > 0) {
+		kill(ctx.mChild, SIGKILL);
+		waitpid(ctx.mChild, nullptr, 0);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkAccounting();
+	checkMonitor();
+
+	return testResult("fdbudget");
+}
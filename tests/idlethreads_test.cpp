@@ -0,0 +1,235 @@
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Idle threads skipping : the decision of IdleThreads, then the thread
+ * reads of an idle and of a busy child monitored with
+ * Config::mIdleThreadsRefreshMs.
+ */
+
+#define MS 1000000ULL
+
+#define IDLE_CHILD_NAME "ssr_idle_test"
+#define BUSY_CHILD_NAME "ssr_busy_test"
+#define CHILD_THREAD_COUNT 4
+
+#define ACQ_PERIOD_MS 50
+#define REFRESH_MS 400
+#define RUN_MS 1000
+
+namespace {
+
+void checkDecision()
+{
+	IdleThreads idle;
+
+	// Threads never read
+	CHECK(idle.update(100, 1000 * MS, REFRESH_MS));
+	CHECK_EQ(idle.mCpuTime, 100);
+	CHECK_EQ(idle.mTs, 1000 * MS);
+
+	// Unchanged CPU time, before the refresh period
+	CHECK(!idle.update(100, 1050 * MS, REFRESH_MS));
+	CHECK(!idle.update(100, 1000 * MS + REFRESH_MS * MS - 1, REFRESH_MS));
+	CHECK_EQ(idle.mTs, 1000 * MS);
+
+	// Refresh period reached
+	CHECK(idle.update(100, 1000 * MS + REFRESH_MS * MS, REFRESH_MS));
+	CHECK_EQ(idle.mTs, 1400 * MS);
+
+	// CPU time changed
+	CHECK(idle.update(101, 1450 * MS, REFRESH_MS));
+	CHECK_EQ(idle.mCpuTime, 101);
+	CHECK_EQ(idle.mTs, 1450 * MS);
+	CHECK(!idle.update(101, 1500 * MS, REFRESH_MS));
+
+	// Without refresh period, threads are always read
+	CHECK(idle.update(101, 1550 * MS, 0));
+	CHECK(idle.update(101, 1550 * MS, 0));
+
+	// A timestamp before the last read doesn't skip
+	CHECK(idle.update(101, 1500 * MS, REFRESH_MS));
+}
+
+// Child with threads, which spin or sleep
+pid_t startChild(const char *name, bool busy)
+{
+	int fds[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		prctl(PR_SET_NAME, name);
+
+		for (int i = 0; i < CHILD_THREAD_COUNT; i++) {
+			std::thread([busy] () {
+				volatile uint64_t v = 0;
+
+				while (busy)
+					v++;
+
+				while (true)
+					pause();
+			}).detach();
+		}
+
+		if (write(fds[1], &c, 1) != 1)
+			_exit(1);
+
+		while (true)
+			pause();
+	}
+
+	close(fds[1]);
+	if (pid > 0 && read(fds[0], &c, 1) != 1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+
+	close(fds[0]);
+
+	return pid;
+}
+
+struct MonitorCtx {
+	pid_t mIdlePid;
+	pid_t mBusyPid;
+	int mAcqCount;
+	int mIdleThreadReads;
+	int mBusyThreadReads;
+	uint32_t mSkippedReads;
+
+	MonitorCtx()
+	{
+		mIdlePid = -1;
+		mBusyPid = -1;
+		mAcqCount = 0;
+		mIdleThreadReads = 0;
+		mBusyThreadReads = 0;
+		mSkippedReads = 0;
+	}
+};
+
+void threadStatsCb(const SystemMonitor::ThreadStats &stats, void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	if ((pid_t) stats.mPid == ctx->mIdlePid)
+		ctx->mIdleThreadReads++;
+	else if ((pid_t) stats.mPid == ctx->mBusyPid)
+		ctx->mBusyThreadReads++;
+}
+
+void resultsBeginCb(const SystemMonitor::AcquisitionDuration &stats,
+		    void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	ctx->mAcqCount++;
+	ctx->mSkippedReads += stats.mSkippedReads;
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void checkMonitor()
+{
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	EventLoop loop;
+	MonitorCtx ctx;
+	uint64_t deadline;
+	int refreshes;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	ctx.mIdlePid = startChild(IDLE_CHILD_NAME, false);
+	ctx.mBusyPid = startChild(BUSY_CHILD_NAME, true);
+	CHECK(ctx.mIdlePid > 0);
+	CHECK(ctx.mBusyPid > 0);
+	if (ctx.mIdlePid < 0 || ctx.mBusyPid < 0)
+		goto out;
+
+	cb.mThreadStats = threadStatsCb;
+	cb.mResultsBegin = resultsBeginCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mIdleThreadsRefreshMs = REFRESH_MS;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	CHECK_EQ(mon->addProcess(IDLE_CHILD_NAME), 0);
+	CHECK_EQ(mon->addProcess(BUSY_CHILD_NAME), 0);
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	deadline = nowMs() + RUN_MS;
+	while (nowMs() < deadline)
+		loop.wait(ACQ_PERIOD_MS);
+
+	mon->stop();
+
+	CHECK(ctx.mAcqCount > 2 * RUN_MS / REFRESH_MS);
+
+	// Busy threads are read at each acquisition, once found
+	CHECK(ctx.mBusyThreadReads >= (ctx.mAcqCount - 2) * CHILD_THREAD_COUNT);
+
+	// Idle threads only by refreshes, the first read included. Each one
+	// reads the main thread and its CHILD_THREAD_COUNT threads.
+	refreshes = RUN_MS / REFRESH_MS + 1;
+	CHECK(ctx.mIdleThreadReads > 0);
+	CHECK(ctx.mIdleThreadReads <=
+	      (refreshes + 1) * (CHILD_THREAD_COUNT + 1));
+	CHECK(ctx.mSkippedReads > 0);
+
+out:
+	delete mon;
+
+	for (auto pid : { ctx.mIdlePid, ctx.mBusyPid }) {
+		if (pid <= 0)
+			continue;
+
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkDecision();
+	checkMonitor();
+
+	return testResult("idlethreads");
+}
@@ -0,0 +1,213 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "ssr_priv.hpp"
+
+/**
+ * Pid directory walk cost : opendir()/readdir() with strtol() on every
+ * name (the previous path), against the getdents64 walk of
+ * pfstools::iteratePidDir(), which skips non directory entries unparsed.
+ *
+ * Walks are done on /proc, on a directory with DIR_ENTRY_COUNT numeric
+ * entries, and on /proc with a walk of each task directory run from the
+ * callback, as the discovery does when it attaches processes. Both paths
+ * must find the same entries, nested walk included.
+ *
+ * Usage : piddir_bench [ITERATIONS]
+ */
+
+#define DEFAULT_ITERATIONS 200
+#define DIR_ENTRY_COUNT 10000
+
+namespace {
+
+typedef int (*WalkFunc)(const char *path, pfstools::PidFoundCb cb, void *userdata);
+
+struct NestedCtx {
+	WalkFunc mWalk;
+	uint64_t mCount;
+};
+
+// Previous iterateAllPid(), on any directory. readdir_r() is deprecated,
+// readdir() does the same getdents64 calls.
+int readdirWalk(const char *path, pfstools::PidFoundCb cb, void *userdata)
+{
+	struct dirent *entry;
+	char *endptr;
+	long pid;
+	DIR *d;
+
+	d = opendir(path);
+	if (!d)
+		return -errno;
+
+	while ((entry = readdir(d)) != nullptr) {
+		errno = 0;
+		pid = strtol(entry->d_name, &endptr, 10);
+		if (pid == LONG_MIN || pid == LONG_MAX || errno == EINVAL)
+			continue;
+		else if (*endptr != '\0')
+			continue;
+
+		if (!cb(pid, userdata))
+			break;
+	}
+
+	closedir(d);
+
+	return 0;
+}
+
+bool countCb(int pid, void *userdata)
+{
+	uint64_t *count = (uint64_t *) userdata;
+
+	(*count)++;
+
+	return true;
+}
+
+bool nestedCb(int pid, void *userdata)
+{
+	NestedCtx *ctx = (NestedCtx *) userdata;
+	char path[64];
+
+	ctx->mCount++;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	ctx->mWalk(path, countCb, &ctx->mCount);
+
+	return true;
+}
+
+uint64_t nowNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Walk duration in ns, and entry count of the last walk
+double timeWalk(WalkFunc walk, const char *path, int iterations, uint64_t *count)
+{
+	uint64_t start;
+
+	start = nowNs();
+	for (int i = 0; i < iterations; i++) {
+		*count = 0;
+		walk(path, countCb, count);
+	}
+
+	return (double) (nowNs() - start) / iterations;
+}
+
+double timeNestedWalk(WalkFunc walk, int iterations, uint64_t *count)
+{
+	NestedCtx ctx;
+	uint64_t start;
+
+	ctx.mWalk = walk;
+
+	start = nowNs();
+	for (int i = 0; i < iterations; i++) {
+		ctx.mCount = 0;
+		walk("/proc", nestedCb, &ctx);
+	}
+
+	*count = ctx.mCount;
+
+	return (double) (nowNs() - start) / iterations;
+}
+
+void printResult(const char *name,
+		 double refNs, uint64_t refCount,
+		 double ns, uint64_t count)
+{
+	printf("%-22s %8llu %12.1f %12.1f   x%.2f%s\n", name,
+	       (unsigned long long) count, refNs / 1000, ns / 1000, refNs / ns,
+	       refCount != count ? "   (entry count differs)" : "");
+}
+
+int populate(const std::string &path, int count)
+{
+	std::string entry;
+
+	if (mkdir(path.c_str(), 0700) < 0)
+		return -errno;
+
+	for (int i = 1; i <= count; i++) {
+		entry = path + "/" + std::to_string(i);
+		if (mkdir(entry.c_str(), 0700) < 0)
+			return -errno;
+	}
+
+	return 0;
+}
+
+void cleanup(const std::string &path, int count)
+{
+	std::string entry;
+
+	for (int i = 1; i <= count; i++) {
+		entry = path + "/" + std::to_string(i);
+		rmdir(entry.c_str());
+	}
+
+	rmdir(path.c_str());
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	char root[] = "/tmp/piddir_bench.XXXXXX";
+	int iterations = DEFAULT_ITERATIONS;
+	std::string path;
+	uint64_t refCount;
+	uint64_t count;
+	double refNs;
+	double ns;
+	int ret;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	if (!mkdtemp(root)) {
+		fprintf(stderr, "mkdtemp : %d(%m)\n", errno);
+		return 1;
+	}
+
+	path = std::string(root) + "/pids";
+	ret = populate(path, DIR_ENTRY_COUNT);
+	if (ret < 0) {
+		fprintf(stderr, "populate : %d(%s)\n", -ret, strerror(-ret));
+		cleanup(path, DIR_ENTRY_COUNT);
+		rmdir(root);
+		return 1;
+	}
+
+	printf("%-22s %8s %12s %12s\n", "walk", "entries",
+	       "readdir us", "getdents us");
+
+	refNs = timeWalk(readdirWalk, "/proc", iterations, &refCount);
+	ns = timeWalk(pfstools::iteratePidDir, "/proc", iterations, &count);
+	printResult("/proc", refNs, refCount, ns, count);
+
+	refNs = timeWalk(readdirWalk, path.c_str(), iterations, &refCount);
+	ns = timeWalk(pfstools::iteratePidDir, path.c_str(), iterations, &count);
+	printResult("10000 entries", refNs, refCount, ns, count);
+
+	refNs = timeNestedWalk(readdirWalk, iterations, &refCount);
+	ns = timeNestedWalk(pfstools::iteratePidDir, iterations, &count);
+	printResult("/proc + task dirs", refNs, refCount, ns, count);
+
+	cleanup(path, DIR_ENTRY_COUNT);
+	rmdir(root);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <set>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * pfstools::iteratePidDir() on directories bigger than one getdents64
+ * buffer, with a walk of another directory in the callback of the first
+ * one, as the /proc walk does when it attaches a process and scans its
+ * task directory.
+ */
+
+// A few getdents64 buffers each
+#define OUTER_COUNT 5000
+#define INNER_COUNT 3000
+
+// Nested walk every NESTED_PERIOD entries of the outer one
+#define NESTED_PERIOD 500
+
+namespace {
+
+struct WalkCtx {
+	std::string mInnerPath;
+	std::set<int> mSeen;
+	int mDuplicates;
+	int mNestedWalks;
+	int mNestedErrors;
+	int mNestedCounts;
+
+	WalkCtx()
+	{
+		mDuplicates = 0;
+		mNestedWalks = 0;
+		mNestedErrors = 0;
+		mNestedCounts = 0;
+	}
+};
+
+bool countCb(int pid, void *userdata)
+{
+	int *count = (int *) userdata;
+
+	(*count)++;
+
+	return true;
+}
+
+bool collectCb(int pid, void *userdata)
+{
+	WalkCtx *ctx = (WalkCtx *) userdata;
+	int count = 0;
+	int ret;
+
+	if (!ctx->mSeen.insert(pid).second)
+		ctx->mDuplicates++;
+
+	if (ctx->mSeen.size() % NESTED_PERIOD != 0)
+		return true;
+
+	ret = pfstools::iteratePidDir(ctx->mInnerPath.c_str(), countCb, &count);
+	ctx->mNestedWalks++;
+	if (ret < 0)
+		ctx->mNestedErrors++;
+	else if (count == INNER_COUNT)
+		ctx->mNestedCounts++;
+
+	return true;
+}
+
+bool stopCb(int pid, void *userdata)
+{
+	int *count = (int *) userdata;
+
+	(*count)++;
+
+	return false;
+}
+
+// Numeric entries, and some which must be skipped
+int populate(const std::string &path, int count)
+{
+	std::string entry;
+	int fd;
+
+	if (mkdir(path.c_str(), 0700) < 0)
+		return -errno;
+
+	for (int i = 1; i <= count; i++) {
+		entry = path + "/" + std::to_string(i);
+		if (mkdir(entry.c_str(), 0700) < 0)
+			return -errno;
+	}
+
+	for (auto name : { "self", "12a", "abc" }) {
+		entry = path + "/" + name;
+		if (mkdir(entry.c_str(), 0700) < 0)
+			return -errno;
+	}
+
+	// Numeric, but not a directory
+	entry = path + "/" + std::to_string(count + 1);
+	fd = open(entry.c_str(), O_CREAT|O_WRONLY|O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+
+	close(fd);
+
+	return 0;
+}
+
+void cleanup(const std::string &path, int count)
+{
+	std::string entry;
+
+	for (int i = 1; i <= count; i++) {
+		entry = path + "/" + std::to_string(i);
+		rmdir(entry.c_str());
+	}
+
+	for (auto name : { "self", "12a", "abc" }) {
+		entry = path + "/" + name;
+		rmdir(entry.c_str());
+	}
+
+	entry = path + "/" + std::to_string(count + 1);
+	unlink(entry.c_str());
+	rmdir(path.c_str());
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	char root[] = "/tmp/piddir_test.XXXXXX";
+	std::string outerPath;
+	WalkCtx ctx;
+	int count;
+	int ret;
+
+	if (!mkdtemp(root)) {
+		fprintf(stderr, "mkdtemp : %d(%m)\n", errno);
+		return 1;
+	}
+
+	outerPath = std::string(root) + "/outer";
+	ctx.mInnerPath = std::string(root) + "/inner";
+
+	ret = populate(outerPath, OUTER_COUNT);
+	if (ret == 0)
+		ret = populate(ctx.mInnerPath, INNER_COUNT);
+
+	if (ret < 0) {
+		fprintf(stderr, "populate : %d(%s)\n", -ret, strerror(-ret));
+		sTestFailures++;
+		goto out;
+	}
+
+	// Flat walk
+	count = 0;
+	ret = pfstools::iteratePidDir(ctx.mInnerPath.c_str(), countCb, &count);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(count, INNER_COUNT);
+
+	// Nested walks must not disturb the outer one
+	ret = pfstools::iteratePidDir(outerPath.c_str(), collectCb, &ctx);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(ctx.mSeen.size(), OUTER_COUNT);
+	CHECK_EQ(ctx.mDuplicates, 0);
+	CHECK_EQ(*ctx.mSeen.begin(), 1);
+	CHECK_EQ(*ctx.mSeen.rbegin(), OUTER_COUNT);
+	CHECK_EQ(ctx.mNestedWalks, OUTER_COUNT / NESTED_PERIOD);
+	CHECK_EQ(ctx.mNestedErrors, 0);
+	CHECK_EQ(ctx.mNestedCounts, ctx.mNestedWalks);
+
+	// The callback stops the walk
+	count = 0;
+	ret = pfstools::iteratePidDir(outerPath.c_str(), stopCb, &count);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(count, 1);
+
+	ret = pfstools::iteratePidDir("/nonexistent", countCb, &count);
+	CHECK_EQ(ret, -ENOENT);
+
+out:
+	cleanup(outerPath, OUTER_COUNT);
+	cleanup(ctx.mInnerPath, INNER_COUNT);
+	rmdir(root);
+
+	return testResult("piddir");
+}
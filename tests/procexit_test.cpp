@@ -0,0 +1,198 @@
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Process exit notification : a monitored child is killed, its
+ * ProcessExit must be notified once, after its last ProcessStats and
+ * before its pid is reaped.
+ */
+
+#define CHILD_NAME "ssr_exit_test"
+#define ACQ_PERIOD_MS 50
+#define TIMEOUT_MS 5000
+
+namespace {
+
+struct TestCtx {
+	pid_t mChild;
+	int mStatsCount;
+	int mStatsAfterExit;
+	int mExitCount;
+	SystemMonitor::ProcessExit mExit;
+
+	TestCtx()
+	{
+		mChild = -1;
+		mStatsCount = 0;
+		mStatsAfterExit = 0;
+		mExitCount = 0;
+		memset(&mExit, 0, sizeof(mExit));
+	}
+};
+
+void processStatsCb(const SystemMonitor::ProcessStats &stats, void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+
+	if ((pid_t) stats.mPid != ctx->mChild)
+		return;
+
+	if (ctx->mExitCount > 0)
+		ctx->mStatsAfterExit++;
+	else
+		ctx->mStatsCount++;
+}
+
+void processExitCb(const SystemMonitor::ProcessExit &exit, void *userdata)
+{
+	TestCtx *ctx = (TestCtx *) userdata;
+
+	if ((pid_t) exit.mPid != ctx->mChild)
+		return;
+
+	ctx->mExit = exit;
+	ctx->mExitCount++;
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Runs the loop until the condition is true, false on timeout
+template <typename Cond>
+bool waitFor(EventLoop *loop, Cond cond)
+{
+	uint64_t deadline = nowMs() + TIMEOUT_MS;
+
+	while (!cond()) {
+		if (nowMs() > deadline)
+			return false;
+
+		loop->wait(ACQ_PERIOD_MS);
+	}
+
+	return true;
+}
+
+void runFor(EventLoop *loop, int durationMs)
+{
+	uint64_t deadline = nowMs() + durationMs;
+
+	while (nowMs() < deadline)
+		loop->wait(ACQ_PERIOD_MS);
+}
+
+// Child renamed to CHILD_NAME, started once the name is set
+pid_t startChild()
+{
+	int fds[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		prctl(PR_SET_NAME, CHILD_NAME);
+		if (write(fds[1], &c, 1) != 1)
+			_exit(1);
+
+		while (true)
+			pause();
+	}
+
+	close(fds[1]);
+	if (pid > 0 && read(fds[0], &c, 1) != 1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+
+	close(fds[0]);
+
+	return pid;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	EventLoop loop;
+	TestCtx ctx;
+	int ret;
+
+	ret = loop.init();
+	if (ret < 0)
+		return 1;
+
+	ctx.mChild = startChild();
+	if (ctx.mChild < 0) {
+		fprintf(stderr, "Fail to start child : %d(%m)\n", errno);
+		return 1;
+	}
+
+	cb.mProcessStats = processStatsCb;
+	cb.mProcessExit = processExitCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mRecordThreads = false;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	ret = mon->addProcess(CHILD_NAME);
+	CHECK_EQ(ret, 0);
+
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	CHECK(waitFor(&loop, [&ctx] () { return ctx.mStatsCount > 0; }));
+
+	// Not reaped : the exit must be seen without a failed read
+	kill(ctx.mChild, SIGKILL);
+
+	CHECK(waitFor(&loop, [&ctx] () { return ctx.mExitCount > 0; }));
+	CHECK_STR_EQ(ctx.mExit.mName, CHILD_NAME);
+	CHECK(ctx.mExit.mTs > 0);
+
+	// Nothing more about the pid, even after a few periods
+	waitpid(ctx.mChild, nullptr, 0);
+	runFor(&loop, 5 * ACQ_PERIOD_MS);
+
+	CHECK_EQ(ctx.mExitCount, 1);
+	CHECK_EQ(ctx.mStatsAfterExit, 0);
+
+	mon->stop();
+
+out:
+	delete mon;
+
+	if (ctx.mExitCount == 0) {
+		kill(ctx.mChild, SIGKILL);
+		waitpid(ctx.mChild, nullptr, 0);
+	}
+
+	return testResult("procexit");
+}
@@ -0,0 +1,301 @@
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Record-all mode : the monitor of an exited process is reclaimed, and a
+ * new process with the same pid is discovered again. The pid is reused
+ * through /proc/sys/kernel/ns_last_pid, once after the exit has been
+ * handled, then before the monitor of the exited process has been
+ * reclaimed. Run with /proc scans, then with proc events.
+ */
+
+#define NAME_FIRST "ssr_reuse_a"
+#define NAME_AFTER_EXIT "ssr_reuse_b"
+#define NAME_BEFORE_RECLAIM "ssr_reuse_c"
+
+#define LAST_PID_PATH "/proc/sys/kernel/ns_last_pid"
+
+// Other processes may take the pid first
+#define REUSE_ATTEMPTS 20
+
+#define ACQ_PERIOD_MS 50
+#define WAIT_TIMEOUT_MS 3000
+
+namespace {
+
+struct MonitorCtx {
+	pid_t mPid;
+
+	// Stats and exits of mPid
+	std::string mName;
+	int mExitCount;
+
+	// Reports of mPid by the current acquisition, and their maximum
+	int mReports;
+	int mMaxReports;
+
+	MonitorCtx()
+	{
+		mPid = -1;
+		mExitCount = 0;
+		mReports = 0;
+		mMaxReports = 0;
+	}
+};
+
+void processStatsCb(const SystemMonitor::ProcessStats &stats, void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	if ((pid_t) stats.mPid != ctx->mPid)
+		return;
+
+	ctx->mName = stats.mName;
+	ctx->mReports++;
+}
+
+void processExitCb(const SystemMonitor::ProcessExit &exit, void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	if ((pid_t) exit.mPid == ctx->mPid)
+		ctx->mExitCount++;
+}
+
+void resultsBeginCb(const SystemMonitor::AcquisitionDuration &stats,
+		    void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	ctx->mReports = 0;
+}
+
+void resultsEndCb(void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	ctx->mMaxReports = std::max(ctx->mMaxReports, ctx->mReports);
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+template <typename F>
+bool waitFor(EventLoop *loop, F done)
+{
+	uint64_t deadline = nowMs() + WAIT_TIMEOUT_MS;
+
+	while (nowMs() < deadline) {
+		if (done())
+			return true;
+
+		loop->wait(ACQ_PERIOD_MS);
+	}
+
+	return done();
+}
+
+// Named child, returned once its name is set
+pid_t startChild(const char *name)
+{
+	int fds[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		prctl(PR_SET_NAME, name);
+
+		if (write(fds[1], &c, 1) != 1)
+			_exit(1);
+
+		while (true)
+			pause();
+	}
+
+	close(fds[1]);
+	if (pid > 0 && read(fds[0], &c, 1) != 1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+
+	close(fds[0]);
+
+	return pid;
+}
+
+void stopChild(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+}
+
+int setLastPid(pid_t pid)
+{
+	FILE *file;
+	int ret;
+
+	file = fopen(LAST_PID_PATH, "w");
+	if (!file)
+		return -errno;
+
+	ret = fprintf(file, "%d", pid);
+	if (fclose(file) != 0 || ret < 0)
+		return -EIO;
+
+	return 0;
+}
+
+// Child started with the given pid
+pid_t startChildAt(pid_t pid, const char *name)
+{
+	pid_t child;
+
+	for (int i = 0; i < REUSE_ATTEMPTS; i++) {
+		if (setLastPid(pid - 1) < 0)
+			return -1;
+
+		child = startChild(name);
+		if (child == pid || child < 0)
+			return child;
+
+		stopChild(child);
+	}
+
+	return -1;
+}
+
+bool canReusePid()
+{
+	FILE *file;
+
+	// Needs CAP_SYS_ADMIN or CAP_CHECKPOINT_RESTORE
+	file = fopen(LAST_PID_PATH, "r+");
+	if (!file)
+		return false;
+
+	fclose(file);
+
+	return true;
+}
+
+void checkReuse(bool procEvents)
+{
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	EventLoop loop;
+	MonitorCtx ctx;
+	pid_t child;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	cb.mProcessStats = processStatsCb;
+	cb.mProcessExit = processExitCb;
+	cb.mResultsBegin = resultsBeginCb;
+	cb.mResultsEnd = resultsEndCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mRecordThreads = false;
+	config.mProcEvents = procEvents;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	// Record every process
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	// Started after the monitor
+	child = startChild(NAME_FIRST);
+	CHECK(child > 0);
+	if (child < 0)
+		goto out;
+
+	ctx.mPid = child;
+	CHECK(waitFor(&loop, [&] () {
+		return ctx.mName == "(" NAME_FIRST ")"; }));
+
+	// Reused once the exit has been handled
+	stopChild(child);
+	CHECK(waitFor(&loop, [&] () { return ctx.mExitCount == 1; }));
+
+	child = startChildAt(ctx.mPid, NAME_AFTER_EXIT);
+	CHECK_EQ(child, ctx.mPid);
+	if (child < 0)
+		goto out;
+
+	CHECK(waitFor(&loop, [&] () {
+		return ctx.mName == "(" NAME_AFTER_EXIT ")"; }));
+
+	// Reused before the loop runs : the exit of the previous process
+	// is still pending
+	stopChild(child);
+	child = startChildAt(ctx.mPid, NAME_BEFORE_RECLAIM);
+	CHECK_EQ(child, ctx.mPid);
+	if (child < 0)
+		goto out;
+
+	CHECK(waitFor(&loop, [&] () {
+		return ctx.mName == "(" NAME_BEFORE_RECLAIM ")"; }));
+	CHECK(waitFor(&loop, [&] () { return ctx.mExitCount == 2; }));
+
+	// Still recorded once its predecessor is reclaimed
+	ctx.mName.clear();
+	CHECK(waitFor(&loop, [&] () {
+		return ctx.mName == "(" NAME_BEFORE_RECLAIM ")"; }));
+
+	stopChild(child);
+
+	// A single monitor per pid at each acquisition
+	CHECK_EQ(ctx.mMaxReports, 1);
+
+	mon->stop();
+
+out:
+	delete mon;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	if (!canReusePid()) {
+		printf("reclaim : pid reuse unavailable, skipped\n");
+		return testResult("reclaim");
+	}
+
+	checkReuse(false);
+	checkReuse(true);
+
+	return testResult("reclaim");
+}
@@ -0,0 +1,88 @@
+#ifndef __REF_TOKENIZER_HPP__
+#define __REF_TOKENIZER_HPP__
+
+/**
+ * Byte per byte stat line tokenizer, as used before the vectorized field
+ * search. Kept as the reference of the parser tests and benchmarks.
+ */
+typedef bool (*TokenizerCb) (
+		int idx,
+		const char *start,
+		const char *end,
+		void *userdata);
+
+enum ParserState {
+	PARSER_STATE_IDLE = 0,
+	PARSER_STATE_INT,
+	PARSER_STATE_STR
+};
+
+static inline int tokenizeStats(const char *s, TokenizerCb cb, void *userdata)
+{
+	bool doParse;
+	const char *start = NULL;
+	ParserState state;
+	int idx = 0;
+
+	if (!s|| !cb)
+		return -EINVAL;
+
+	state = PARSER_STATE_IDLE;
+	while (*s != '\0') {
+		switch (state) {
+		case PARSER_STATE_IDLE:
+			if (*s == '(') {
+				state = PARSER_STATE_STR;
+				start = s;
+			} else if (*s != ' ') {
+				state = PARSER_STATE_INT;
+				start = s;
+			}
+			break;
+
+		case PARSER_STATE_INT:
+			if (*s == ' ') {
+				doParse = cb(idx, start, s - 1, userdata);
+				if (!doParse)
+					return 0;
+
+				state = PARSER_STATE_IDLE;
+				idx++;
+			}
+			break;
+
+		case PARSER_STATE_STR:
+			if (*s == ')') {
+				doParse = cb(idx, start, s, userdata);
+				if (!doParse)
+					return 0;
+
+				state = PARSER_STATE_IDLE;
+				idx++;
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		s++;
+	}
+
+	switch (state) {
+	case PARSER_STATE_INT:
+		cb(idx, start, s - 1, userdata);
+		break;
+
+	case PARSER_STATE_STR:
+		cb(idx, start, s - 1, userdata);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+#endif // !__REF_TOKENIZER_HPP__
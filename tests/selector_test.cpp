@@ -0,0 +1,408 @@
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Process selectors : the matching of each MatchType, then a child
+ * selected at fork time by the name of its parent and matched again once
+ * it has called exec(), with proc events.
+ */
+
+#define LAUNCHER_NAME "ssr_sel_launch"
+#define LAUNCHER_GLOB "ssr_sel_*"
+#define EXEC_MARKER "ssr_sel_exec_marker"
+
+#define ACQ_PERIOD_MS 50
+#define EXEC_DELAY_MS 300
+#define RUN_MS 1200
+
+namespace {
+
+typedef SystemMonitor::MatchType MatchType;
+
+// Selector matching comm (and cmdline), -1 if init() fails
+int matches(const char *pattern, MatchType type, const char *comm,
+	    const char *cmdline = nullptr)
+{
+	SystemMonitor::ProcessConfig config;
+	ProcessSelector sel;
+
+	config.mMatch = type;
+	if (sel.init(pattern, config) < 0)
+		return -1;
+
+	return sel.match(comm, cmdline) ? 1 : 0;
+}
+
+void checkName()
+{
+	// The kernel truncates comm to 15 chars
+	CHECK_EQ(matches("ssr_long_process_name", MatchType::name,
+			 "ssr_long_proces"), 1);
+	CHECK_EQ(matches("ssr_long_process_name", MatchType::name,
+			 "ssr_long_procex"), 0);
+	CHECK_EQ(matches("bash", MatchType::name, "bash"), 1);
+	CHECK_EQ(matches("bash", MatchType::name, "bas"), 0);
+	CHECK_EQ(matches("bash", MatchType::name, "bash2"), 0);
+
+	// Patterns are not interpreted
+	CHECK_EQ(matches("b*", MatchType::name, "bash"), 0);
+	CHECK_EQ(matches("b*", MatchType::name, "b*"), 1);
+
+	CHECK_EQ(matches("", MatchType::name, ""), -1);
+}
+
+void checkGlob()
+{
+	CHECK_EQ(matches("ssr*", MatchType::glob, "ssr"), 1);
+	CHECK_EQ(matches("ssr*", MatchType::glob, "ssrd"), 1);
+	CHECK_EQ(matches("ssr*", MatchType::glob, "xssr"), 0);
+	CHECK_EQ(matches("?sh", MatchType::glob, "zsh"), 1);
+	CHECK_EQ(matches("?sh", MatchType::glob, "bash"), 0);
+	CHECK_EQ(matches("*", MatchType::glob, ""), 1);
+
+	// Bracket expressions, with '!' negation
+	CHECK_EQ(matches("[bz]sh", MatchType::glob, "zsh"), 1);
+	CHECK_EQ(matches("[bz]sh", MatchType::glob, "ksh"), 0);
+	CHECK_EQ(matches("[!b]ash", MatchType::glob, "dash"), 1);
+	CHECK_EQ(matches("[!b]ash", MatchType::glob, "bash"), 0);
+	CHECK_EQ(matches("[!b]ash", MatchType::glob, "!ash"), 1);
+	CHECK_EQ(matches("kworker/[0-9]*", MatchType::glob, "kworker/3:1"), 1);
+	CHECK_EQ(matches("kworker/[0-9]*", MatchType::glob, "kworker/u8:2"), 0);
+
+	// A ']' right after the opening is a literal
+	CHECK_EQ(matches("[]a]x", MatchType::glob, "]x"), 1);
+	CHECK_EQ(matches("[]a]x", MatchType::glob, "ax"), 1);
+	CHECK_EQ(matches("[]a]x", MatchType::glob, "bx"), 0);
+	CHECK_EQ(matches("[!]a]x", MatchType::glob, "]x"), 0);
+	CHECK_EQ(matches("[!]a]x", MatchType::glob, "bx"), 1);
+
+	// Unclosed bracket : literal
+	CHECK_EQ(matches("a[bc", MatchType::glob, "a[bc"), 1);
+	CHECK_EQ(matches("a[bc", MatchType::glob, "ab"), 0);
+
+	// Regex special chars are literals
+	CHECK_EQ(matches("a.b", MatchType::glob, "a.b"), 1);
+	CHECK_EQ(matches("a.b", MatchType::glob, "axb"), 0);
+	CHECK_EQ(matches("(a)+|b$", MatchType::glob, "(a)+|b$"), 1);
+	CHECK_EQ(matches("a\\b", MatchType::glob, "a\\b"), 1);
+	CHECK_EQ(matches("{a}^", MatchType::glob, "{a}^"), 1);
+}
+
+void checkRegex()
+{
+	CHECK_EQ(matches("^kworker/[0-9]+:", MatchType::regex, "kworker/3:1"), 1);
+	CHECK_EQ(matches("^kworker/[0-9]+:", MatchType::regex, "kworker/u8:2"), 0);
+
+	// Not anchored
+	CHECK_EQ(matches("sh", MatchType::regex, "bash"), 1);
+	CHECK_EQ(matches("^(ba|z)sh$", MatchType::regex, "zsh"), 1);
+	CHECK_EQ(matches("^(ba|z)sh$", MatchType::regex, "dash"), 0);
+
+	CHECK_EQ(matches("(", MatchType::regex, "("), -1);
+	CHECK_EQ(matches("[a", MatchType::regex, "a"), -1);
+}
+
+void checkCmdline()
+{
+	CHECK_EQ(matches("--config /etc/app", MatchType::cmdline, "app",
+			 "/usr/bin/app --config /etc/app.conf"), 1);
+	CHECK_EQ(matches("--config /etc/app", MatchType::cmdline, "app",
+			 "/usr/bin/app"), 0);
+
+	// Command line not read : kernel threads have none
+	CHECK_EQ(matches("app", MatchType::cmdline, "app", nullptr), 0);
+}
+
+void checkConfig()
+{
+	SystemMonitor::ProcessConfig config;
+	ProcessSelector all;
+	ProcessSelector single;
+	ProcessSelector cmdline;
+	ProcessSelector glob;
+
+	// Every process, the name is not read
+	config.mMatch = MatchType::all;
+	config.mAllInstances = true;
+	CHECK_EQ(all.init("*", config), 0);
+	CHECK(all.match("anything", nullptr));
+	CHECK(all.match(nullptr, nullptr));
+	CHECK(!all.needsComm());
+	CHECK(!all.needsCmdline());
+	CHECK(!all.usesNameIndex());
+	CHECK(all.isAllInstances());
+	CHECK(all.isWaiting());
+
+	// All instances : scanned once with proc events, then only when
+	// events are lost
+	CHECK(all.needsDiscovery(false));
+	CHECK(all.needsDiscovery(true));
+	all.clearRescan();
+	CHECK(all.needsDiscovery(false));
+	CHECK(!all.needsDiscovery(true));
+	all.requestRescan();
+	CHECK(all.needsDiscovery(true));
+
+	CHECK(!all.hasPid(42));
+	all.addPid(42);
+	CHECK(all.hasPid(42));
+	all.removePid(42);
+	CHECK(!all.hasPid(42));
+
+	// Single instance by name : hash lookup, waiting for its monitor
+	config = SystemMonitor::ProcessConfig();
+	config.mAcqPeriodMs = 300;
+	CHECK_EQ(single.init("bash", config), 0);
+	CHECK(single.usesNameIndex());
+	CHECK(single.needsComm());
+	CHECK(!single.needsCmdline());
+	CHECK(!single.isWaiting());
+	CHECK_EQ(single.getSchedule()->mPeriodMs, 300);
+	CHECK_STR_EQ(single.getPattern(), "bash");
+
+	config = SystemMonitor::ProcessConfig();
+	config.mMatch = MatchType::cmdline;
+	CHECK_EQ(cmdline.init("app", config), 0);
+	CHECK(!cmdline.needsComm());
+	CHECK(cmdline.needsCmdline());
+	CHECK(!cmdline.usesNameIndex());
+
+	config = SystemMonitor::ProcessConfig();
+	config.mMatch = MatchType::glob;
+	CHECK_EQ(glob.init("b*", config), 0);
+	CHECK(glob.needsComm());
+	CHECK(!glob.usesNameIndex());
+}
+
+struct ExecCtx {
+	pid_t mChild;
+	int mAcqCount;
+
+	// Stats of the child, by name, and acquisitions with several stats
+	// of the child
+	int mForkStats;
+	int mExecStats;
+	int mChildAcqStats;
+	int mDuplicates;
+
+	ExecCtx()
+	{
+		mChild = -1;
+		mAcqCount = 0;
+		mForkStats = 0;
+		mExecStats = 0;
+		mChildAcqStats = 0;
+		mDuplicates = 0;
+	}
+};
+
+void resultsBeginCb(const SystemMonitor::AcquisitionDuration &stats,
+		    void *userdata)
+{
+	ExecCtx *ctx = (ExecCtx *) userdata;
+
+	ctx->mAcqCount++;
+	ctx->mChildAcqStats = 0;
+}
+
+void processStatsCb(const SystemMonitor::ProcessStats &stats, void *userdata)
+{
+	ExecCtx *ctx = (ExecCtx *) userdata;
+
+	if ((pid_t) stats.mPid != ctx->mChild)
+		return;
+
+	// Names are read from the stat file, in parentheses
+	if (strcmp(stats.mName, "(" LAUNCHER_NAME ")") == 0)
+		ctx->mForkStats++;
+	else if (strcmp(stats.mName, "(sleep)") == 0)
+		ctx->mExecStats++;
+
+	ctx->mChildAcqStats++;
+	if (ctx->mChildAcqStats == 2)
+		ctx->mDuplicates++;
+}
+
+// Launcher which forks a child once told to, the child calls exec()
+// after EXEC_DELAY_MS. The child pid is written back.
+pid_t startLauncher(int *cmdFd, int *pidFd)
+{
+	int cmd[2];
+	int res[2];
+	pid_t pid;
+	pid_t child;
+	char c;
+
+	if (pipe(cmd) < 0)
+		return -1;
+
+	if (pipe(res) < 0) {
+		close(cmd[0]);
+		close(cmd[1]);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		close(cmd[1]);
+		close(res[0]);
+		prctl(PR_SET_NAME, LAUNCHER_NAME);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+		if (read(cmd[0], &c, 1) != 1)
+			_exit(1);
+
+		child = fork();
+		if (child == 0) {
+			usleep(EXEC_DELAY_MS * 1000);
+			execlp("sleep", EXEC_MARKER, "10", (char *) nullptr);
+			_exit(1);
+		}
+
+		if (write(res[1], &child, sizeof(child)) != sizeof(child))
+			_exit(1);
+
+		waitpid(child, nullptr, 0);
+		_exit(0);
+	}
+
+	close(cmd[0]);
+	close(res[1]);
+	*cmdFd = cmd[1];
+	*pidFd = res[0];
+
+	return pid;
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void runLoop(EventLoop *loop, int durationMs)
+{
+	uint64_t deadline = nowMs() + durationMs;
+
+	while (nowMs() < deadline)
+		loop->wait(ACQ_PERIOD_MS);
+}
+
+void checkExec()
+{
+	SystemMonitor::ProcessConfig globConfig;
+	SystemMonitor::ProcessConfig cmdlineConfig;
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	ProcEvents::Callbacks evtCb;
+	ProcEvents events;
+	EventLoop loop;
+	ExecCtx ctx;
+	pid_t launcher = -1;
+	int cmdFd = -1;
+	int pidFd = -1;
+	char c = 0;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	// Proc events need CAP_NET_ADMIN
+	if (events.init(&loop, evtCb) < 0) {
+		printf("selector : proc events unavailable, exec check skipped\n");
+		return;
+	}
+
+	events.clear();
+
+	launcher = startLauncher(&cmdFd, &pidFd);
+	CHECK(launcher > 0);
+	if (launcher < 0)
+		return;
+
+	cb.mProcessStats = processStatsCb;
+	cb.mResultsBegin = resultsBeginCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mProcEvents = true;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	// The child matches the first one with the name of its parent, the
+	// second one once it runs sleep
+	globConfig.mMatch = MatchType::glob;
+	globConfig.mAllInstances = true;
+	globConfig.mRecordThreads = false;
+	CHECK_EQ(mon->addProcess(LAUNCHER_GLOB, globConfig), 0);
+
+	cmdlineConfig.mMatch = MatchType::cmdline;
+	cmdlineConfig.mRecordThreads = false;
+	CHECK_EQ(mon->addProcess(EXEC_MARKER, cmdlineConfig), 0);
+
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	// Initial scan done
+	runLoop(&loop, 2 * ACQ_PERIOD_MS);
+
+	if (write(cmdFd, &c, 1) != 1 ||
+	    read(pidFd, &ctx.mChild, sizeof(ctx.mChild)) != sizeof(ctx.mChild)) {
+		CHECK(false);
+		goto out;
+	}
+
+	runLoop(&loop, RUN_MS);
+	mon->stop();
+
+	// Read under both names, never by both selectors at once
+	CHECK(ctx.mForkStats > 0);
+	CHECK(ctx.mExecStats > 0);
+	CHECK_EQ(ctx.mDuplicates, 0);
+
+out:
+	delete mon;
+
+	if (cmdFd != -1)
+		close(cmdFd);
+	if (pidFd != -1)
+		close(pidFd);
+
+	if (ctx.mChild > 0)
+		kill(ctx.mChild, SIGKILL);
+
+	kill(launcher, SIGKILL);
+	waitpid(launcher, nullptr, 0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkName();
+	checkGlob();
+	checkRegex();
+	checkCmdline();
+	checkConfig();
+	checkExec();
+
+	return testResult("selector");
+}
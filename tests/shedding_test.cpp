@@ -0,0 +1,182 @@
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Load shedding ladder : steps taken by LoadShedding on overruns and on
+ * acquisitions under half the budget, with monitors of several priorities.
+ */
+
+#define BUDGET 10000000ULL
+#define OVER (BUDGET + 1)
+#define UNDER (BUDGET / 2 - 1)
+#define BETWEEN (BUDGET / 2)
+
+namespace {
+
+struct FakeMonitor {
+	int mPriority;
+
+	int getPriority() const { return mPriority; }
+};
+
+typedef std::vector<FakeMonitor *> Monitors;
+
+struct Level {
+	bool mThreadsShed;
+	int mShedPriority;
+	int mPeriodFactor;
+};
+
+#define CHECK_LEVEL(_shedding, _threads, _priority, _factor) \
+	do { \
+		CHECK_EQ((_shedding).getThreadsShed(), (_threads)); \
+		CHECK_EQ((_shedding).getShedPriority(), (_priority)); \
+		CHECK_EQ((_shedding).getPeriodFactor(), (_factor)); \
+	} while (0)
+
+// Acquisitions under half the budget until a step back, false if none
+bool recover(LoadShedding *shedding, const Monitors &monitors)
+{
+	for (int i = 0; i < SHED_RECOVERY_COUNT - 1; i++) {
+		if (shedding->update(UNDER, BUDGET, monitors))
+			return false;
+	}
+
+	return shedding->update(UNDER, BUDGET, monitors);
+}
+
+void checkLadder()
+{
+	FakeMonitor monitors[] = { { 5 }, { 0 }, { 2 }, { 1 }, { 0 } };
+	const Level steps[] = {
+		{ true, INT32_MIN, 1 },
+		{ true, 0, 1 },
+		{ true, 1, 1 },
+		{ true, 2, 1 },
+		{ true, 2, 2 },
+		{ true, 2, 4 },
+		{ true, 2, 8 },
+	};
+	LoadShedding shedding;
+	Monitors list;
+
+	for (auto &m : monitors)
+		list.push_back(&m);
+
+	CHECK(!shedding.isShedding());
+	CHECK_LEVEL(shedding, false, INT32_MIN, 1);
+
+	// Not shedding : nothing to recover
+	CHECK(!recover(&shedding, list));
+	CHECK(!shedding.update(BUDGET, BUDGET, list));
+
+	// Down one step per overrun. Priority 5, the highest, is kept.
+	for (auto &step : steps) {
+		CHECK(shedding.update(OVER, BUDGET, list));
+		CHECK_LEVEL(shedding, step.mThreadsShed, step.mShedPriority,
+			    step.mPeriodFactor);
+		CHECK(shedding.isShedding());
+	}
+
+	// Bottom of the ladder
+	CHECK(!shedding.update(OVER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, 2, SHED_MAX_PERIOD_FACTOR);
+
+	// Back up in reverse order
+	for (int i = SIZEOF_ARRAY(steps) - 2; i >= 0; i--) {
+		CHECK(recover(&shedding, list));
+		CHECK_LEVEL(shedding, steps[i].mThreadsShed,
+			    steps[i].mShedPriority, steps[i].mPeriodFactor);
+	}
+
+	CHECK(recover(&shedding, list));
+	CHECK_LEVEL(shedding, false, INT32_MIN, 1);
+	CHECK(!shedding.isShedding());
+	CHECK(!recover(&shedding, list));
+}
+
+void checkRecoveryCount()
+{
+	FakeMonitor monitor = { 0 };
+	LoadShedding shedding;
+	Monitors list;
+
+	list.push_back(&monitor);
+
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, INT32_MIN, 2);
+
+	// Only acquisitions in a row under half the budget count
+	for (int i = 0; i < SHED_RECOVERY_COUNT - 1; i++)
+		CHECK(!shedding.update(UNDER, BUDGET, list));
+
+	CHECK(!shedding.update(BETWEEN, BUDGET, list));
+
+	for (int i = 0; i < SHED_RECOVERY_COUNT - 1; i++)
+		CHECK(!shedding.update(UNDER, BUDGET, list));
+
+	// An overrun resets the count too
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, INT32_MIN, 4);
+
+	for (int i = 0; i < SHED_RECOVERY_COUNT - 1; i++)
+		CHECK(!shedding.update(UNDER, BUDGET, list));
+
+	CHECK(shedding.update(UNDER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, INT32_MIN, 2);
+}
+
+// Without lower priorities, the period is lengthened after threads
+void checkSinglePriority()
+{
+	FakeMonitor monitors[] = { { 3 }, { 3 } };
+	LoadShedding shedding;
+	Monitors list;
+	Monitors empty;
+
+	for (auto &m : monitors)
+		list.push_back(&m);
+
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, INT32_MIN, 2);
+
+	LoadShedding noMonitor;
+
+	CHECK(noMonitor.update(OVER, BUDGET, empty));
+	CHECK(noMonitor.update(OVER, BUDGET, empty));
+	CHECK_LEVEL(noMonitor, true, INT32_MIN, 2);
+}
+
+// Shed priorities whose monitors are gone are skipped by the recovery
+void checkRemovedMonitor()
+{
+	FakeMonitor monitors[] = { { 1 }, { 0 }, { 9 } };
+	LoadShedding shedding;
+	Monitors list;
+
+	for (auto &m : monitors)
+		list.push_back(&m);
+
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK(shedding.update(OVER, BUDGET, list));
+	CHECK_LEVEL(shedding, true, 1, 1);
+
+	list.erase(list.begin() + 1);
+	CHECK(recover(&shedding, list));
+	CHECK_LEVEL(shedding, true, INT32_MIN, 1);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkLadder();
+	checkRecoveryCount();
+	checkSinglePriority();
+	checkRemovedMonitor();
+
+	return testResult("shedding");
+}
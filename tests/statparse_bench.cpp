@@ -0,0 +1,173 @@
+#include <time.h>
+#include "ssr_priv.hpp"
+#include "reftokenizer.hpp"
+
+/**
+ * Stat line parsing cost : the byte per byte tokenizer with copy-then-atoi
+ * field callbacks (the previous path), against the vectorized field search
+ * with in place conversion of pfstools::readProcessStats().
+ *
+ * Usage : statparse_bench PID_STAT_SAMPLES [ITERATIONS]
+ */
+
+#define DEFAULT_ITERATIONS 20000
+
+namespace {
+
+enum ProcStatIdx {
+	PROCSTAT_IDX_PID = 0,
+	PROCSTAT_IDX_NAME = 1,
+	PROCSTAT_IDX_UTIME = 13,
+	PROCSTAT_IDX_STIME = 14,
+	PROCSTAT_IDX_THREADCOUNT= 19,
+	PROCSTAT_IDX_VSIZE = 22,
+	PROCSTAT_IDX_RSS = 23
+};
+
+// Previous field callback
+bool processStatsCb(int idx,
+		     const char *start,
+		     const char *end,
+		     void *userdata)
+{
+	SystemMonitor::ProcessStats *stats = (SystemMonitor::ProcessStats *) userdata;
+	char buf[64];
+	bool ret = true;
+
+	if ((size_t) (end - start + 1) > sizeof(buf))
+		return false;
+
+	memcpy(buf, start, end - start + 1);
+	buf[end - start + 1] = '\0';
+
+	switch (idx) {
+	case PROCSTAT_IDX_PID:
+		stats->mPid = atoi(buf);
+		break;
+
+	case PROCSTAT_IDX_NAME:
+		strncpy(stats->mName, buf, sizeof(stats->mName));
+		break;
+
+	case PROCSTAT_IDX_UTIME:
+		stats->mUtime = atoll(buf);
+		break;
+
+	case PROCSTAT_IDX_STIME:
+		stats->mStime = atoll(buf);
+		break;
+
+	case PROCSTAT_IDX_THREADCOUNT:
+		stats->mThreadCount = atoi(buf);
+		break;
+
+	case PROCSTAT_IDX_VSIZE:
+		stats->mVsize = atoi(buf);
+		break;
+
+	case PROCSTAT_IDX_RSS:
+		stats->mRss = atoi(buf);
+		ret = false;
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+uint64_t nowNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int readSamples(const char *path, std::vector<std::string> *lines)
+{
+	char *line = nullptr;
+	size_t size = 0;
+	ssize_t len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Fail to open %s : %d(%m)\n", path, errno);
+		return -errno;
+	}
+
+	while ((len = getline(&line, &size, f)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		lines->push_back(line);
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	SystemMonitor::ProcessStats stats;
+	std::vector<std::string> lines;
+	uint64_t checksum = 0;
+	uint64_t parses;
+	uint64_t start;
+	uint64_t refNs;
+	uint64_t ns;
+	int iterations = DEFAULT_ITERATIONS;
+	int ret;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage : %s PID_STAT_SAMPLES [ITERATIONS]\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+
+	ret = readSamples(argv[1], &lines);
+	if (ret < 0 || lines.empty())
+		return 1;
+
+	parses = (uint64_t) iterations * lines.size();
+
+	start = nowNs();
+	for (int i = 0; i < iterations; i++) {
+		for (auto &line : lines) {
+			tokenizeStats(line.c_str(), processStatsCb, &stats);
+			checksum += stats.mUtime;
+		}
+	}
+	refNs = nowNs() - start;
+
+	start = nowNs();
+	for (int i = 0; i < iterations; i++) {
+		for (auto &line : lines) {
+			pfstools::readProcessStats(line.c_str(), &stats);
+			checksum += stats.mUtime;
+		}
+	}
+	ns = nowNs() - start;
+
+	printf("%zu lines x %d iterations\n", lines.size(), iterations);
+	printf("  byte per byte tokenizer : %6.1f ns/line\n",
+	       (double) refNs / parses);
+	printf("  vectorized parser       : %6.1f ns/line (x%.1f)\n",
+	       (double) ns / parses, (double) refNs / ns);
+	printf("  (checksum %llu)\n", (unsigned long long) checksum);
+
+	return 0;
+}
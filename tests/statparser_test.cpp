@@ -0,0 +1,438 @@
+#include <dirent.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+#include "reftokenizer.hpp"
+
+/**
+ * Differential test of the stat parsers.
+ *
+ * Each sample is split by the byte per byte tokenizer used before the
+ * vectorized one, then parsed by pfstools at every alignment of the
+ * vectorized delimiter search. Every parsed field must match its token.
+ * Samples come from tests/data, and from the /proc of the host.
+ */
+
+// Vectorized loads are aligned on at most 32 bytes
+#define ALIGNMENT_COUNT 32
+
+#define SAMPLE_MAX_SIZE (64 * 1024)
+
+namespace {
+
+typedef std::vector<std::string> Tokens;
+
+alignas(64) char sBuffer[SAMPLE_MAX_SIZE + ALIGNMENT_COUNT];
+
+bool collectTokenCb(int idx, const char *start, const char *end, void *userdata)
+{
+	Tokens *tokens = (Tokens *) userdata;
+
+	tokens->push_back(std::string(start, end - start + 1));
+
+	return true;
+}
+
+void tokenize(const char *s, Tokens *tokens)
+{
+	tokens->clear();
+	tokenizeStats(s, collectTokenCb, tokens);
+}
+
+uint64_t tokenValue(const Tokens &tokens, size_t idx)
+{
+	if (idx >= tokens.size())
+		return 0;
+
+	return strtoull(tokens[idx].c_str(), nullptr, 10);
+}
+
+std::string tokenString(const Tokens &tokens, size_t idx, size_t size)
+{
+	if (idx >= tokens.size())
+		return std::string();
+
+	return tokens[idx].substr(0, size - 1);
+}
+
+// Copy of a sample, with its first byte at the given alignment
+char *alignedCopy(const std::string &sample, int offset)
+{
+	char *s = sBuffer + offset;
+
+	snprintf(s, SAMPLE_MAX_SIZE, "%s", sample.c_str());
+
+	return s;
+}
+
+void checkPidStat(const std::string &line)
+{
+	SystemMonitor::ProcessStats processStats;
+	SystemMonitor::ThreadStats threadStats;
+	int failures = sTestFailures;
+	Tokens tokens;
+	std::string name;
+	int ret;
+
+	tokenize(line.c_str(), &tokens);
+	name = tokenString(tokens, 1, sizeof(processStats.mName));
+
+	for (int offset = 0; offset < ALIGNMENT_COUNT; offset++) {
+		memset(&processStats, 0, sizeof(processStats));
+		ret = pfstools::readProcessStats(alignedCopy(line, offset),
+						 &processStats);
+		CHECK_EQ(ret, 0);
+		CHECK_EQ(processStats.mPid, (uint32_t) tokenValue(tokens, 0));
+		CHECK_STR_EQ(processStats.mName, name.c_str());
+		CHECK_EQ(processStats.mUtime, tokenValue(tokens, 13));
+		CHECK_EQ(processStats.mStime, tokenValue(tokens, 14));
+		CHECK_EQ(processStats.mThreadCount,
+			 (uint16_t) tokenValue(tokens, 19));
+		CHECK_EQ(processStats.mVsize, (uint32_t) tokenValue(tokens, 22));
+		CHECK_EQ(processStats.mRss, (uint32_t) tokenValue(tokens, 23));
+
+		memset(&threadStats, 0, sizeof(threadStats));
+		ret = pfstools::readThreadStats(alignedCopy(line, offset),
+						&threadStats);
+		CHECK_EQ(ret, 0);
+		CHECK_EQ(threadStats.mTid, (uint32_t) tokenValue(tokens, 0));
+		CHECK_STR_EQ(threadStats.mName, name.c_str());
+		CHECK_EQ(threadStats.mUtime, tokenValue(tokens, 13));
+		CHECK_EQ(threadStats.mStime, tokenValue(tokens, 14));
+
+		if (sTestFailures != failures)
+			break;
+	}
+
+	if (sTestFailures != failures)
+		fprintf(stderr, "  in '%s'\n", line.c_str());
+}
+
+// Expected values of a /proc/stat content, line by line
+void tokenizeSysStat(const std::string &sample,
+		     SystemMonitor::SystemStats *stats,
+		     std::vector<SystemMonitor::CpuStats> *cpuStats)
+{
+	SystemMonitor::CpuStats cpu;
+	std::string line;
+	size_t start = 0;
+	size_t end;
+	Tokens tokens;
+
+	memset(stats, 0, sizeof(*stats));
+	cpuStats->clear();
+
+	while (start < sample.size()) {
+		end = sample.find('\n', start);
+		if (end == std::string::npos)
+			end = sample.size();
+
+		line = sample.substr(start, end - start);
+		start = end + 1;
+
+		tokenize(line.c_str(), &tokens);
+		if (tokens.empty())
+			continue;
+
+		if (tokens[0] == "cpu") {
+			stats->mUtime = tokenValue(tokens, 1);
+			stats->mNice = tokenValue(tokens, 2);
+			stats->mStime = tokenValue(tokens, 3);
+			stats->mIdle = tokenValue(tokens, 4);
+			stats->mIoWait = tokenValue(tokens, 5);
+			stats->mIrq = tokenValue(tokens, 6);
+			stats->mSoftIrq = tokenValue(tokens, 7);
+		} else if (tokens[0].compare(0, 3, "cpu") == 0) {
+			memset(&cpu, 0, sizeof(cpu));
+			cpu.mCpu = strtoul(tokens[0].c_str() + 3, nullptr, 10);
+			cpu.mUtime = tokenValue(tokens, 1);
+			cpu.mNice = tokenValue(tokens, 2);
+			cpu.mStime = tokenValue(tokens, 3);
+			cpu.mIdle = tokenValue(tokens, 4);
+			cpu.mIoWait = tokenValue(tokens, 5);
+			cpu.mIrq = tokenValue(tokens, 6);
+			cpu.mSoftIrq = tokenValue(tokens, 7);
+			cpuStats->push_back(cpu);
+		} else if (tokens[0] == "intr") {
+			stats->mIrqCount = tokenValue(tokens, 1);
+		} else if (tokens[0] == "softirq") {
+			stats->mSoftIrqCount = tokenValue(tokens, 1);
+		} else if (tokens[0] == "ctxt") {
+			stats->mCtxSwitchCount = tokenValue(tokens, 1);
+		}
+	}
+}
+
+void checkSysStat(const std::string &sample)
+{
+	SystemMonitor::SystemStats expected;
+	SystemMonitor::SystemStats stats;
+	std::vector<SystemMonitor::CpuStats> expectedCpus;
+	std::vector<SystemMonitor::CpuStats> cpus;
+	int failures = sTestFailures;
+	int ret;
+
+	tokenizeSysStat(sample, &expected, &expectedCpus);
+
+	for (int offset = 0; offset < ALIGNMENT_COUNT; offset++) {
+		memset(&stats, 0, sizeof(stats));
+		ret = pfstools::readSystemStats(alignedCopy(sample, offset),
+						&stats, &cpus);
+		CHECK_EQ(ret, 0);
+		CHECK_EQ(stats.mUtime, expected.mUtime);
+		CHECK_EQ(stats.mNice, expected.mNice);
+		CHECK_EQ(stats.mStime, expected.mStime);
+		CHECK_EQ(stats.mIdle, expected.mIdle);
+		CHECK_EQ(stats.mIoWait, expected.mIoWait);
+		CHECK_EQ(stats.mIrq, expected.mIrq);
+		CHECK_EQ(stats.mSoftIrq, expected.mSoftIrq);
+		CHECK_EQ(stats.mIrqCount, expected.mIrqCount);
+		CHECK_EQ(stats.mSoftIrqCount, expected.mSoftIrqCount);
+		CHECK_EQ(stats.mCtxSwitchCount, expected.mCtxSwitchCount);
+
+		CHECK_EQ(cpus.size(), expectedCpus.size());
+		for (size_t i = 0; i < cpus.size() && i < expectedCpus.size(); i++) {
+			CHECK_EQ(cpus[i].mCpu, expectedCpus[i].mCpu);
+			CHECK_EQ(cpus[i].mUtime, expectedCpus[i].mUtime);
+			CHECK_EQ(cpus[i].mNice, expectedCpus[i].mNice);
+			CHECK_EQ(cpus[i].mStime, expectedCpus[i].mStime);
+			CHECK_EQ(cpus[i].mIdle, expectedCpus[i].mIdle);
+			CHECK_EQ(cpus[i].mIoWait, expectedCpus[i].mIoWait);
+			CHECK_EQ(cpus[i].mIrq, expectedCpus[i].mIrq);
+			CHECK_EQ(cpus[i].mSoftIrq, expectedCpus[i].mSoftIrq);
+		}
+
+		if (sTestFailures != failures)
+			break;
+	}
+
+	if (sTestFailures != failures)
+		fprintf(stderr, "  in '%s'\n", sample.c_str());
+}
+
+// Lines of a sample file, without comments and empty lines
+int readSampleFile(const std::string &path, std::vector<std::string> *lines)
+{
+	char *line = nullptr;
+	size_t size = 0;
+	ssize_t len;
+	FILE *f;
+
+	f = fopen(path.c_str(), "r");
+	if (!f) {
+		fprintf(stderr, "Fail to open %s : %d(%m)\n", path.c_str(), errno);
+		return -errno;
+	}
+
+	while ((len = getline(&line, &size, f)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		lines->push_back(line);
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+// Content of a procfs file, without the trailing '\n' like RawStats
+bool readProcFile(const char *path, std::string *content)
+{
+	char buf[SAMPLE_MAX_SIZE];
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+
+	if (buf[len - 1] == '\n')
+		len--;
+
+	content->assign(buf, len);
+
+	return true;
+}
+
+int checkCapturedSamples(const std::string &dataDir)
+{
+	std::vector<std::string> lines;
+	std::string sample;
+	int ret;
+
+	ret = readSampleFile(dataDir + "/pid_stat.txt", &lines);
+	if (ret < 0)
+		return ret;
+
+	CHECK(!lines.empty());
+	for (auto &line : lines)
+		checkPidStat(line);
+
+	lines.clear();
+	ret = readSampleFile(dataDir + "/sys_stat.txt", &lines);
+	if (ret < 0)
+		return ret;
+
+	CHECK(!lines.empty());
+	for (auto &line : lines) {
+		if (line == "---") {
+			checkSysStat(sample);
+			sample.clear();
+			continue;
+		}
+
+		if (!sample.empty())
+			sample += '\n';
+
+		sample += line;
+	}
+
+	if (!sample.empty())
+		checkSysStat(sample);
+
+	return 0;
+}
+
+// Per cpu lines, beyond the differential test : ids with gaps, the
+// aggregate line, a line cut by a full read buffer
+void checkPerCpu()
+{
+	char sample[] =
+		"cpu  300 3 30 3000 6 0 9 0 0 0\n"
+		"cpu0 100 1 10 1000 2 0 3 0 0 0\n"
+		"cpu3 100 1 10 1000 2 0 3 0 0 0\n"
+		"cpu12 100 1 10 1000 2 0 3 0 0 0\n"
+		"intr 42 0 0\n"
+		"ctxt 43";
+	char noCpu[] =
+		"cpu  300 3 30 3000 6 0 9 0 0 0\n"
+		"ctxt 43";
+	char cut[] =
+		"cpu  300 3 30 3000 6 0 9 0 0 0\n"
+		"cpu0 100 1 10 1000 2 0 3 0 0 0\n"
+		"cpu1 100 1";
+	const int ids[] = { 0, 3, 12 };
+	SystemMonitor::SystemStats stats;
+	std::vector<SystemMonitor::CpuStats> cpus;
+	std::string copy = sample;
+	int ret;
+
+	// Lines are split in place
+	memset(&stats, 0, sizeof(stats));
+	ret = pfstools::readSystemStats(sample, &stats, &cpus);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(stats.mUtime, 300);
+	CHECK_EQ(stats.mIdle, 3000);
+	CHECK_EQ(stats.mSoftIrq, 9);
+	CHECK_EQ(stats.mIrqCount, 42);
+	CHECK_EQ(stats.mCtxSwitchCount, 43);
+
+	// The aggregate line is not a cpu, offline cpus have no entry
+	CHECK_EQ(cpus.size(), SIZEOF_ARRAY(ids));
+	for (size_t i = 0; i < cpus.size() && i < SIZEOF_ARRAY(ids); i++) {
+		CHECK_EQ(cpus[i].mCpu, ids[i]);
+		CHECK_EQ(cpus[i].mUtime, 100);
+		CHECK_EQ(cpus[i].mNice, 1);
+		CHECK_EQ(cpus[i].mStime, 10);
+		CHECK_EQ(cpus[i].mIdle, 1000);
+		CHECK_EQ(cpus[i].mIoWait, 2);
+		CHECK_EQ(cpus[i].mIrq, 0);
+		CHECK_EQ(cpus[i].mSoftIrq, 3);
+	}
+
+	// Entries of a previous read are dropped
+	ret = pfstools::readSystemStats(noCpu, &stats, &cpus);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(cpus.size(), 0);
+
+	// Only the complete lines
+	ret = pfstools::readSystemStats(cut, &stats, &cpus);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(cpus.size(), 1);
+	if (cpus.size() == 1)
+		CHECK_EQ(cpus[0].mCpu, 0);
+
+	// Per cpu lines are optional
+	memset(&stats, 0, sizeof(stats));
+	ret = pfstools::readSystemStats(&copy[0], &stats, nullptr);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(stats.mUtime, 300);
+	CHECK_EQ(stats.mCtxSwitchCount, 43);
+}
+
+void checkHostSamples()
+{
+	struct dirent *entry;
+	std::string content;
+	char path[PATH_MAX];
+	DIR *dir;
+	DIR *taskDir;
+
+	if (readProcFile("/proc/stat", &content))
+		checkSysStat(content);
+
+	dir = opendir("/proc");
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) != nullptr) {
+		if (entry->d_name[0] < '1' || entry->d_name[0] > '9')
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+		if (readProcFile(path, &content))
+			checkPidStat(content);
+
+		snprintf(path, sizeof(path), "/proc/%s/task", entry->d_name);
+		taskDir = opendir(path);
+		if (!taskDir)
+			continue;
+
+		for (auto task = readdir(taskDir); task; task = readdir(taskDir)) {
+			if (task->d_name[0] < '1' || task->d_name[0] > '9')
+				continue;
+
+			snprintf(path, sizeof(path), "/proc/%s/task/%s/stat",
+				 entry->d_name, task->d_name);
+			if (readProcFile(path, &content))
+				checkPidStat(content);
+		}
+
+		closedir(taskDir);
+	}
+
+	closedir(dir);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage : %s DATA_DIR\n", argv[0]);
+		return 1;
+	}
+
+	ret = checkCapturedSamples(argv[1]);
+	if (ret < 0)
+		return 1;
+
+	checkPerCpu();
+	checkHostSamples();
+
+	return testResult("statparser");
+}
@@ -0,0 +1,58 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# Jitter percentiles of genoutput.py
+#
+# Usage : stats_test.py TOOLS_DIR
+
+import sys
+import unittest
+
+sys.path.insert(0, sys.argv.pop(1))
+
+from ssr.stats import percentile, jitterPercentiles
+
+class JitterPercentilesTest(unittest.TestCase):
+	def testSingleValue(self):
+		self.assertEqual(jitterPercentiles([42]), (42, 42, 42))
+
+	def testUnsorted(self):
+		self.assertEqual(jitterPercentiles([5, 1, 4, 2, 3]), (3, 5, 5))
+
+	def testHundredValues(self):
+		values = list(range(100, 0, -1))
+
+		self.assertEqual(jitterPercentiles(values), (50, 99, 100))
+
+	def testThousandValues(self):
+		values = list(range(1, 1001))
+
+		self.assertEqual(jitterPercentiles(values), (500, 990, 1000))
+
+	def testFewValues(self):
+		# Under 100 values, the p99 is the max
+		values = list(range(1, 11))
+
+		self.assertEqual(jitterPercentiles(values), (5, 10, 10))
+
+	def testOutlier(self):
+		# 2 outliers in 100 values are above the p99, 1 is not
+		values = [10] * 98 + [1000, 2000]
+		self.assertEqual(jitterPercentiles(values), (10, 1000, 2000))
+
+		values = [10] * 99 + [2000]
+		self.assertEqual(jitterPercentiles(values), (10, 10, 2000))
+
+	def testFloats(self):
+		self.assertEqual(jitterPercentiles([0.5, 2.5, 1.5]), (1.5, 2.5, 2.5))
+
+	def testPercentileBounds(self):
+		values = [1, 2, 3, 4]
+
+		self.assertEqual(percentile(values, 0), 1)
+		self.assertEqual(percentile(values, 25), 1)
+		self.assertEqual(percentile(values, 26), 2)
+		self.assertEqual(percentile(values, 100), 4)
+
+if __name__ == '__main__':
+	unittest.main()
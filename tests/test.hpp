@@ -0,0 +1,51 @@
+#ifndef __SSR_TEST_HPP__
+#define __SSR_TEST_HPP__
+
+/**
+ * Checks of the test executables. A failed check is reported and counted,
+ * the test goes on : testResult() gives the exit code.
+ */
+static int sTestFailures = 0;
+
+#define CHECK(_cond) \
+	do { \
+		if (!(_cond)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", \
+				__FILE__, __LINE__, #_cond); \
+			sTestFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(_a, _b) \
+	do { \
+		unsigned long long __a = (unsigned long long) (_a); \
+		unsigned long long __b = (unsigned long long) (_b); \
+		if (__a != __b) { \
+			fprintf(stderr, "%s:%d: %s == %s failed : %llu != %llu\n", \
+				__FILE__, __LINE__, #_a, #_b, __a, __b); \
+			sTestFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_STR_EQ(_a, _b) \
+	do { \
+		if (strcmp((_a), (_b)) != 0) { \
+			fprintf(stderr, "%s:%d: %s == %s failed : '%s' != '%s'\n", \
+				__FILE__, __LINE__, #_a, #_b, (_a), (_b)); \
+			sTestFailures++; \
+		} \
+	} while (0)
+
+static inline int testResult(const char *name)
+{
+	if (sTestFailures > 0) {
+		fprintf(stderr, "%s : %d check(s) failed\n", name, sTestFailures);
+		return 1;
+	}
+
+	printf("%s : ok\n", name);
+
+	return 0;
+}
+
+#endif // !__SSR_TEST_HPP__
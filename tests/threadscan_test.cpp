@@ -0,0 +1,382 @@
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <set>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Incremental thread tracking : a child starts and joins threads between
+ * acquisitions, the threads read by each acquisition must converge to the
+ * task directory of the child. Run with /proc scans, then with proc
+ * events, where a burst of short threads overflows the event socket so
+ * that the threads created after it are only found by a rescan.
+ */
+
+#define CHILD_NAME "ssr_scan_test"
+#define CHILD_THREAD_COUNT 2
+
+// Short threads of a burst, and threads kept after it
+#define BURST_COUNT 3000
+#define BURST_KEPT 3
+
+#define ACQ_PERIOD_MS 50
+#define CONVERGE_TIMEOUT_MS 3000
+
+// Child commands
+#define CMD_START '+'
+#define CMD_STOP '-'
+#define CMD_CHURN 'c'
+#define CMD_BURST 'b'
+
+namespace {
+
+typedef std::set<int> Tids;
+
+// Threads kept by the child, each one waits for its pipe to be closed
+struct ChildThread {
+	std::thread mThread;
+	int mFd;
+};
+
+void startThread(std::list<ChildThread> *threads)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		_exit(1);
+
+	threads->emplace_back();
+	threads->back().mFd = fds[1];
+	threads->back().mThread = std::thread([fds] () {
+		char c;
+
+		while (read(fds[0], &c, 1) > 0)
+			;
+
+		close(fds[0]);
+	});
+}
+
+void stopThread(std::list<ChildThread> *threads)
+{
+	if (threads->empty())
+		return;
+
+	close(threads->front().mFd);
+	threads->front().mThread.join();
+	threads->pop_front();
+}
+
+void runChild(int cmdFd, int ackFd)
+{
+	std::list<ChildThread> threads;
+	char cmd;
+
+	prctl(PR_SET_NAME, CHILD_NAME);
+
+	for (int i = 0; i < CHILD_THREAD_COUNT; i++)
+		startThread(&threads);
+
+	while (read(cmdFd, &cmd, 1) == 1) {
+		switch (cmd) {
+		case CMD_START:
+			startThread(&threads);
+			break;
+
+		case CMD_STOP:
+			stopThread(&threads);
+			break;
+
+		case CMD_CHURN:
+			stopThread(&threads);
+			startThread(&threads);
+			break;
+
+		case CMD_BURST:
+			for (int i = 0; i < BURST_COUNT; i++)
+				std::thread([] () {}).join();
+
+			for (int i = 0; i < BURST_KEPT; i++)
+				startThread(&threads);
+			break;
+
+		default:
+			break;
+		}
+
+		if (write(ackFd, &cmd, 1) != 1)
+			break;
+	}
+
+	_exit(0);
+}
+
+struct Child {
+	pid_t mPid;
+	int mCmdFd;
+	int mAckFd;
+};
+
+int startChild(Child *child)
+{
+	int cmd[2];
+	int ack[2];
+
+	if (pipe(cmd) < 0)
+		return -errno;
+
+	if (pipe(ack) < 0) {
+		close(cmd[0]);
+		close(cmd[1]);
+		return -errno;
+	}
+
+	child->mPid = fork();
+	if (child->mPid == 0) {
+		close(cmd[1]);
+		close(ack[0]);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		runChild(cmd[0], ack[1]);
+	}
+
+	close(cmd[0]);
+	close(ack[1]);
+	child->mCmdFd = cmd[1];
+	child->mAckFd = ack[0];
+
+	return child->mPid > 0 ? 0 : -ECHILD;
+}
+
+void stopChild(Child *child)
+{
+	close(child->mCmdFd);
+	close(child->mAckFd);
+	kill(child->mPid, SIGKILL);
+	waitpid(child->mPid, nullptr, 0);
+}
+
+bool sendCommand(Child *child, char cmd)
+{
+	char ack;
+
+	return write(child->mCmdFd, &cmd, 1) == 1 &&
+	       read(child->mAckFd, &ack, 1) == 1;
+}
+
+void readTaskDir(pid_t pid, Tids *tids)
+{
+	struct dirent *entry;
+	char path[64];
+	DIR *dir;
+
+	tids->clear();
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) != nullptr) {
+		if (entry->d_name[0] >= '1' && entry->d_name[0] <= '9')
+			tids->insert(atoi(entry->d_name));
+	}
+
+	closedir(dir);
+}
+
+struct MonitorCtx {
+	pid_t mChild;
+
+	// Threads of the child read by the current and the last acquisition
+	Tids mCurrent;
+	Tids mLast;
+	int mAcqCount;
+	int mDuplicates;
+
+	MonitorCtx()
+	{
+		mChild = -1;
+		mAcqCount = 0;
+		mDuplicates = 0;
+	}
+};
+
+void threadStatsCb(const SystemMonitor::ThreadStats &stats, void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	if ((pid_t) stats.mPid != ctx->mChild)
+		return;
+
+	if (!ctx->mCurrent.insert(stats.mTid).second)
+		ctx->mDuplicates++;
+}
+
+void resultsBeginCb(const SystemMonitor::AcquisitionDuration &stats,
+		    void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	ctx->mCurrent.clear();
+}
+
+void resultsEndCb(void *userdata)
+{
+	MonitorCtx *ctx = (MonitorCtx *) userdata;
+
+	ctx->mLast = ctx->mCurrent;
+	ctx->mAcqCount++;
+}
+
+uint64_t nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Run acquisitions until the last one has read every thread of the child
+bool converge(EventLoop *loop, MonitorCtx *ctx)
+{
+	uint64_t deadline = nowMs() + CONVERGE_TIMEOUT_MS;
+	Tids expected;
+	int acqCount;
+
+	readTaskDir(ctx->mChild, &expected);
+
+	while (nowMs() < deadline) {
+		acqCount = ctx->mAcqCount;
+		loop->wait(ACQ_PERIOD_MS);
+		if (ctx->mAcqCount != acqCount && ctx->mLast == expected)
+			return true;
+	}
+
+	fprintf(stderr, "%zu threads read, %zu expected\n",
+		ctx->mLast.size(), expected.size());
+
+	return false;
+}
+
+void checkTracking(bool procEvents)
+{
+	SystemMonitor::Callbacks cb;
+	SystemMonitor::Config config;
+	SystemMonitor *mon = nullptr;
+	EventLoop loop;
+	MonitorCtx ctx;
+	Child child;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	ret = startChild(&child);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	ctx.mChild = child.mPid;
+
+	// Threads started
+	CHECK(sendCommand(&child, CMD_CHURN));
+
+	cb.mThreadStats = threadStatsCb;
+	cb.mResultsBegin = resultsBeginCb;
+	cb.mResultsEnd = resultsEndCb;
+	cb.mUserdata = &ctx;
+
+	config.mAcqPeriodMs = ACQ_PERIOD_MS;
+	config.mProcEvents = procEvents;
+
+	ret = SystemMonitor::create(&loop, config, cb, &mon);
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	CHECK_EQ(mon->addProcess(CHILD_NAME), 0);
+	mon->loadProcesses();
+
+	ret = mon->start();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	CHECK(converge(&loop, &ctx));
+	CHECK_EQ(ctx.mLast.size(), CHILD_THREAD_COUNT + 1);
+
+	// New threads
+	for (int i = 0; i < 3; i++)
+		CHECK(sendCommand(&child, CMD_START));
+
+	CHECK(converge(&loop, &ctx));
+
+	// Exited threads
+	for (int i = 0; i < 2; i++)
+		CHECK(sendCommand(&child, CMD_STOP));
+
+	CHECK(converge(&loop, &ctx));
+
+	// Same thread count, other tids
+	for (int i = 0; i < 5; i++)
+		CHECK(sendCommand(&child, CMD_CHURN));
+
+	CHECK(converge(&loop, &ctx));
+
+	// Churn between acquisitions
+	for (int i = 0; i < 10; i++) {
+		CHECK(sendCommand(&child, CMD_CHURN));
+		CHECK(sendCommand(&child, i % 2 ? CMD_START : CMD_STOP));
+		loop.wait(ACQ_PERIOD_MS / 2);
+	}
+
+	CHECK(converge(&loop, &ctx));
+
+	// Events lost while the loop doesn't run
+	CHECK(sendCommand(&child, CMD_BURST));
+	CHECK(converge(&loop, &ctx));
+
+	CHECK_EQ(ctx.mDuplicates, 0);
+
+	mon->stop();
+
+out:
+	delete mon;
+	stopChild(&child);
+}
+
+bool hasProcEvents()
+{
+	ProcEvents::Callbacks cb;
+	ProcEvents events;
+	EventLoop loop;
+
+	// Needs CAP_NET_ADMIN
+	if (loop.init() < 0 || events.init(&loop, cb) < 0)
+		return false;
+
+	events.clear();
+
+	return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkTracking(false);
+
+	if (hasProcEvents())
+		checkTracking(true);
+	else
+		printf("threadscan : proc events unavailable, skipped\n");
+
+	return testResult("threadscan");
+}
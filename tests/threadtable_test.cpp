@@ -0,0 +1,209 @@
+#include <map>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * ThreadTable index : lookups after inserts and removes, with probe
+ * sequences wrapping around the end of the slots and rehashes, checked
+ * against a std::map.
+ */
+
+// Tids of the same slot in the initial 16 slots, the hash keeps the low
+// bits of the tid there
+#define LAST_SLOT_TIDS { 15, 31, 47, 63 }
+
+#define RANDOM_OPS 20000
+#define RANDOM_MAX_TID 512
+
+namespace {
+
+void checkEntry(ThreadTable *table, int tid, int fd)
+{
+	int idx = table->find(tid);
+
+	CHECK(idx >= 0);
+	if (idx < 0)
+		return;
+
+	CHECK_EQ(table->hot(idx).mTid, tid);
+	CHECK_EQ(table->hot(idx).mFd, fd);
+}
+
+void checkWrapAround()
+{
+	const int tids[] = LAST_SLOT_TIDS;
+	ThreadTable table;
+	int idx;
+
+	// Probe sequence of the last slot goes on from the first one
+	for (auto tid : tids)
+		CHECK_EQ(table.insert(tid, tid + 1000, "thread"), table.size() - 1);
+
+	// In the slots taken by the wrapped sequence
+	CHECK_EQ(table.insert(16, 1016, "thread"), 4);
+	CHECK_EQ(table.insert(1, 1001, "thread"), 5);
+
+	for (auto tid : tids)
+		checkEntry(&table, tid, tid + 1000);
+
+	checkEntry(&table, 16, 1016);
+	checkEntry(&table, 1, 1001);
+
+	// Same slot, not inserted
+	CHECK_EQ(table.find(79), -1);
+	CHECK_EQ(table.find(0), -1);
+
+	CHECK_EQ(table.insert(47, 0, "thread"), -EEXIST);
+	CHECK_EQ(table.insert(2, 0, nullptr), -EINVAL);
+	CHECK_EQ(table.size(), 6);
+
+	// Backward shift over the wrap : the entries after the freed slot
+	// stay reachable
+	table.remove(table.find(15));
+	CHECK_EQ(table.find(15), -1);
+	for (auto tid : { 31, 47, 63 })
+		checkEntry(&table, tid, tid + 1000);
+
+	checkEntry(&table, 16, 1016);
+	checkEntry(&table, 1, 1001);
+
+	table.remove(table.find(47));
+	CHECK_EQ(table.find(47), -1);
+	checkEntry(&table, 31, 1031);
+	checkEntry(&table, 63, 1063);
+	checkEntry(&table, 16, 1016);
+	checkEntry(&table, 1, 1001);
+
+	// A freed slot is reused
+	idx = table.insert(15, 2015, "again");
+	CHECK_EQ(idx, 4);
+	checkEntry(&table, 15, 2015);
+	CHECK_STR_EQ(table.cold(idx).mName, "again");
+
+	// An entry in its own slot after the wrap is not moved back into
+	// the freed last slot
+	ThreadTable home;
+
+	CHECK_EQ(home.insert(15, 15, "thread"), 0);
+	CHECK_EQ(home.insert(16, 16, "thread"), 1);
+	CHECK_EQ(home.insert(32, 32, "thread"), 2);
+	home.remove(0);
+	checkEntry(&home, 16, 16);
+	checkEntry(&home, 32, 32);
+	CHECK_EQ(home.find(15), -1);
+}
+
+void checkRemoveMovesLast()
+{
+	ThreadTable table;
+	int idx;
+
+	for (int tid = 100; tid < 105; tid++) {
+		idx = table.insert(tid, tid, "thread");
+		snprintf(table.cold(idx).mName, sizeof(table.cold(idx).mName),
+			 "t%d", tid);
+		table.cold(idx).mScanGen = tid;
+	}
+
+	// Last entry moved in the hole, with its cold part
+	table.remove(1);
+	CHECK_EQ(table.size(), 4);
+	CHECK_EQ(table.find(101), -1);
+	CHECK_EQ(table.find(104), 1);
+	CHECK_EQ(table.hot(1).mTid, 104);
+	CHECK_STR_EQ(table.cold(1).mName, "t104");
+	CHECK_EQ(table.cold(1).mScanGen, 104);
+
+	// Last entry itself
+	table.remove(3);
+	CHECK_EQ(table.size(), 3);
+	CHECK_EQ(table.find(103), -1);
+	checkEntry(&table, 100, 100);
+	checkEntry(&table, 104, 104);
+	checkEntry(&table, 102, 102);
+
+	// Out of range
+	table.remove(3);
+	CHECK_EQ(table.size(), 3);
+
+	table.clear();
+	CHECK_EQ(table.size(), 0);
+	CHECK_EQ(table.find(100), -1);
+	CHECK_EQ(table.insert(100, 1, "thread"), 0);
+}
+
+void checkRehash()
+{
+	ThreadTable table;
+
+	// Same low bits : long probe sequences, moved by each rehash
+	for (int i = 0; i < 200; i++)
+		CHECK_EQ(table.insert(i * 64 + 15, i, "thread"), i);
+
+	for (int i = 0; i < 200; i++)
+		checkEntry(&table, i * 64 + 15, i);
+
+	for (int i = 0; i < 200; i += 2)
+		table.remove(table.find(i * 64 + 15));
+
+	CHECK_EQ(table.size(), 100);
+	for (int i = 0; i < 200; i++) {
+		if (i % 2 == 0)
+			CHECK_EQ(table.find(i * 64 + 15), -1);
+		else
+			checkEntry(&table, i * 64 + 15, i);
+	}
+}
+
+// Inserts and removes of random tids, in a table that grows and shrinks
+void checkRandom()
+{
+	std::map<int, int> ref;
+	ThreadTable table;
+	uint32_t seed = 1;
+	int tid;
+	int idx;
+
+	for (int i = 0; i < RANDOM_OPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		tid = (seed >> 8) % RANDOM_MAX_TID + 1;
+
+		idx = table.find(tid);
+		if (ref.count(tid) == 0) {
+			CHECK_EQ(idx, -1);
+			CHECK(table.insert(tid, i, "thread") >= 0);
+			ref[tid] = i;
+		} else if (idx < 0) {
+			CHECK(idx >= 0);
+		} else {
+			CHECK_EQ(table.hot(idx).mFd, ref[tid]);
+			table.remove(idx);
+			ref.erase(tid);
+		}
+	}
+
+	CHECK_EQ(table.size(), ref.size());
+	for (auto &p : ref)
+		checkEntry(&table, p.first, p.second);
+
+	// Emptied one by one
+	while (table.size() > 0) {
+		ref.erase(table.hot(0).mTid);
+		table.remove(0);
+
+		for (auto &p : ref)
+			checkEntry(&table, p.first, p.second);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkWrapAround();
+	checkRemoveMovesLast();
+	checkRehash();
+	checkRandom();
+
+	return testResult("threadtable");
+}
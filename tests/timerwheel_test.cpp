@@ -0,0 +1,235 @@
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * Timers of the EventLoop wheel : one-shot timers on both sides of the
+ * level boundaries (64 ticks and 4096 ticks), which cascade down before
+ * expiring, timers re-armed and cancelled by callbacks, and a periodic
+ * timer.
+ *
+ * Timers never expire before their deadline, which is rounded up to the
+ * 1 ms tick, and run in deadline order.
+ */
+
+#define MS 1000000ULL
+
+// Wakeups may be delayed by the scheduler, not by more than this
+#define MAX_LATENESS (50 * MS)
+
+#define REARM_MS 10
+#define REARM_COUNT 5
+
+#define PERIOD_MS 30
+
+#define RUN_MS 4400
+
+namespace {
+
+uint64_t nowNs()
+{
+	uint64_t ns = 0;
+
+	pfstools::getTimeNs(&ns);
+
+	return ns;
+}
+
+struct timespec nsToTs(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+
+	return ts;
+}
+
+struct OneShot {
+	Timer mTimer;
+	uint64_t mDelay;
+	uint64_t mDeadline;
+	uint64_t mExpired;
+	uint64_t mLateness;
+	int mCount;
+	int mRank;
+};
+
+void checkOneShots()
+{
+	// Not multiples of the tick : rounded up. Level 1 from 64 ms, level 2
+	// from 4096 ms.
+	const uint64_t delays[] = {
+		500000, 1 * MS, 2 * MS + 500000, 63 * MS, 64 * MS,
+		64 * MS + 1, 65 * MS, 127 * MS, 128 * MS, 129 * MS + 300000,
+		1000 * MS, 4095 * MS, 4096 * MS, 4097 * MS + 1, 4200 * MS,
+	};
+	const int count = SIZEOF_ARRAY(delays);
+	std::vector<OneShot> timers(count);
+	Timer cancelled;
+	Timer canceller;
+	Timer moved;
+	Timer mover;
+	Timer periodic;
+	uint64_t periodicTs[RUN_MS / PERIOD_MS + 1];
+	uint64_t periodicStart;
+	uint64_t movedDeadline = 0;
+	uint64_t movedTs = 0;
+	uint64_t deadline;
+	bool cancelledRun = false;
+	int periodicCount = 0;
+	int expiredCount = 0;
+	EventLoop loop;
+	uint64_t now;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	for (int i = 0; i < count; i++) {
+		OneShot *t = &timers[i];
+
+		t->mDelay = delays[i];
+		t->mExpired = 0;
+		t->mLateness = 0;
+		t->mCount = 0;
+		t->mRank = -1;
+		t->mDeadline = nowNs() + t->mDelay;
+
+		ret = t->mTimer.set(&loop, nsToTs(t->mDelay),
+			[t, &expiredCount] () {
+				t->mExpired = nowNs();
+				t->mLateness = t->mTimer.getLateness();
+				t->mRank = expiredCount++;
+				t->mCount++;
+			});
+		CHECK_EQ(ret, 0);
+	}
+
+	// Cleared before its deadline by another timer
+	ret = cancelled.set(&loop, nsToTs(100 * MS),
+		[&] () { cancelledRun = true; });
+	CHECK_EQ(ret, 0);
+	ret = canceller.set(&loop, nsToTs(50 * MS),
+		[&] () { CHECK_EQ(cancelled.clear(), 0); });
+	CHECK_EQ(ret, 0);
+
+	// Moved from level 0 to level 1
+	ret = moved.set(&loop, nsToTs(60 * MS),
+		[&] () { movedTs = nowNs(); });
+	CHECK_EQ(ret, 0);
+	ret = mover.set(&loop, nsToTs(40 * MS),
+		[&] () {
+			movedDeadline = nowNs() + 200 * MS;
+			CHECK_EQ(moved.clear(), 0);
+			CHECK_EQ(moved.set(&loop, nsToTs(200 * MS),
+				 [&] () { movedTs = nowNs(); }), 0);
+		});
+	CHECK_EQ(ret, 0);
+
+	// Keeps its phase
+	periodicStart = nowNs();
+	ret = periodic.setPeriodic(&loop, nsToTs(PERIOD_MS * MS),
+		[&] () {
+			if (periodicCount < (int) SIZEOF_ARRAY(periodicTs))
+				periodicTs[periodicCount++] = nowNs();
+		});
+	CHECK_EQ(ret, 0);
+
+	deadline = nowNs() + RUN_MS * MS;
+	while (true) {
+		now = nowNs();
+		if (now >= deadline)
+			break;
+
+		loop.wait((deadline - now) / MS + 1);
+	}
+
+	periodic.clear();
+
+	// Each one-shot once, in deadline order, never early
+	CHECK_EQ(expiredCount, count);
+	for (int i = 0; i < count; i++) {
+		OneShot *t = &timers[i];
+
+		CHECK_EQ(t->mCount, 1);
+		CHECK(t->mExpired >= t->mDeadline);
+		CHECK(t->mExpired - t->mDeadline < MAX_LATENESS);
+		CHECK(t->mLateness <= t->mExpired - t->mDeadline + MS);
+		if (i > 0)
+			CHECK(t->mRank > timers[i - 1].mRank);
+	}
+
+	CHECK(!cancelledRun);
+
+	CHECK(movedDeadline != 0);
+	CHECK(movedTs >= movedDeadline);
+	CHECK(movedTs - movedDeadline < MAX_LATENESS);
+
+	// Expiries on the multiples of the period since the start
+	CHECK(periodicCount >= RUN_MS / PERIOD_MS - 2);
+	for (int i = 0; i < periodicCount; i++) {
+		CHECK(periodicTs[i] >= periodicStart + (i + 1) * PERIOD_MS * MS);
+		if (i > 0)
+			CHECK(periodicTs[i] > periodicTs[i - 1]);
+	}
+}
+
+// A timer set again by its callback, REARM_COUNT times : each deadline
+// counts from the call
+void checkRearm()
+{
+	uint64_t ts[REARM_COUNT];
+	EventLoop loop;
+	Timer timer;
+	TimerCb cb;
+	uint64_t deadline;
+	uint64_t setTs;
+	int count = 0;
+	int ret;
+
+	ret = loop.init();
+	CHECK_EQ(ret, 0);
+	if (ret < 0)
+		return;
+
+	cb = [&] () {
+		ts[count++] = nowNs();
+		if (count == REARM_COUNT)
+			return;
+
+		CHECK_EQ(timer.clear(), 0);
+		setTs = nowNs();
+		CHECK_EQ(timer.set(&loop, nsToTs(REARM_MS * MS), cb), 0);
+	};
+
+	setTs = nowNs();
+	ret = timer.set(&loop, nsToTs(REARM_MS * MS), cb);
+	CHECK_EQ(ret, 0);
+
+	deadline = nowNs() + 2 * REARM_COUNT * REARM_MS * MS;
+	while (count < REARM_COUNT && nowNs() < deadline)
+		loop.wait(REARM_MS);
+
+	CHECK_EQ(count, REARM_COUNT);
+	for (int i = 1; i < count; i++)
+		CHECK(ts[i] >= ts[i - 1] + REARM_MS * MS);
+
+	CHECK(ts[count - 1] >= setTs + REARM_MS * MS);
+
+	// A set timer must be cleared first
+	CHECK_EQ(timer.set(&loop, nsToTs(REARM_MS * MS), cb), -EPERM);
+	CHECK_EQ(timer.clear(), 0);
+	CHECK_EQ(timer.clear(), -EPERM);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkRearm();
+	checkOneShots();
+
+	return testResult("timerwheel");
+}
@@ -0,0 +1,173 @@
+#include <unistd.h>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * TimeSource timestamps : monotonic across calls, threads and resyncs, and
+ * close to CLOCK_MONOTONIC. The TSC checks are skipped without an invariant
+ * TSC.
+ */
+
+// Allowed distance to CLOCK_MONOTONIC
+#define MAX_ERROR_NS 200000ULL
+
+#define CALL_COUNT 1000000
+#define RESYNC_PERIOD 1000
+#define THREAD_COUNT 4
+
+namespace {
+
+uint64_t monotonicNs()
+{
+	uint64_t ns;
+
+	pfstools::getTimeNs(&ns);
+
+	return ns;
+}
+
+// Timestamp between two CLOCK_MONOTONIC reads, as close as they allow
+void checkCloseToMonotonic()
+{
+	uint64_t before = monotonicNs();
+	uint64_t ts = TimeSource::now();
+	uint64_t after = monotonicNs();
+
+	CHECK(ts + MAX_ERROR_NS >= before);
+	CHECK(ts <= after + MAX_ERROR_NS);
+}
+
+void checkMonotonic(bool resync)
+{
+	uint64_t prev = TimeSource::now();
+	uint64_t ts;
+	int backward = 0;
+
+	for (int i = 0; i < CALL_COUNT; i++) {
+		if (resync && i % RESYNC_PERIOD == 0)
+			TimeSource::resync();
+
+		ts = TimeSource::now();
+		if (ts < prev)
+			backward++;
+
+		prev = ts;
+	}
+
+	CHECK_EQ(backward, 0);
+}
+
+// Each thread sees its timestamps increase, and never gets one older than
+// a timestamp published by another thread before
+void checkThreads()
+{
+	std::atomic<uint64_t> published(0);
+	std::atomic<int> backward(0);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		threads.push_back(std::thread([&published, &backward] () {
+			uint64_t prev = 0;
+			uint64_t seen;
+			uint64_t ts;
+
+			for (int j = 0; j < CALL_COUNT / THREAD_COUNT; j++) {
+				seen = published.load(std::memory_order_acquire);
+				ts = TimeSource::now();
+				if (ts < prev || ts < seen)
+					backward++;
+
+				prev = ts;
+				while (seen < ts && !published.compare_exchange_weak(
+						seen, ts, std::memory_order_release))
+					;
+			}
+		}));
+	}
+
+	for (auto &t : threads)
+		t.join();
+
+	CHECK_EQ(backward, 0);
+}
+
+#ifdef __x86_64__
+// A reference behind the given timestamps slows the scale down, then the
+// timestamps catch CLOCK_MONOTONIC up
+void checkBackwardReference()
+{
+	uint64_t before;
+	uint64_t after;
+	uint64_t prev;
+	uint64_t ts;
+	int backward = 0;
+
+	before = TimeSource::now();
+	TimeSource::resync(__rdtsc(), monotonicNs() - 10000000);
+	after = TimeSource::now();
+	CHECK(after >= before);
+
+	prev = after;
+	for (int i = 0; i < 40; i++) {
+		usleep(5000);
+		TimeSource::resync();
+
+		ts = TimeSource::now();
+		if (ts < prev)
+			backward++;
+
+		prev = ts;
+	}
+
+	CHECK_EQ(backward, 0);
+	checkCloseToMonotonic();
+}
+
+// A TSC read behind the base gives the base, not a wrapped delta
+void checkTscBehindBase()
+{
+	uint64_t ns = monotonicNs() + 1000000000ULL;
+	uint64_t ts;
+
+	TimeSource::resync(__rdtsc() + 1000000000ULL, ns);
+
+	ts = TimeSource::now();
+	CHECK(ts >= ns);
+	CHECK(ts < ns + MAX_ERROR_NS);
+}
+#endif
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = TimeSource::init(SystemMonitor::ClockSource::monotonic);
+	CHECK_EQ(ret, 0);
+	CHECK(TimeSource::getSource() == SystemMonitor::ClockSource::monotonic);
+	checkCloseToMonotonic();
+	checkMonotonic(false);
+
+	ret = TimeSource::init(SystemMonitor::ClockSource::tsc);
+	if (ret == -ENOTSUP) {
+		printf("No invariant TSC, TSC checks skipped\n");
+		return testResult("timesource");
+	}
+
+	CHECK_EQ(ret, 0);
+	CHECK(TimeSource::getSource() == SystemMonitor::ClockSource::tsc);
+	checkCloseToMonotonic();
+	checkMonotonic(true);
+	checkThreads();
+	checkCloseToMonotonic();
+
+#ifdef __x86_64__
+	checkBackwardReference();
+
+	// Last : the base is left one second ahead
+	checkTscBehindBase();
+#endif
+
+	return testResult("timesource");
+}
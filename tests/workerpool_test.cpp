@@ -0,0 +1,163 @@
+#include <set>
+#include "ssr_priv.hpp"
+#include "test.hpp"
+
+/**
+ * WorkerPool jobs, with the caller running job 0 or with a dedicated
+ * thread per job as used by the real-time acquisition mode, and across
+ * stop()/start() cycles.
+ */
+
+#define JOB_COUNT 4
+#define RUN_COUNT 100
+
+namespace {
+
+struct RunStats {
+	std::mutex mMutex;
+	int mJobRuns[JOB_COUNT];
+	int mCallerJobs[JOB_COUNT];
+	std::set<std::thread::id> mJobThreads[JOB_COUNT];
+
+	RunStats()
+	{
+		memset(mJobRuns, 0, sizeof(mJobRuns));
+		memset(mCallerJobs, 0, sizeof(mCallerJobs));
+	}
+};
+
+void runJobs(WorkerPool *pool, RunStats *stats)
+{
+	std::thread::id caller = std::this_thread::get_id();
+
+	WorkerPool::JobCb cb = [stats, caller] (int job) {
+		std::lock_guard<std::mutex> lock(stats->mMutex);
+
+		if (job < 0 || job >= JOB_COUNT)
+			return;
+
+		stats->mJobRuns[job]++;
+		stats->mJobThreads[job].insert(std::this_thread::get_id());
+		if (std::this_thread::get_id() == caller)
+			stats->mCallerJobs[job]++;
+	};
+
+	for (int i = 0; i < RUN_COUNT; i++)
+		pool->run(cb);
+}
+
+void checkShared()
+{
+	std::atomic<int> initCount(0);
+	WorkerPool pool;
+	RunStats stats;
+	int ret;
+
+	ret = pool.start(JOB_COUNT, false, [&initCount] () { initCount++; });
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(pool.getJobCount(), JOB_COUNT);
+
+	runJobs(&pool, &stats);
+
+	// Job 0 on the caller, each other job always on the same thread
+	for (int job = 0; job < JOB_COUNT; job++) {
+		CHECK_EQ(stats.mJobRuns[job], RUN_COUNT);
+		CHECK_EQ(stats.mJobThreads[job].size(), 1);
+		CHECK_EQ(stats.mCallerJobs[job], job == 0 ? RUN_COUNT : 0);
+	}
+
+	pool.stop();
+	CHECK_EQ(initCount, JOB_COUNT - 1);
+}
+
+void checkDedicated()
+{
+	std::atomic<int> initCount(0);
+	WorkerPool pool;
+	RunStats stats;
+	int ret;
+
+	ret = pool.start(JOB_COUNT, true, [&initCount] () { initCount++; });
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(pool.getJobCount(), JOB_COUNT);
+
+	runJobs(&pool, &stats);
+
+	// The caller only waits
+	for (int job = 0; job < JOB_COUNT; job++) {
+		CHECK_EQ(stats.mJobRuns[job], RUN_COUNT);
+		CHECK_EQ(stats.mJobThreads[job].size(), 1);
+		CHECK_EQ(stats.mCallerJobs[job], 0);
+	}
+
+	pool.stop();
+	CHECK_EQ(initCount, JOB_COUNT);
+
+	// A single dedicated job still gets its thread
+	RunStats singleStats;
+
+	ret = pool.start(1, true, nullptr);
+	CHECK_EQ(ret, 0);
+	CHECK_EQ(pool.getJobCount(), 1);
+
+	runJobs(&pool, &singleStats);
+	CHECK_EQ(singleStats.mJobRuns[0], RUN_COUNT);
+	CHECK_EQ(singleStats.mCallerJobs[0], 0);
+}
+
+void checkRestart()
+{
+	WorkerPool pool;
+
+	for (bool dedicated : { false, true }) {
+		for (int i = 0; i < 3; i++) {
+			RunStats stats;
+			int ret;
+
+			ret = pool.start(JOB_COUNT, dedicated, nullptr);
+			CHECK_EQ(ret, 0);
+			if (ret < 0)
+				return;
+
+			// Workers wait for the first run of this start
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+			runJobs(&pool, &stats);
+			for (int job = 0; job < JOB_COUNT; job++)
+				CHECK_EQ(stats.mJobRuns[job], RUN_COUNT);
+
+			CHECK_EQ(pool.stop(), 0);
+		}
+	}
+}
+
+void checkErrors()
+{
+	WorkerPool pool;
+	RunStats stats;
+
+	CHECK_EQ(pool.start(0), -EINVAL);
+
+	CHECK_EQ(pool.start(2), 0);
+	CHECK_EQ(pool.start(2), -EPERM);
+	CHECK_EQ(pool.stop(), 0);
+	CHECK_EQ(pool.stop(), 0);
+
+	// Without thread, run() is a plain call
+	CHECK_EQ(pool.start(1), 0);
+	runJobs(&pool, &stats);
+	CHECK_EQ(stats.mJobRuns[0], RUN_COUNT);
+	CHECK_EQ(stats.mCallerJobs[0], RUN_COUNT);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	checkShared();
+	checkDedicated();
+	checkRestart();
+	checkErrors();
+
+	return testResult("workerpool");
+}
@@ -9,6 +9,7 @@ import math
 import jinja2
 import re
 from ssr.parser import Parser
+from ssr.stats import jitterPercentiles
 
 DEFAULT_STRUCTNAME = 'processstats'
 DEFAULT_SAMPLENAME = 'cpuload'
@@ -59,6 +60,15 @@ class AcqDurationHandler:
 	def __init__(self):
 		self.totalAcqTime = 0
 		self.sampleCount = 0
+		self.missedCount = 0
+		self.reopenCount = 0
+		self.skippedCount = 0
+		self.maxThreadFds = 0
+		self.spans = []
+		self.latenesses = []
+		self.submitTime = 0
+		self.reapTime = 0
+		self.uringSampleCount = 0
 
 	def handleSample(self, sample):
 		acqTime = (sample['end'] - sample['start']) / 1000
@@ -66,10 +76,92 @@ class AcqDurationHandler:
 
 		self.totalAcqTime += acqTime
 		self.sampleCount += 1
+		self.spans.append(acqTime)
+
+		# Older records don't have this field
+		self.missedCount += sample.get('missedticks', 0)
+		self.reopenCount += sample.get('reopencount', 0)
+		self.skippedCount += sample.get('skippedreads', 0)
+		self.maxThreadFds = max(self.maxThreadFds, sample.get('threadfds', 0))
+		if 'ticklateness' in sample:
+			self.latenesses.append(sample['ticklateness'] / 1000)
+
+		# io_uring only, see ReadBackend
+		if sample.get('readbackend', 0) == 1 and 'submittime' in sample:
+			self.submitTime += sample['submittime'] / 1000
+			self.reapTime += sample['reaptime'] / 1000
+			self.uringSampleCount += 1
 
 	def printStats(self):
 		average = self.totalAcqTime / self.sampleCount
 		print('Average acquisition time : %d us' % average)
+		print('Missed acquisitions : %d' % self.missedCount)
+		print('Thread fds : %d max, %d reopens per acquisition' %
+		      (self.maxThreadFds, self.reopenCount / self.sampleCount))
+		print('Idle thread reads skipped : %d per acquisition' %
+		      (self.skippedCount / self.sampleCount))
+		if self.uringSampleCount:
+			print('io_uring : %d us submitting, %d us reaping per acquisition' %
+			      (self.submitTime / self.uringSampleCount,
+			       self.reapTime / self.uringSampleCount))
+
+		# Jitter report
+		print('Acquisition span : p50 %d us, p99 %d us, max %d us' %
+		      jitterPercentiles(self.spans))
+		if self.latenesses:
+			print('Tick lateness : p50 %d us, p99 %d us, max %d us' %
+			      jitterPercentiles(self.latenesses))
+
+class ProcessExitHandler:
+	def __init__(self):
+		self.exitCount = 0
+
+	def handleSample(self, sample):
+		self.exitCount += 1
+
+	def printStats(self):
+		print('Process exits : %d' % self.exitCount)
+
+class SheddingHandler:
+	def __init__(self):
+		self.steps = []
+
+	def handleSample(self, sample):
+		self.steps.append(sample)
+
+	def printStats(self):
+		print('Load shedding steps : %d' % len(self.steps))
+		for step in self.steps:
+			if step['shedpriority'] == -2**31:
+				priority = 'none'
+			else:
+				priority = '<= %d' % step['shedpriority']
+
+			print('  ts %u - acquisition %d us : threads %s, processes shed %s, period x%d' %
+			      (step['ts'], step['duration'] / 1000,
+			       'off' if step['threadsshed'] else 'on',
+			       priority, step['periodfactor']))
+
+class CadenceHandler:
+	REASONS = ['idle', 'load', 'pressure']
+
+	def __init__(self):
+		self.changes = []
+
+	def handleSample(self, sample):
+		self.changes.append(sample)
+
+	def printStats(self):
+		print('Cadence changes : %d' % len(self.changes))
+		for change in self.changes:
+			if change['load'] < 0:
+				load = 'unknown'
+			else:
+				load = '%.1f%%' % (change['load'] / 10)
+
+			print('  ts %u - period %d ms : %s, cpu load %s' %
+			      (change['ts'], change['periodms'],
+			       self.REASONS[change['reason']], load))
 
 class SystemStatsHandler:
 	SAMPLENAME = 'systemstats'
@@ -122,8 +214,15 @@ class ProcStatsHandler:
 		}
 
 	def handleCpuload(self, ts, sampleName, lastSample, sample):
-		keyList = ['utime', 'stime']
-		cpuload = Helpers.computeCpuLoad(lastSample, sample, self.sysconfig, keyList)
+		# Thread records have finer CPU times in nanoseconds
+		if 'utimens' in sample:
+			keyList = ['utimens', 'stimens']
+			ns = Helpers.computeTicks(lastSample, sample, keyList)
+			cpuload = float(ns) / float(ts - lastSample['ts']) * 100
+		else:
+			keyList = ['utime', 'stime']
+			cpuload = Helpers.computeCpuLoad(lastSample, sample, self.sysconfig, keyList)
+
 		self.samples.addSample(sampleName, ts, cpuload)
 
 	def handleVSize(self, ts, sampleName, lastSample, sample):
@@ -458,6 +557,15 @@ if __name__ == '__main__':
 	acqDurationHandler = AcqDurationHandler()
 	evtHandler.registerSectionHandler('acqduration', acqDurationHandler)
 
+	processExitHandler = ProcessExitHandler()
+	evtHandler.registerSectionHandler('processexit', processExitHandler)
+
+	sheddingHandler = SheddingHandler()
+	evtHandler.registerSectionHandler('shedding', sheddingHandler)
+
+	cadenceHandler = CadenceHandler()
+	evtHandler.registerSectionHandler('cadence', cadenceHandler)
+
 	# Create user-required handler
 	try:
 		handlerCreateCb = handlers[args.struct]
@@ -478,5 +586,8 @@ if __name__ == '__main__':
 
 	# Display general stats
 	acqDurationHandler.printStats()
+	processExitHandler.printStats()
+	sheddingHandler.printStats()
+	cadenceHandler.printStats()
 	samples.printStats()
 
@@ -76,7 +76,7 @@ def readI32(f):
 	if len(b) < 4:
 		raise EOFException
 
-	(v, ) = struct.unpack('!I', b)
+	(v, ) = struct.unpack('!i', b)
 	return v
 
 def readU64(f):
@@ -244,9 +244,11 @@ if __name__ == '__main__':
 		print(name, data)
 
 	if len(sys.argv) < 2:
-		print('Usage : %s <logfile>' % (sys.argv[1]))
+		print('Usage : %s <logfile>' % (sys.argv[0]))
 		sys.exit(1)
 
-	parser = Parser(recordRead)
-	parser.parse(sys.argv[1])
+	parser = Parser()
+	parser.open(sys.argv[1])
+	parser.printHeader()
+	parser.parse(recordRead)
 
@@ -0,0 +1,15 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+def percentile(sortedValues, p):
+	# Nearest rank : smallest value with at least p% of the values under
+	# or equal to it
+	rank = (len(sortedValues) * p + 99) // 100
+
+	return sortedValues[max(rank, 1) - 1]
+
+def jitterPercentiles(values):
+	# p50, p99 and max of a non empty list
+	values = sorted(values)
+
+	return (percentile(values, 50), percentile(values, 99), values[-1])